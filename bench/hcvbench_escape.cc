@@ -0,0 +1,162 @@
+/****************************************************************
+ * file bench/hcvbench_escape.cc
+ *
+ * Description:
+ *      HTML encoding of https://github.com/bstarynk/helpcovid, vector
+ *      against scalar: cross-check their outputs then measure both.
+ *      Usage: hcvbench_escape [-n ITERATIONS]
+ *      e.g. make bench-escape
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+
+typedef void hcvbench_encoder_sig_t(std::string&outstr, const char*str, size_t len);
+
+static double
+hcvbench_clock(void)
+{
+  struct timespec ts = {0,0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + 1.0e-9*ts.tv_nsec;
+} // end hcvbench_clock
+
+
+/// some text of len bytes with about one special character every
+/// period bytes, none when period is 0
+static std::string
+hcvbench_make_input(std::mt19937&rng, size_t len, unsigned period)
+{
+  static const char specials[] = "<>&'\"";
+  static const char plain[] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJ 0123456789.,;:-\n";
+  std::string str(len, ' ');
+  for (size_t ix = 0; ix < len; ix++)
+    {
+      if (period > 0 && rng() % period == 0)
+        str[ix] = specials[rng() % (sizeof(specials)-1)];
+      else
+        str[ix] = plain[rng() % (sizeof(plain)-1)];
+    }
+  return str;
+} // end hcvbench_make_input
+
+
+/// compare both encoders on every length and offset of a short
+/// input, then on random slices of a large one, to exercise the
+/// vector loops and their scalar tails
+static bool
+hcvbench_cross_check(std::mt19937&rng)
+{
+  long nbcheck = 0;
+  for (unsigned period: {0u, 2u, 7u, 61u})
+    {
+      std::string str = hcvbench_make_input(rng, 200, period);
+      for (size_t off = 0; off < 40; off++)
+        for (size_t len = 0; off + len <= str.size(); len++)
+          {
+            std::string vecout, scalout;
+            hcv_append_encoded_html(vecout, str.data()+off, len);
+            hcv_append_encoded_html_scalar(scalout, str.data()+off, len);
+            nbcheck++;
+            if (vecout != scalout)
+              {
+                fprintf(stderr, "mismatch at period %u offset %zu length %zu\n",
+                        period, off, len);
+                return false;
+              }
+          }
+      std::string big = hcvbench_make_input(rng, 70*1024, period);
+      for (int cnt = 0; cnt < 2000; cnt++)
+        {
+          size_t off = rng() % big.size();
+          size_t len = rng() % (big.size() - off + 1);
+          std::string vecout, scalout;
+          hcv_append_encoded_html(vecout, big.data()+off, len);
+          hcv_append_encoded_html_scalar(scalout, big.data()+off, len);
+          nbcheck++;
+          if (vecout != scalout)
+            {
+              fprintf(stderr, "mismatch at period %u offset %zu length %zu\n",
+                      period, off, len);
+              return false;
+            }
+        }
+    }
+  printf("cross-check: %ld vector encodings identical to scalar ones\n", nbcheck);
+  return true;
+} // end hcvbench_cross_check
+
+
+/// megabytes per second of encoding str nbiter times
+static double
+hcvbench_measure(hcvbench_encoder_sig_t*encoder, const std::string&str, long nbiter)
+{
+  std::string out;
+  out.reserve(2*str.size());
+  double start = hcvbench_clock();
+  for (long it = 0; it < nbiter; it++)
+    {
+      out.clear();
+      encoder(out, str.data(), str.size());
+      asm volatile("" : : "r"(out.data()) : "memory");
+    }
+  double elapsed = hcvbench_clock() - start;
+  return (str.size() * (double)nbiter) / (1.0e6 * elapsed);
+} // end hcvbench_measure
+
+
+int
+main(int argc, char**argv)
+{
+  long nbiter = 0;
+  if (argc > 2 && !strcmp(argv[1], "-n"))
+    nbiter = atol(argv[2]);
+  else if (argc > 1)
+    {
+      fprintf(stderr, "usage: %s [-n ITERATIONS]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  std::mt19937 rng(31415);
+  if (!hcvbench_cross_check(rng))
+    return EXIT_FAILURE;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  printf("vector encoder: %s\n", __builtin_cpu_supports("avx2") ? "AVX2" : "SSE2");
+#else
+  printf("vector encoder: none, scalar only\n");
+#endif /*__x86_64__*/
+  printf("%8s %14s %12s %12s %8s\n", "size", "special every", "scalar MB/s", "vector MB/s", "speedup");
+  for (size_t size: {1024, 4096, 16384, 65536})
+    for (unsigned period: {0u, 100u, 10u})
+      {
+        std::string str = hcvbench_make_input(rng, size, period);
+        long itercnt = nbiter > 0 ? nbiter : (long) ((256L << 20) / size);
+        double scalrate = hcvbench_measure(hcv_append_encoded_html_scalar, str, itercnt);
+        double vecrate = hcvbench_measure(hcv_append_encoded_html, str, itercnt);
+        printf("%8zu %14s %12.1f %12.1f %7.2fx\n", size,
+               period ? std::to_string(period).c_str() : "never",
+               scalrate, vecrate, vecrate / scalrate);
+      }
+  return EXIT_SUCCESS;
+} // end main
+
+//////////////////// end of file bench/hcvbench_escape.cc of github.com/bstarynk/helpcovid
@@ -0,0 +1,159 @@
+/****************************************************************
+ * file bench/hcvbench_template.cc
+ *
+ * Description:
+ *      Throughput of the template expansion of https://github.com/bstarynk/helpcovid,
+ *      through hcv_expand_template_file, hcv_expand_template_input_stream
+ *      and hcv_expand_template_string, with stub HTTP template data.
+ *      Usage: hcvbench_template [-n ITERATIONS] FILE.html...
+ *      e.g. make bench-template
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+
+/// template data of a fake GET request, accepting English only
+class Hcv_bench_template_data : public Hcv_http_template_data
+{
+  static const std::shared_ptr<const std::vector<std::string>> _hcvbench_languages;
+public:
+  Hcv_bench_template_data(const httplib::Request& req, httplib::Response&resp, long reqnum)
+    : Hcv_http_template_data(req, resp, reqnum) {};
+  virtual std::shared_ptr<const std::vector<std::string>> request_languages(void) const
+  {
+    return _hcvbench_languages;
+  };
+  virtual ~Hcv_bench_template_data() {};
+};				// end class Hcv_bench_template_data
+
+const std::shared_ptr<const std::vector<std::string>>
+Hcv_bench_template_data::_hcvbench_languages
+  = std::make_shared<const std::vector<std::string>>(std::vector<std::string> {"en"});
+
+enum hcvbench_path_en
+{
+  hcvbench_file,
+  hcvbench_stream,
+  hcvbench_string,
+  hcvbench__nbpaths
+};
+
+static const char*const hcvbench_path_names[hcvbench__nbpaths] =
+{
+  "file", "input_stream", "string"
+};
+
+static double
+hcvbench_clock(void)
+{
+  struct timespec ts = {0,0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + 1.0e-9*ts.tv_nsec;
+} // end hcvbench_clock
+
+
+static std::string
+hcvbench_expand(hcvbench_path_en path, const std::string&filepath,
+                const std::string&src, long reqnum)
+{
+  httplib::Request req;
+  httplib::Response resp;
+  req.method = "GET";
+  req.path = "/bench.html";
+  Hcv_bench_template_data data(req, resp, reqnum);
+  switch (path)
+    {
+    case hcvbench_file:
+      return hcv_expand_template_file(filepath, &data);
+    case hcvbench_stream:
+    {
+      std::istringstream inp(src);
+      return hcv_expand_template_input_stream(inp, filepath.c_str(), &data);
+    }
+    case hcvbench_string:
+      return hcv_expand_template_string(src, filepath.c_str(), &data);
+    default:
+      HCV_FATALOUT("hcvbench_expand: bad path #" << (int)path);
+    }
+} // end hcvbench_expand
+
+
+int
+main(int argc, char**argv)
+{
+  long nbiter = 2000;
+  int argix = 1;
+  if (argc > 2 && !strcmp(argv[1], "-n"))
+    {
+      nbiter = atol(argv[2]);
+      argix = 3;
+    }
+  if (argix >= argc || nbiter <= 0)
+    {
+      fprintf(stderr, "usage: %s [-n ITERATIONS] FILE.html...\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  hcv_initialize_templates();
+  size_t totalbytes = 0;
+  double totaltime[hcvbench__nbpaths] = {0.0, 0.0, 0.0};
+  printf("%-28s %7s", "template", "bytes");
+  for (int p = 0; p < hcvbench__nbpaths; p++)
+    printf(" %14s", hcvbench_path_names[p]);
+  printf("   (MB/s of source)\n");
+  long reqnum = 0;
+  for (int ix = argix; ix < argc; ix++)
+    {
+      char*abspath = realpath(argv[ix], nullptr);
+      std::ifstream inp(argv[ix]);
+      if (!abspath || !inp)
+        {
+          fprintf(stderr, "%s: cannot open %s (%m)\n", argv[0], argv[ix]);
+          return EXIT_FAILURE;
+        }
+      std::string filepath(abspath);
+      free(abspath);
+      std::ostringstream srcout;
+      srcout << inp.rdbuf();
+      std::string src = srcout.str();
+      totalbytes += src.size() * nbiter;
+      printf("%-28s %7zu", argv[ix], src.size());
+      for (int p = 0; p < hcvbench__nbpaths; p++)
+        {
+          /// warm up, e.g. the compiled template cache and the variants
+          (void) hcvbench_expand((hcvbench_path_en)p, filepath, src, ++reqnum);
+          double start = hcvbench_clock();
+          for (long it = 0; it < nbiter; it++)
+            (void) hcvbench_expand((hcvbench_path_en)p, filepath, src, ++reqnum);
+          double elapsed = hcvbench_clock() - start;
+          totaltime[p] += elapsed;
+          printf(" %14.2f", (src.size() * nbiter) / (1.0e6 * elapsed));
+        }
+      printf("\n");
+    }
+  printf("%-28s %7s", "total", "");
+  for (int p = 0; p < hcvbench__nbpaths; p++)
+    printf(" %14.2f", totalbytes / (1.0e6 * totaltime[p]));
+  printf("\n");
+  return EXIT_SUCCESS;
+} // end main
+
+//////////////////// end of file bench/hcvbench_template.cc of github.com/bstarynk/helpcovid
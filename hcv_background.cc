@@ -39,22 +39,94 @@ int hcv_bg_event_fd;
 int hcv_bg_signal_fd;
 int hcv_bg_timer_fd;
 
+/// Postponed tasks are kept in a hierarchical timer wheel with ticks
+/// of 10 milliseconds: three levels of 256 slots, covering 2.56
+/// seconds, 655 seconds and 46 hours. Each slot is a singly linked
+/// list of todo nodes, so insertion is O(1).  Nodes of the two upper
+/// levels are moved down a level when the lower level wraps
+/// around. The hcv_bg_timer_fd is armed at the next tick having due
+/// tasks (or the next cascade), and every due task runs when it expires.
+///
+/// The wheel belongs to the background thread.  Other threads submit
+/// their tasks thru a lock-free multi-producer single-consumer queue
+/// (Dmitry Vyukov's intrusive MPSC queue, see
+/// https://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue)
+/// and write hcv_bg_event_fd only when no wakeup is already pending;
+/// the background thread then drains the whole queue into the wheel.
 struct hcv_todo_st
 {
-  double hcvtodo_time;		// elapsed monotonic time
+  std::atomic<hcv_todo_st*> hcvtodo_qnext; // next in the submission queue
+  hcv_todo_st* hcvtodo_next;	// next in the same wheel slot, or due
+  long hcvtodo_tick;		// expiring tick
   void* hcvtodo_data;		// data pointer
   std::function<void(void*)> hcvtodo_func;
+  std::string hcvtodo_name;
+  struct hcv_task_class_st* hcvtodo_class; // when run by a worker, or null
+  double hcvtodo_queuetime;	// monotonic time when queued for a worker
 };
-std::map<double, hcv_todo_st> hcv_todo_map;
-std::recursive_mutex hcv_todo_mtx;
-#define HCV_MAX_TODO 1024
-
+#define HCV_TODO_TICK 0.01 /*seconds*/
+#define HCV_TODO_WHEEL_BITS 8
+#define HCV_TODO_WHEEL_SIZE (1<<HCV_TODO_WHEEL_BITS)
+#define HCV_TODO_WHEEL_MASK (HCV_TODO_WHEEL_SIZE-1)
+#define HCV_TODO_NB_LEVELS 3
+#define HCV_MAX_TODO (1L<<20)
+/// only used in the background thread
+static hcv_todo_st* hcv_todo_wheel[HCV_TODO_NB_LEVELS][HCV_TODO_WHEEL_SIZE];
+static long hcv_todo_current_tick;	// every earlier tick has been run
+static long hcv_todo_wheel_count;	// number of tasks in the wheel
+static long hcv_todo_armed_tick;	// tick for which hcv_bg_timer_fd is armed, or 0
+/// the submission queue, pushed at its head and popped at its tail
+static hcv_todo_st hcv_todo_queue_stub;
+static std::atomic<hcv_todo_st*> hcv_todo_queue_head(&hcv_todo_queue_stub);
+static hcv_todo_st* hcv_todo_queue_tail = &hcv_todo_queue_stub;
+static std::atomic<bool> hcv_todo_wakeup_pending;
+static std::atomic<long> hcv_todo_pending_count; // queued or in the wheel
+
+static void hcv_todo_run_due(void);
+
+
+/// Tasks given a task class are not run by the background thread
+/// itself, but by a small pool of worker threads (background_workers
+/// in the [helpcovid] configuration group, default 2), so a slow task
+/// (e.g. sending an email thru popen) does not delay signal handling
+/// and the other timers. Each task class has its own queue and a limit
+/// of concurrently running tasks, by default 1, overridden by the
+/// class name key in the [background_tasks] configuration group.
+struct hcv_task_class_st
+{
+  std::string hcvtcl_name;
+  int hcvtcl_limit;		// maximal number of running tasks
+  int hcvtcl_running;		// currently running tasks
+  std::deque<hcv_todo_st*> hcvtcl_queue;
+  long hcvtcl_completed;
+  double hcvtcl_total_wait;	// cumulated queue wait, in seconds
+  double hcvtcl_max_wait;
+  double hcvtcl_total_run;	// cumulated running time, in seconds
+};
+#define HCV_WORKERS_DEFAULT_COUNT 2
+#define HCV_WORKERS_MAX_COUNT 32
+#define HCV_CLEANUP_PERIOD 300.0 /*seconds*/
+#define HCV_CLEANUP_RETRY_DELAY 10.0 /*seconds, when the budget was exhausted*/
+static std::mutex hcv_worker_mtx;
+static std::condition_variable hcv_worker_cond;
+static std::map<std::string,hcv_task_class_st*> hcv_task_class_map;
+static std::vector<hcv_task_class_st*> hcv_task_class_vec; // for round robin
+static unsigned hcv_task_class_rank;
+static std::vector<std::thread> hcv_worker_threads;
+static bool hcv_workers_stopping;
+
+static hcv_task_class_st* hcv_get_task_class(const std::string&clname);
+static void hcv_worker_submit(hcv_todo_st*todo);
+
+static void hcv_start_background_workers(void);
 void hcv_process_SIGTERM_signal(void);
 void hcv_process_SIGXCPU_signal(void);
 void hcv_process_SIGHUP_signal(void);
+void hcv_process_SIGUSR1_signal(void);
 void hcv_bg_do_event(int64_t); // handle one event on hcv_bg_event_fd
 
 #define HCV_BACKGROUND_TICK_TIMEOUT 16384 /*milliseconds*/
+#define HCV_BACKGROUND_TRACING_TIMEOUT 1000 /*milliseconds, to dump traces*/
 void hcv_background_thread_body(void)
 {
   char thnambuf[16];
@@ -82,6 +154,8 @@ void hcv_background_thread_body(void)
       outs.flush();
       HCV_DEBUGOUT("hcv_background_thread_body signal mask set: " << outs.str());
     }
+  /// tasks could have been postponed before this thread started
+  hcv_todo_run_due();
   /// loop
   while (!hcv_should_stop_bg_thread.load())
     {
@@ -95,7 +169,8 @@ void hcv_background_thread_body(void)
       polltab[2].events = POLL_IN;
       HCV_DEBUGOUT("hcv_background_thread_body before poll");
       int nbfd = poll(polltab, 3,
-                      hcv_debugging.load()?(2*HCV_BACKGROUND_TICK_TIMEOUT):HCV_BACKGROUND_TICK_TIMEOUT);
+                      hcv_tracing.load()?HCV_BACKGROUND_TRACING_TIMEOUT
+                      :hcv_debugging.load()?(2*HCV_BACKGROUND_TICK_TIMEOUT):HCV_BACKGROUND_TICK_TIMEOUT);
       if (nbfd==0)   /* timedout */
         {
           static long cnt;
@@ -174,6 +249,13 @@ void hcv_background_thread_body(void)
                   hcv_process_SIGXCPU_signal();
                   hcv_should_stop_bg_thread.store (true);
                 }
+              else if  (signalinfo.ssi_signo == SIGUSR1)
+                {
+                  HCV_SYSLOGOUT(LOG_NOTICE, "hcv_background_thread_body got SIGUSR1 at "
+                                << (hcv_monotonic_real_time() - hcv_monotonic_start_time)
+                                << " elapsed seconds");
+                  hcv_process_SIGUSR1_signal();
+                }
               else if  (signalinfo.ssi_signo == SIGPIPE)
                 {
                   HCV_SYSLOGOUT(LOG_NOTICE, "hcv_background_thread_body got SIGPIPE at "
@@ -198,15 +280,18 @@ void hcv_background_thread_body(void)
                 HCV_FATALOUT("hcv_background_thread_body: corrupted read of hcv_bg_timer_fd="
                              << hcv_bg_timer_fd << ", byrd=" << byrd);
               HCV_DEBUGOUT("hcv_background_thread_body got nbexpir=" << nbexpir);
-#warning hcv_background_thread_body does not handle hcv_bg_timer_fd properly
-              HCV_SYSLOGOUT(LOG_INFO, "hcv_background_thread_body unimplemented timer, nbexpir=" << nbexpir
-                            << " hcv_bg_timer_fd=" << hcv_bg_timer_fd);
+              hcv_todo_run_due();
             }
         }
       else
         {
           HCV_FATALOUT("hcv_background_thread_body: poll failed");
         }
+      if (!hcv_should_stop_bg_thread.load())
+        {
+          hcv_session_periodic_flush();
+          hcv_trace_periodic_dump();
+        }
     }
   HCV_SYSLOGOUT(LOG_INFO, "hcv_background_thread_body ending thread " << thnambuf);
 } // end hcv_background_thread_body
@@ -230,6 +315,7 @@ hcv_start_background_thread(void)
     sigaddset(&sigmaskbits, SIGHUP);
     sigaddset(&sigmaskbits, SIGXCPU);
     sigaddset(&sigmaskbits, SIGPIPE);
+    sigaddset(&sigmaskbits, SIGUSR1);
     /// http://man7.org/linux/man-pages/man2/sigprocmask.2.html
     ///  https://stackoverflow.com/a/61374592/841108
     if (sigprocmask(SIG_BLOCK, &sigmaskbits, nullptr))
@@ -246,6 +332,12 @@ hcv_start_background_thread(void)
     HCV_FATALOUT("hcv_start_background_thread:timerfd_create failure");
   HCV_DEBUGOUT("hcv_start_background_thread hcv_bg_timer_fd=" << hcv_bg_timer_fd);
   //////
+  hcv_start_background_workers();
+  hcv_do_postpone_background_task(HCV_CLEANUP_PERIOD, "cleanup", "periodic cleanup", nullptr,
+                                  [](void*)
+  {
+    hcv_background_periodic_cleanup();
+  });
   hcv_bgthread = std::thread([]()
   {
     hcv_background_thread_body();
@@ -267,6 +359,22 @@ hcv_stop_background_thread(void)
 } // end hcv_stop_background_thread
 
 
+/// called by main before returning, since static std::thread-s still
+/// joinable at exit would call std::terminate
+void
+hcv_join_background_thread(void)
+{
+  if (hcv_bgthread.joinable())
+    {
+      if (!hcv_should_stop_bg_thread.load())
+        hcv_stop_background_thread();
+      hcv_bgthread.join();
+    }
+  hcv_stop_background_workers();
+  HCV_DEBUGOUT("hcv_join_background_thread done");
+} // end hcv_join_background_thread
+
+
 
 /////////////////////////////// Unix signal processing thru signalfd(2)
 ////////// see http://man7.org/linux/man-pages/man7/signal.7.html
@@ -275,13 +383,9 @@ void
 hcv_process_SIGTERM_signal(void)
 {
   HCV_DEBUGOUT("start of hcv_process_SIGTERM_signal");
+  /// the listen of hcv_webserver_run returns, then main joins this
+  /// thread and does the final session flush and database close
   hcv_stop_web();
-  hcv_close_database();
-  HCV_SYSLOGOUT(LOG_NOTICE, "HelpCovid terminating on " << hcv_get_hostname()
-                << " process " << (int)getpid()
-                << " built " << hcv_timestamp << std::endl
-                << "... md5sum " << hcv_md5sum
-                << " lastgitcommit " << hcv_lastgitcommit);
 } // end hcv_process_SIGTERM_signal
 
 
@@ -297,48 +401,251 @@ hcv_process_SIGXCPU_signal(void)
 void
 hcv_process_SIGHUP_signal(void)
 {
-  HCV_FATALOUT("hcv_process_SIGHUP_signal unimplemented");
-#warning hcv_process_SIGHUP_signal unimplemented
-  /* we want to flush the database */
+  /// the reload happens in the background thread, so web requests
+  /// keep being served with the previous snapshots meanwhile
+  hcv_reload_configuration();
 } // end hcv_process_SIGHUP_signal
 
 
-// process eventfd, and also SIGPIPE
+/// SIGUSR1 toggles the tracing of spans, see file hcv_trace.cc
 void
-hcv_bg_do_event(int64_t ev)
+hcv_process_SIGUSR1_signal(void)
 {
-  HCV_DEBUGOUT("hcv_bg_do_event ev=" << ev);
-  std::lock_guard<std::recursive_mutex> gu(hcv_todo_mtx);
-  auto beg = hcv_todo_map.begin();
-  if (beg == hcv_todo_map.end())
+  if (hcv_tracing.load())
+    hcv_stop_tracing();
+  else
+    hcv_start_tracing();
+} // end hcv_process_SIGUSR1_signal
+
+
+static inline long
+hcv_todo_tick_of_time(double montime)
+{
+  return (long) std::ceil(montime / HCV_TODO_TICK);
+} // end hcv_todo_tick_of_time
+
+
+/// put a node in its wheel slot; a node expiring before mintick is
+/// delayed to it
+static void
+hcv_todo_insert(hcv_todo_st*todo, long mintick)
+{
+  if (todo->hcvtodo_tick < mintick)
+    todo->hcvtodo_tick = mintick;
+  long delta = todo->hcvtodo_tick - hcv_todo_current_tick;
+  int lev = 0;
+  while (lev < HCV_TODO_NB_LEVELS-1
+         && delta >= (1L << (HCV_TODO_WHEEL_BITS*(lev+1))))
+    lev++;
+  int slot = (todo->hcvtodo_tick >> (HCV_TODO_WHEEL_BITS*lev)) & HCV_TODO_WHEEL_MASK;
+  todo->hcvtodo_next = hcv_todo_wheel[lev][slot];
+  hcv_todo_wheel[lev][slot] = todo;
+} // end hcv_todo_insert
+
+
+/// move the nodes of an upper level slot to lower levels, when
+/// hcv_todo_current_tick has just been incremented but its level 0
+/// slot is not yet run
+static void
+hcv_todo_cascade(int lev, int slot)
+{
+  hcv_todo_st*todo = hcv_todo_wheel[lev][slot];
+  hcv_todo_wheel[lev][slot] = nullptr;
+  while (todo)
+    {
+      hcv_todo_st*next = todo->hcvtodo_next;
+      hcv_todo_insert(todo, hcv_todo_current_tick);
+      todo = next;
+    }
+} // end hcv_todo_cascade
+
+
+/// arm hcv_bg_timer_fd for the next tick with due tasks, or for the next
+/// cascade of the upper levels
+static void
+hcv_todo_arm_timer(void)
+{
+  if (hcv_bg_timer_fd <= 0)
+    return;
+  long nextick = 0;
+  if (hcv_todo_wheel_count > 0)
+    {
+      for (long t = hcv_todo_current_tick+1;
+           t <= hcv_todo_current_tick+HCV_TODO_WHEEL_SIZE; t++)
+        {
+          if (hcv_todo_wheel[0][t & HCV_TODO_WHEEL_MASK])
+            {
+              nextick = t;
+              break;
+            }
+          if ((t & HCV_TODO_WHEEL_MASK) == 0)
+            {
+              nextick = t;	// a cascade could bring some due tasks
+              break;
+            }
+        }
+    }
+  if (nextick == hcv_todo_armed_tick)
     return;
-  {
-    auto todo = beg->second;
-    hcv_todo_map.erase(beg);
-    todo.hcvtodo_func(todo.hcvtodo_data);
-    beg = hcv_todo_map.begin();
-    if (beg == hcv_todo_map.end())
-      return;
-  }
-  auto todonext =  beg->second;
-  double nextim = todonext.hcvtodo_time;
-  double fractim=0.0, itim=0.0;
-  fractim= std::modf(nextim,&itim);
   struct itimerspec ts;
   memset(&ts, 0, sizeof(ts));
-  ts.it_value.tv_sec = (time_t)itim;
-  ts.it_value.tv_nsec = (long)(fractim*1.0e9);
-  ts.it_interval.tv_sec = 0;
-  ts.it_interval.tv_nsec = 0;
-  if (timerfd_settime(hcv_bg_timer_fd,TFD_TIMER_ABSTIME, &ts, nullptr))
-    HCV_FATALOUT("hcv_do_event timerfd_settime failure");
+  if (nextick > 0)
+    {
+      double nextim = nextick * HCV_TODO_TICK;
+      double fractim=0.0, itim=0.0;
+      fractim= std::modf(nextim,&itim);
+      ts.it_value.tv_sec = (time_t)itim;
+      ts.it_value.tv_nsec = (long)(fractim*1.0e9);
+      if (ts.it_value.tv_sec == 0 && ts.it_value.tv_nsec == 0)
+        ts.it_value.tv_nsec = 1;
+    }
+  if (timerfd_settime(hcv_bg_timer_fd, TFD_TIMER_ABSTIME, &ts, nullptr))
+    HCV_FATALOUT("hcv_todo_arm_timer timerfd_settime failure");
+  hcv_todo_armed_tick = nextick;
+} // end hcv_todo_arm_timer
+
+
+/// push a submitted task, from any thread
+static void
+hcv_todo_queue_push(hcv_todo_st*todo)
+{
+  todo->hcvtodo_qnext.store(nullptr, std::memory_order_relaxed);
+  hcv_todo_st*prev = hcv_todo_queue_head.exchange(todo, std::memory_order_acq_rel);
+  prev->hcvtodo_qnext.store(todo, std::memory_order_release);
+} // end hcv_todo_queue_push
+
+
+/// pop a submitted task, in the background thread; gives null when
+/// empty, or when some producer is in the middle of its push (that
+/// producer then wakes us up again)
+static hcv_todo_st*
+hcv_todo_queue_pop(void)
+{
+  hcv_todo_st*tail = hcv_todo_queue_tail;
+  hcv_todo_st*next = tail->hcvtodo_qnext.load(std::memory_order_acquire);
+  if (tail == &hcv_todo_queue_stub)
+    {
+      if (!next)
+        return nullptr;
+      hcv_todo_queue_tail = next;
+      tail = next;
+      next = next->hcvtodo_qnext.load(std::memory_order_acquire);
+    }
+  if (next)
+    {
+      hcv_todo_queue_tail = next;
+      return tail;
+    }
+  if (tail != hcv_todo_queue_head.load(std::memory_order_acquire))
+    return nullptr;
+  hcv_todo_queue_push(&hcv_todo_queue_stub);
+  next = tail->hcvtodo_qnext.load(std::memory_order_acquire);
+  if (next)
+    {
+      hcv_todo_queue_tail = next;
+      return tail;
+    }
+  return nullptr;
+} // end hcv_todo_queue_pop
+
+
+/// drain submitted tasks into the wheel and run every due postponed
+/// task, in the background thread
+static void
+hcv_todo_run_due(void)
+{
+  hcv_todo_st*duelist = nullptr;
+  long nbdue = 0, nbsubmitted = 0;
+  /// clear the flag before draining, so a task pushed after the drain
+  /// always writes hcv_bg_event_fd
+  hcv_todo_wakeup_pending.store(false);
+  long nowtick = hcv_todo_tick_of_time(hcv_monotonic_real_time());
+  if (hcv_todo_wheel_count == 0)
+    hcv_todo_current_tick = nowtick-1;
+  while (hcv_todo_st*todo = hcv_todo_queue_pop())
+    {
+      hcv_todo_insert(todo, hcv_todo_current_tick+1);
+      hcv_todo_wheel_count++;
+      nbsubmitted++;
+    }
+  hcv_todo_armed_tick = 0;
+  while (hcv_todo_current_tick < nowtick && hcv_todo_wheel_count > nbdue)
+    {
+      long t = ++hcv_todo_current_tick;
+      if ((t & HCV_TODO_WHEEL_MASK) == 0)
+        {
+          int slot1 = (t >> HCV_TODO_WHEEL_BITS) & HCV_TODO_WHEEL_MASK;
+          if (slot1 == 0)
+            hcv_todo_cascade(2, (t >> (2*HCV_TODO_WHEEL_BITS)) & HCV_TODO_WHEEL_MASK);
+          hcv_todo_cascade(1, slot1);
+        }
+      hcv_todo_st*todo = hcv_todo_wheel[0][t & HCV_TODO_WHEEL_MASK];
+      hcv_todo_wheel[0][t & HCV_TODO_WHEEL_MASK] = nullptr;
+      while (todo)
+        {
+          hcv_todo_st*next = todo->hcvtodo_next;
+          todo->hcvtodo_next = duelist;
+          duelist = todo;
+          nbdue++;
+          todo = next;
+        }
+    }
+  if (hcv_todo_current_tick < nowtick && hcv_todo_wheel_count == nbdue)
+    hcv_todo_current_tick = nowtick;
+  hcv_todo_wheel_count -= nbdue;
+  hcv_todo_arm_timer();
+  if (nbdue > 0 || nbsubmitted > 0)
+    HCV_DEBUGOUT("hcv_todo_run_due got " << nbsubmitted << " submitted tasks, running "
+                 << nbdue << " tasks");
+  while (duelist)
+    {
+      hcv_todo_st*todo = duelist;
+      duelist = todo->hcvtodo_next;
+      if (todo->hcvtodo_class)
+        {
+          hcv_worker_submit(todo);
+          continue;
+        }
+      try
+        {
+          todo->hcvtodo_func(todo->hcvtodo_data);
+        }
+      catch (const std::exception&exc)
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_todo_run_due: postponed task " << todo->hcvtodo_name
+                        << " failed: " << exc.what());
+        }
+      delete todo;
+      hcv_todo_pending_count--;
+    }
+} // end hcv_todo_run_due
+
+
+// process eventfd, and also SIGPIPE
+void
+hcv_bg_do_event(int64_t ev)
+{
+  HCV_DEBUGOUT("hcv_bg_do_event ev=" << ev);
+  hcv_todo_run_due();
 } // end hcv_bg_do_event
 
 
 
+/// could be called from any thread, without locking; only the first
+/// submission since the last drain writes hcv_bg_event_fd
 void
 hcv_do_postpone_background(double delay,  const std::string&name, void*data,
                            const std::function<void(void*)>& todofun)
+{
+  hcv_do_postpone_background_task(delay, nullptr, name, data, todofun);
+} // end hcv_do_postpone_background
+
+
+/// with a non-null taskclass, the task is run by some worker thread
+void
+hcv_do_postpone_background_task(double delay, const char*taskclass,
+                                const std::string&name, void*data,
+                                const std::function<void(void*)>& todofun)
 {
   if (delay<HCV_POSTPONE_MINIMAL_DELAY)
     delay = HCV_POSTPONE_MINIMAL_DELAY;
@@ -348,28 +655,329 @@ hcv_do_postpone_background(double delay,  const std::string&name, void*data,
     HCV_FATALOUT("hcv_do_postpone_background missing todo: delay="  << delay
                  << ", name=" << name << ", data=" << data);
   double todotime = hcv_monotonic_real_time() + delay;
-  std::lock_guard<std::recursive_mutex> gu(hcv_todo_mtx);
-  if (hcv_todo_map.size() > HCV_MAX_TODO)
-    HCV_FATALOUT("hcv_do_postpone_background: too much todo:" << hcv_todo_map.size());
-  hcv_todo_map.insert({todotime,
-    {.hcvtodo_time=todotime, .hcvtodo_data=data, .hcvtodo_func= todofun}});
-  int64_t one=1;
-  if (write(hcv_bg_event_fd,&one,sizeof(one)) != sizeof(one))
-    HCV_FATALOUT("hcv_do_postpone_background failure to write hcv_bg_event_fd="
-                 << hcv_bg_event_fd);
-} // end hcv_do_postpone_background
+  long nbpending = hcv_todo_pending_count++;
+  if (nbpending >= HCV_MAX_TODO)
+    HCV_FATALOUT("hcv_do_postpone_background: too much todo:" << nbpending);
+  hcv_todo_st*todo = new hcv_todo_st;
+  todo->hcvtodo_next = nullptr;
+  todo->hcvtodo_tick = hcv_todo_tick_of_time(todotime);
+  todo->hcvtodo_data = data;
+  todo->hcvtodo_func = todofun;
+  todo->hcvtodo_name = name;
+  todo->hcvtodo_class = taskclass?hcv_get_task_class(taskclass):nullptr;
+  todo->hcvtodo_queuetime = 0.0;
+  hcv_todo_queue_push(todo);
+  if (!hcv_todo_wakeup_pending.exchange(true) && hcv_bg_event_fd > 0)
+    {
+      int64_t one=1;
+      if (write(hcv_bg_event_fd,&one,sizeof(one)) != sizeof(one))
+        HCV_FATALOUT("hcv_do_postpone_background_task failure to write hcv_bg_event_fd="
+                     << hcv_bg_event_fd);
+    }
+} // end hcv_do_postpone_background_task
+
+
+/// number of postponed tasks, for /status.json
+long
+hcv_background_pending_count(void)
+{
+  return hcv_todo_pending_count.load();
+} // end hcv_background_pending_count
 
 
 
+////////////////////////////////////////////////////////////////
+//// the pool of worker threads
+
+/// find or create a task class, whose limit may be configured
+static hcv_task_class_st*
+hcv_get_task_class(const std::string&clname)
+{
+  {
+    std::lock_guard<std::mutex> gu(hcv_worker_mtx);
+    auto it = hcv_task_class_map.find(clname);
+    if (it != hcv_task_class_map.end())
+      return it->second;
+  }
+  int limit = 1;
+  if (hcv_config_has_group("background_tasks"))
+    hcv_config_do([&](const Glib::KeyFile*kf)
+    {
+      if (kf->has_key("background_tasks", clname))
+        limit = kf->get_integer("background_tasks", clname);
+    });
+  if (limit < 1)
+    limit = 1;
+  std::lock_guard<std::mutex> gu(hcv_worker_mtx);
+  auto it = hcv_task_class_map.find(clname);
+  if (it != hcv_task_class_map.end())
+    return it->second;
+  hcv_task_class_st*tcl = new hcv_task_class_st;
+  tcl->hcvtcl_name = clname;
+  tcl->hcvtcl_limit = limit;
+  tcl->hcvtcl_running = 0;
+  tcl->hcvtcl_completed = 0;
+  tcl->hcvtcl_total_wait = 0.0;
+  tcl->hcvtcl_max_wait = 0.0;
+  tcl->hcvtcl_total_run = 0.0;
+  hcv_task_class_map.insert({clname, tcl});
+  hcv_task_class_vec.push_back(tcl);
+  HCV_DEBUGOUT("hcv_get_task_class new class " << clname << " limit=" << limit);
+  return tcl;
+} // end hcv_get_task_class
+
+
+/// queue a due task for the workers, in the background thread
+static void
+hcv_worker_submit(hcv_todo_st*todo)
+{
+  HCV_ASSERT(todo && todo->hcvtodo_class);
+  todo->hcvtodo_queuetime = hcv_monotonic_real_time();
+  {
+    std::lock_guard<std::mutex> gu(hcv_worker_mtx);
+    todo->hcvtodo_class->hcvtcl_queue.push_back(todo);
+  }
+  hcv_worker_cond.notify_one();
+} // end hcv_worker_submit
+
+
+/// pick a queued task of some class below its limit, round robin
+/// between classes, with hcv_worker_mtx locked
+static hcv_todo_st*
+hcv_worker_pick_locked(void)
+{
+  unsigned nbcl = hcv_task_class_vec.size();
+  for (unsigned ix=0; ix<nbcl; ix++)
+    {
+      hcv_task_class_st*tcl = hcv_task_class_vec[(hcv_task_class_rank+ix) % nbcl];
+      if (!tcl->hcvtcl_queue.empty() && tcl->hcvtcl_running < tcl->hcvtcl_limit)
+        {
+          hcv_task_class_rank = (hcv_task_class_rank+ix+1) % nbcl;
+          hcv_todo_st*todo = tcl->hcvtcl_queue.front();
+          tcl->hcvtcl_queue.pop_front();
+          tcl->hcvtcl_running++;
+          return todo;
+        }
+    }
+  return nullptr;
+} // end hcv_worker_pick_locked
+
+
+static void
+hcv_worker_thread_body(int rank)
+{
+  char thnambuf[16];
+  memset (&thnambuf, 0, sizeof(thnambuf));
+  snprintf(thnambuf, sizeof(thnambuf), "hcovwork%d", rank);
+  pthread_setname_np(pthread_self(), thnambuf);
+  std::unique_lock<std::mutex> lk(hcv_worker_mtx);
+  for (;;)
+    {
+      hcv_todo_st*todo = nullptr;
+      hcv_worker_cond.wait(lk, [&todo]
+      {
+        return hcv_workers_stopping || (todo = hcv_worker_pick_locked()) != nullptr;
+      });
+      if (!todo)
+        break;
+      lk.unlock();
+      double startime = hcv_monotonic_real_time();
+      try
+        {
+          todo->hcvtodo_func(todo->hcvtodo_data);
+        }
+      catch (const std::exception&exc)
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_worker_thread_body: task " << todo->hcvtodo_name
+                        << " of class " << todo->hcvtodo_class->hcvtcl_name
+                        << " failed: " << exc.what());
+        }
+      double endtime = hcv_monotonic_real_time();
+      lk.lock();
+      hcv_task_class_st*tcl = todo->hcvtodo_class;
+      double waitime = startime - todo->hcvtodo_queuetime;
+      tcl->hcvtcl_running--;
+      tcl->hcvtcl_completed++;
+      tcl->hcvtcl_total_wait += waitime;
+      if (waitime > tcl->hcvtcl_max_wait)
+        tcl->hcvtcl_max_wait = waitime;
+      tcl->hcvtcl_total_run += endtime - startime;
+      delete todo;
+      hcv_todo_pending_count--;
+      /// some other task of that class may now run, perhaps on another worker
+      hcv_worker_cond.notify_all();
+    }
+  HCV_DEBUGOUT("hcv_worker_thread_body ending " << thnambuf);
+} // end hcv_worker_thread_body
+
+
+static void
+hcv_start_background_workers(void)
+{
+  int nbworkers = HCV_WORKERS_DEFAULT_COUNT;
+  if (hcv_config_has_group("helpcovid"))
+    hcv_config_do([&nbworkers](const Glib::KeyFile*kf)
+    {
+      if (kf->has_key("helpcovid", "background_workers"))
+        nbworkers = kf->get_integer("helpcovid", "background_workers");
+    });
+  if (nbworkers < 1)
+    nbworkers = 1;
+  else if (nbworkers > HCV_WORKERS_MAX_COUNT)
+    nbworkers = HCV_WORKERS_MAX_COUNT;
+  hcv_workers_stopping = false;
+  for (int ix=0; ix<nbworkers; ix++)
+    hcv_worker_threads.emplace_back(hcv_worker_thread_body, ix);
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_start_background_workers started " << nbworkers << " worker threads");
+} // end hcv_start_background_workers
+
+
+/// let running tasks finish, and forget the queued ones
+void
+hcv_stop_background_workers(void)
+{
+  long nbdropped = 0;
+  {
+    std::lock_guard<std::mutex> gu(hcv_worker_mtx);
+    hcv_workers_stopping = true;
+    for (hcv_task_class_st*tcl: hcv_task_class_vec)
+      {
+        nbdropped += tcl->hcvtcl_queue.size();
+        for (hcv_todo_st*todo: tcl->hcvtcl_queue)
+          delete todo;
+        tcl->hcvtcl_queue.clear();
+      }
+  }
+  hcv_worker_cond.notify_all();
+  for (std::thread&th: hcv_worker_threads)
+    if (th.joinable())
+      th.join();
+  hcv_worker_threads.clear();
+  if (nbdropped > 0)
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_stop_background_workers dropped " << nbdropped << " queued tasks");
+} // end hcv_stop_background_workers
+
+
+std::vector<hcv_task_class_stats_st>
+hcv_background_task_class_statistics(void)
+{
+  std::vector<hcv_task_class_stats_st> vec;
+  std::lock_guard<std::mutex> gu(hcv_worker_mtx);
+  vec.reserve(hcv_task_class_vec.size());
+  for (hcv_task_class_st*tcl: hcv_task_class_vec)
+    vec.push_back({tcl->hcvtcl_name, tcl->hcvtcl_limit, tcl->hcvtcl_running,
+                   (long)tcl->hcvtcl_queue.size(), tcl->hcvtcl_completed,
+                   tcl->hcvtcl_total_wait, tcl->hcvtcl_max_wait, tcl->hcvtcl_total_run});
+  return vec;
+} // end hcv_background_task_class_statistics
+
+
+
+
+////////////////////////////////////////////////////////////////
+//// Database cleanup.  Expired rows are deleted in bounded batches
+//// (cleanup_batch_size in [helpcovid], default 5000 rows per
+//// transaction) until each table is clean or the time budget of the
+//// run is exhausted; the next run continues where it stopped, since
+//// each batch just deletes some expired rows.
+struct hcv_cleanup_step_st
+{
+  const char* hcvclean_table;
+  const char* hcvclean_pstm;
+};
+static const hcv_cleanup_step_st hcv_cleanup_steps[] =
+{
+  {"tb_web_cookie", "purge_web_cookies_pstm"},
+  {"tb_session", "purge_sessions_pstm"},
+  {"tb_email_confirmation", "purge_email_confirmations_pstm"},
+};
+#define HCV_CLEANUP_DEFAULT_BATCH_SIZE 5000
+#define HCV_CLEANUP_DEFAULT_TIME_BUDGET 2.0 /*seconds*/
+#define HCV_DORMANT_USERS_PERIOD 3600.0 /*seconds*/
+static double hcv_last_dormant_users_time;
+
+
+/// run one cleanup within some time budget, and return true if every
+/// table has been purged
+bool
+hcv_run_database_cleanup(double timebudget)
+{
+  long batchsize = HCV_CLEANUP_DEFAULT_BATCH_SIZE;
+  if (hcv_config_has_group("helpcovid"))
+    hcv_config_do([&batchsize](const Glib::KeyFile*kf)
+    {
+      if (kf->has_key("helpcovid", "cleanup_batch_size"))
+        batchsize = kf->get_integer("helpcovid", "cleanup_batch_size");
+    });
+  if (batchsize < 1)
+    batchsize = 1;
+  double startime = hcv_monotonic_real_time();
+  double deadline = startime + timebudget;
+  bool complete = true;
+  std::ostringstream outs;
+  for (const hcv_cleanup_step_st& step: hcv_cleanup_steps)
+    {
+      long nbpurged = 0, nbatches = 0;
+      bool done = false;
+      double stepstart = hcv_monotonic_real_time();
+      while (hcv_monotonic_real_time() < deadline)
+        {
+          long nbrows = hcv_database_purge_batch(step.hcvclean_pstm, batchsize);
+          if (nbrows < 0)
+            break;
+          nbatches++;
+          nbpurged += nbrows;
+          if (nbrows < batchsize)
+            {
+              done = true;
+              break;
+            }
+        }
+      if (!done)
+        complete = false;
+      outs << ' ' << step.hcvclean_table << ':' << nbpurged << " rows in "
+           << nbatches << " batches, " << (hcv_monotonic_real_time() - stepstart) << "s"
+           << (done?";":" (unfinished);");
+    }
+  /// delete_dormant_users() scans users, so run it at most hourly when periodic
+  if (complete && hcv_monotonic_real_time() < deadline
+      && (std::isinf(timebudget)
+          || startime - hcv_last_dormant_users_time >= HCV_DORMANT_USERS_PERIOD))
+    {
+      double dormstart = hcv_monotonic_real_time();
+      if (hcv_database_delete_dormant_users())
+        hcv_last_dormant_users_time = startime;
+      else
+        complete = false;
+      outs << " dormant users in " << (hcv_monotonic_real_time() - dormstart) << "s;";
+    }
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_run_database_cleanup "
+                << (complete?"completed":"interrupted") << " in "
+                << (hcv_monotonic_real_time() - startime) << "s:" << outs.str());
+  return complete;
+} // end hcv_run_database_cleanup
+
 
 /*****
- * a cleanup function to be run in the background thread every five minutes
+ * a cleanup function to be run in the background thread every five
+ * minutes, by some worker thread of the "cleanup" task class
  *****/
 void hcv_background_periodic_cleanup(void)
 {
-  HCV_SYSLOGOUT(LOG_WARNING,
-                "hcv_background_periodic_cleanup unimplemented");
-#warning  hcv_background_periodic_cleanup unimplemented
+  double timebudget = HCV_CLEANUP_DEFAULT_TIME_BUDGET;
+  if (hcv_config_has_group("helpcovid"))
+    hcv_config_do([&timebudget](const Glib::KeyFile*kf)
+    {
+      if (kf->has_key("helpcovid", "cleanup_time_budget"))
+        timebudget = kf->get_double("helpcovid", "cleanup_time_budget");
+    });
+  bool complete = hcv_run_database_cleanup(timebudget);
+  hcv_do_postpone_background_task(complete?HCV_CLEANUP_PERIOD:HCV_CLEANUP_RETRY_DELAY,
+                                  "cleanup", "periodic cleanup", nullptr,
+                                  [](void*)
+  {
+    hcv_background_periodic_cleanup();
+  });
 } // end of hcv_background_periodic_cleanup
 
 
@@ -34,212 +34,488 @@ extern "C" const char hcv_chunkmap_gitid[] = HELPCOVID_GITID;
 extern "C" const char hcv_chunkmap_date[] = __DATE__;
 
 
-static constexpr unsigned hcv_max_chunkmap_size = 512*1024;
-static constexpr unsigned hcv_max_chunkmap_linelen = 65536;
+/// compiled chunk map files are mmap-ed, and their offsets are 32 bits
+static constexpr size_t hcv_max_chunkmap_size = 256*1024*1024;
+static constexpr unsigned hcv_max_chunkmap_namelen = 60;
+static constexpr unsigned hcv_max_chunkmap_labellen = 30;
 
 extern "C" std::mutex hcv_globchunkmap_mtx;
-extern "C" std::map<std::string,std::string> hcv_globchunk_map;
 
-/// see documentation in CUSTOMIZATION.md
-std::map<std::string,std::string>
-hcv_parse_chunk_map(const std::string& filepath)
+/// a syntax error in a chunk map file throws a std::runtime_error, so
+/// that reloading on SIGHUP can keep the previous chunk map
+#define HCV_CHUNKMAP_ERROR(Out) do {					\
+    std::ostringstream hcv_chunkerr_out;				\
+    hcv_chunkerr_out << Out;						\
+    throw std::runtime_error(hcv_chunkerr_out.str());			\
+  } while(0)
+
+
+/// A chunk map file stays in memory while some chunk table refers to
+/// it, and its entries are string views into its contents, so parsing
+/// copies no string. A textual file is read into hcvcf_text, since it
+/// could be edited or truncated in place while in use. A compiled file
+/// is only replaced by rename (see hcv_compile_chunk_map), so it is
+/// mmap-ed read-only and several helpcovid processes share its pages.
+struct hcv_chunk_file_st
 {
-#define HCVSTATE_ENDLABEL_LEN 32
-  std::map<std::string,std::string> resultmap;
-  HCV_DEBUGOUT("hcv_parse_chunk_map start filepath=" << filepath);
-  if (access(filepath.c_str(), R_OK))
-    HCV_FATALOUT("hcv_parse_chunk_map cannot access " << filepath);
-  // https://en.wikipedia.org/wiki/X_Macro trick
-#define HCVSTATE_XMACRO(Mac)			\
-  Mac(_NONE),					\
-    Mac(SKIPSPACES),				\
-    Mac(HEADERLINE),				\
-    Mac(INSIDECHUNK)
-  // define HCVCHUNKSTATE__NONE, etc...
-  enum hcvchunkstate_en
+  std::string hcvcf_path;
+  const char* hcvcf_addr;
+  size_t hcvcf_size;
+  bool hcvcf_compiled;
+  bool hcvcf_mapped;		// hcvcf_addr is mmap-ed, else in hcvcf_text
+  std::string hcvcf_text;
+  /// entries in file order; the first one wins for a duplicate name
+  std::vector<std::pair<std::string_view,std::string_view>> hcvcf_entries;
+  hcv_chunk_file_st(const std::string&path)
+    : hcvcf_path(path), hcvcf_addr(nullptr), hcvcf_size(0),
+      hcvcf_compiled(false), hcvcf_mapped(false), hcvcf_text(), hcvcf_entries() {};
+  ~hcv_chunk_file_st()
   {
-#define HCVSTATE_XDEFINE(Nam) HCVCHUNKSTATE_##Nam
-    HCVSTATE_XMACRO(HCVSTATE_XDEFINE)
-#undef HCVSTATE_XDEFINE
+    if (hcvcf_mapped)
+      munmap(const_cast<char*>(hcvcf_addr), hcvcf_size);
   };
-  const char*const statenames[] =
-  {
-#define HCVSTATE_XNAME(Nam)  #Nam
-    HCVSTATE_XMACRO(HCVSTATE_XNAME),
-#undef HCVSTATE_XNAME
-    nullptr
-  };
-  enum hcvchunkstate_en state = HCVCHUNKSTATE__NONE;
-  std::ifstream inp(filepath);
+  hcv_chunk_file_st(const hcv_chunk_file_st&) = delete;
+  hcv_chunk_file_st& operator = (const hcv_chunk_file_st&) = delete;
+};
+
+/// A compiled chunk map file, see CUSTOMIZATION.md, starts with this
+/// header, followed by hcvcch_count entries sorted by name then by a
+/// string pool of hcvcch_poolsize bytes. Integers are in native byte
+/// order.
+#define HCV_COMPILED_CHUNKMAP_MAGIC "HCVCHNK1"
+struct hcv_compiled_chunkmap_header_st
+{
+  char hcvcch_magic[8];
+  uint32_t hcvcch_count;
+  uint32_t hcvcch_poolsize;
+};
+
+struct hcv_compiled_chunkmap_entry_st
+{
+  uint32_t hcvcce_nameoff;	// offsets are relative to the pool
+  uint32_t hcvcce_namelen;
+  uint32_t hcvcce_valoff;
+  uint32_t hcvcce_vallen;
+};
+
+
+static inline bool
+hcv_chunk_name_char(char c)
+{
+  return isalnum(c) || c == '_';
+} // end hcv_chunk_name_char
+
+
+/// parse a textual chunk map file, see documentation in CUSTOMIZATION.md
+static void
+hcv_parse_chunk_text(hcv_chunk_file_st&chf)
+{
+  const char*const buf = chf.hcvcf_addr;
+  const char*const endbuf = buf + chf.hcvcf_size;
+  const std::string& filepath = chf.hcvcf_path;
   int lincnt = 0;
-  long off = 0;
-  state = HCVCHUNKSTATE_SKIPSPACES;
-  std::string chunkname;
-  std::string chunkbody;
-  for (std::string linbuf; (off=inp.tellg()), std::getline(inp, linbuf); )
+  bool insidechunk = false;
+  std::string_view chunkname;
+  std::string_view endlabel;
+  const char*bodystart = nullptr;
+  const char*bodyend = nullptr;
+  const char*nextlin = nullptr;
+  for (const char*linstart = buf; linstart < endbuf; linstart = nextlin)
     {
-      char endstrbuf[HCVSTATE_ENDLABEL_LEN]; // that size appears in sscanf below
-      memset(endstrbuf, 0, sizeof(endstrbuf));
+      const char*eol = (const char*) memchr(linstart, '\n', endbuf-linstart);
+      if (!eol)
+        eol = endbuf;
+      nextlin = (eol < endbuf)?(eol+1):endbuf;
       lincnt++;
-      if (lincnt >= (int)hcv_max_chunkmap_linelen)
-        HCV_FATALOUT("hcv_parse_chunk_map  " << filepath << " has too many lines " << lincnt);
-      if (off >  hcv_max_chunkmap_size)
-        HCV_FATALOUT("hcv_parse_chunk_map  " << filepath << " has too many bytes " << off);
-      HCV_DEBUGOUT("hcv_parse_chunk_map line#" << lincnt
-                   << " state=" << statenames[state] << " line:" << linbuf);
-      bool allspaces = false;
-      switch (state)
+      std::string_view linv(linstart, eol-linstart);
+      if (insidechunk)
         {
-        case HCVCHUNKSTATE_SKIPSPACES:
-        {
-          chunkname.clear();
-          chunkbody.clear();
-          if (linbuf.empty())
-            continue;
-          // lines starting with # are comments
-          if (linbuf[0] == '#')
-            continue;
-          // line with only spaces should be skipped
-          allspaces = true;
-          for (auto c : linbuf)
-            if (!isspace(c))
-              {
-                allspaces = false;
-                break;
-              };
-          if (allspaces)
-            continue;
-          if (linbuf.size() >= 3
-              && linbuf[0] == '!'
-              && isalpha(linbuf[1]))
-            {
-              state = HCVCHUNKSTATE_HEADERLINE;
-              goto parse_headerline;
-            }
-          else
-            HCV_FATALOUT("hcv_parse_chunk_map, in file " << filepath
-                         << ", line# " << lincnt
-                         << " is unexpected:" << linbuf);
-        };
-        break;
-        ////
-        case HCVCHUNKSTATE_HEADERLINE:
-parse_headerline:
-          {
-            char chunknamebuf[64];
-            memset (chunknamebuf, 0, sizeof(chunknamebuf));
-            int endpos= -1;
-            if (linbuf.size() >= 3
-                && linbuf[0] == '!'
-                && isalpha(linbuf[1]))
-              {
-                if (sscanf(linbuf.c_str(),
-                           "!%60[A-Za-z0-9_]'%n", chunknamebuf, &endpos) >= 1
-                    && endpos>2 && linbuf[endpos-1]=='\'')
-                  {
-                    /**
-                     * single-line chunk line such as
-                     * !FOO'some chunk on single line up to end-of-line
-                     **/
-                    chunkbody.assign(linbuf.c_str()+endpos);
-                    chunkname.assign(chunknamebuf);
-                    HCV_DEBUGOUT("hcv_parse_chunk_map line#" << lincnt
-                                 << ", file:" << filepath
-                                 << ", single line chunk " << chunkname
-                                 << ":" << chunkbody);
-                    resultmap.insert({chunkname,chunkbody});
-                    state = HCVCHUNKSTATE_SKIPSPACES;
-                    continue;
-
-                  }
-                else if (sscanf(linbuf.c_str(),
-                                "!%60[A-Za-z0-9_]\"%30[A-Za-z0-9_](%n",
-                                chunknamebuf, endstrbuf, &endpos) >= 2
-                         && endpos>4 && isalpha(endstrbuf[0])
-                         && linbuf[endpos-1]=='(')
-                  {
-                    /**
-                     * multi-line chunk line starting with
-                     * !MULTIBAR"abc(
-                     **/
-                    chunkname.assign(chunknamebuf);
-                    chunkbody.clear();
-                    if ((int)linbuf.size() > endpos
-                        && !isspace(linbuf[endpos]))
-                      chunkbody.assign(linbuf.c_str()+endpos);
-                    HCV_DEBUGOUT("hcv_parse_chunk_map line#" << lincnt
-                                 << ", file:" << filepath
-                                 << ", multiline line chunk " << chunkname
-                                 << (chunkbody.empty()?" eol":" starting with:")
-                                 << chunkbody);
-                    state = HCVCHUNKSTATE_INSIDECHUNK;
-                  }
-                else goto badheaderline;
-              }
-            else
-badheaderline:
-              HCV_FATALOUT("hcv_parse_chunk_map line#" << lincnt
-                           << " bad header line state=" << statenames[state]
-                           << " line:" << linbuf);
-          }
-          break;
-        ////
-        case HCVCHUNKSTATE_INSIDECHUNK:
           /**
            * Inside a chunk started with something like !MULTIBAR"abc(
            *
            * which should be ended by )abc"
            **/
-        {
-          int endpos= -1;
-          char parsendstrbuf[HCVSTATE_ENDLABEL_LEN]; // that size appears in sscanf below
-          memset (parsendstrbuf, 0, sizeof(parsendstrbuf));
-          if (sscanf(linbuf.c_str(), ")%30[A-Za-z0-9_] %n", parsendstrbuf, &endpos) >= 1
-              && endpos>2 && isalpha(parsendstrbuf[0])
-              && !strncmp(parsendstrbuf, endstrbuf, HCVSTATE_ENDLABEL_LEN))
+          if (linv.size() > endlabel.size() && linv[0] == ')'
+              && linv.compare(1, endlabel.size(), endlabel) == 0
+              && (linv.size() == endlabel.size()+1
+                  || !hcv_chunk_name_char(linv[endlabel.size()+1])))
             {
-              // end of chunk
-              resultmap.insert({chunkname,chunkbody});
-              state = HCVCHUNKSTATE_SKIPSPACES;
-              continue;
-
+              // end of chunk, the body keeps its inner newlines
+              chf.hcvcf_entries.push_back
+              ({chunkname,
+                bodystart?std::string_view(bodystart, bodyend-bodystart):std::string_view()});
+              insidechunk = false;
             }
           else
             {
-              chunkbody += linbuf;
-#warning should hcv_parse_chunk_map add a newline here to chunkbody?
-              continue;
+              if (!bodystart)
+                bodystart = linstart;
+              bodyend = eol;
             }
-          //
+          continue;
+        }
+      // lines starting with # are comments, blank lines are skipped
+      if (linv.empty() || linv[0] == '#')
+        continue;
+      if (linv.find_first_not_of(" \t\r\f\v") == std::string_view::npos)
+        continue;
+      if (linv.size() < 3 || linv[0] != '!' || !isalpha(linv[1]))
+        HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map, in file " << filepath
+                           << ", line# " << lincnt
+                           << " is unexpected:" << linv);
+      size_t namend = 1;
+      while (namend < linv.size() && hcv_chunk_name_char(linv[namend]))
+        namend++;
+      if (namend-1 > hcv_max_chunkmap_namelen || namend >= linv.size())
+        goto badheaderline;
+      chunkname = linv.substr(1, namend-1);
+      if (linv[namend] == '\'')
+        {
+          /**
+           * single-line chunk line such as
+           * !FOO'some chunk on single line up to end-of-line
+           **/
+          chf.hcvcf_entries.push_back({chunkname, linv.substr(namend+1)});
+          continue;
         }
-          // not implemented
-          ////
-#warning very incomplete hcv_parse_chunk_map
-        case HCVCHUNKSTATE__NONE:
-          HCV_FATALOUT("hcv_parse_chunk_map line#" << lincnt
-                       << " unimplemented state=" << statenames[state]
-                       << " line:" << linbuf);
-        };
-    };				// end for linbuf....
-  HCV_DEBUGOUT("hcv_parse_chunk_map end filepath=" << filepath
-               << " with " << resultmap.size() << " keys");
-  if (state != HCVCHUNKSTATE_SKIPSPACES)
-    HCV_SYSLOGOUT(LOG_WARNING, "hcv_parse_chunk_map line#" << lincnt
-                  << " of " << filepath
-                  << " is not a space line, in state " << statenames[state]
-                  << std::endl);
+      else if (linv[namend] == '"' && namend+1 < linv.size() && isalpha(linv[namend+1]))
+        {
+          /**
+           * multi-line chunk line starting with
+           * !MULTIBAR"abc(
+           **/
+          size_t labelend = namend+1;
+          while (labelend < linv.size() && hcv_chunk_name_char(linv[labelend]))
+            labelend++;
+          if (labelend-namend-1 > hcv_max_chunkmap_labellen
+              || labelend >= linv.size() || linv[labelend] != '(')
+            goto badheaderline;
+          endlabel = linv.substr(namend+1, labelend-namend-1);
+          bodystart = bodyend = nullptr;
+          if (labelend+1 < linv.size() && !isspace(linv[labelend+1]))
+            {
+              bodystart = linstart+labelend+1;
+              bodyend = eol;
+            }
+          insidechunk = true;
+          continue;
+        }
+badheaderline:
+      HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map line#" << lincnt
+                         << " of " << filepath
+                         << " bad header line:" << linv);
+    };				// end for linstart....
+  if (insidechunk)
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_parse_chunk_map " << filepath
+                  << " ends inside chunk " << chunkname
+                  << " without its )" << endlabel << " line");
+} // end hcv_parse_chunk_text
+
+
+/// check a compiled chunk map file and make views of its entries
+static void
+hcv_read_compiled_chunks(hcv_chunk_file_st&chf)
+{
+  typedef hcv_compiled_chunkmap_header_st header_t;
+  typedef hcv_compiled_chunkmap_entry_st entry_t;
+  const std::string& filepath = chf.hcvcf_path;
+  header_t hd;
+  memcpy(&hd, chf.hcvcf_addr, sizeof(hd));
+  size_t entoff = sizeof(header_t);
+  size_t pooloff = entoff + (size_t)hd.hcvcch_count*sizeof(entry_t);
+  if (pooloff + hd.hcvcch_poolsize != chf.hcvcf_size)
+    HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map compiled file " << filepath
+                       << " of " << chf.hcvcf_size << " bytes has a corrupted header");
+  const char*pool = chf.hcvcf_addr + pooloff;
+  chf.hcvcf_entries.reserve(hd.hcvcch_count);
+  for (uint32_t ix = 0; ix < hd.hcvcch_count; ix++)
+    {
+      entry_t ent;
+      memcpy(&ent, chf.hcvcf_addr + entoff + ix*sizeof(entry_t), sizeof(ent));
+      if (ent.hcvcce_namelen == 0
+          || (uint64_t)ent.hcvcce_nameoff + ent.hcvcce_namelen > hd.hcvcch_poolsize
+          || (uint64_t)ent.hcvcce_valoff + ent.hcvcce_vallen > hd.hcvcch_poolsize)
+        HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map compiled file " << filepath
+                           << " has a corrupted entry#" << ix);
+      std::string_view name(pool + ent.hcvcce_nameoff, ent.hcvcce_namelen);
+      /// the sorted table makes duplicate names adjacent
+      if (ix > 0 && !(chf.hcvcf_entries.back().first < name))
+        HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map compiled file " << filepath
+                           << " has an unsorted or duplicate entry#" << ix << " " << name);
+      chf.hcvcf_entries.push_back({name, std::string_view(pool + ent.hcvcce_valoff, ent.hcvcce_vallen)});
+    }
+} // end hcv_read_compiled_chunks
+
+
+/// read and parse a textual chunk map file, or mmap a compiled one
+static std::shared_ptr<const hcv_chunk_file_st>
+hcv_load_chunk_file(const std::string& filepath)
+{
+  double startim = hcv_monotonic_real_time();
+  auto chf = std::make_shared<hcv_chunk_file_st>(filepath);
+  int fd = open(filepath.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map cannot open " << filepath
+                       << " (" << strerror(errno) << ")");
+  struct stat st;
+  memset (&st, 0, sizeof(st));
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+    {
+      close(fd);
+      HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map " << filepath << " is not a regular file");
+    }
+  if ((size_t)st.st_size > hcv_max_chunkmap_size)
+    {
+      close(fd);
+      HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map  " << filepath << " has too many bytes " << st.st_size);
+    }
+  char magic[8];
+  memset (magic, 0, sizeof(magic));
+  if ((size_t)st.st_size >= sizeof(hcv_compiled_chunkmap_header_st)
+      && pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic)
+      && !memcmp(magic, HCV_COMPILED_CHUNKMAP_MAGIC, 8))
+    {
+      void*ad = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (ad == MAP_FAILED)
+        {
+          close(fd);
+          HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map failed to mmap " << filepath
+                             << " (" << strerror(errno) << ")");
+        }
+      chf->hcvcf_addr = (const char*)ad;
+      chf->hcvcf_size = st.st_size;
+      chf->hcvcf_mapped = true;
+      chf->hcvcf_compiled = true;
+    }
+  else if (st.st_size > 0)
+    {
+      /// the file could be shrinking meanwhile, so keep what was read
+      std::string& text = chf->hcvcf_text;
+      text.resize(st.st_size);
+      size_t nbread = 0;
+      while (nbread < text.size())
+        {
+          ssize_t cnt = read(fd, &text[nbread], text.size() - nbread);
+          if (cnt < 0 && errno == EINTR)
+            continue;
+          if (cnt < 0)
+            {
+              close(fd);
+              HCV_CHUNKMAP_ERROR("hcv_parse_chunk_map failed to read " << filepath
+                                 << " (" << strerror(errno) << ")");
+            }
+          if (cnt == 0)
+            break;
+          nbread += cnt;
+        }
+      text.resize(nbread);
+      chf->hcvcf_addr = text.data();
+      chf->hcvcf_size = text.size();
+    }
+  close(fd);
+  if (chf->hcvcf_compiled)
+    hcv_read_compiled_chunks(*chf);
+  else if (chf->hcvcf_size > 0)
+    hcv_parse_chunk_text(*chf);
+  HCV_DEBUGOUT("hcv_load_chunk_file " << filepath
+               << (chf->hcvcf_compiled?" compiled":" textual")
+               << " with " << chf->hcvcf_entries.size() << " entries in "
+               << (hcv_monotonic_real_time() - startim)*1.0e3 << " milliseconds");
+  return chf;
+} // end hcv_load_chunk_file
+
+
+/// see documentation in CUSTOMIZATION.md
+std::map<std::string,std::string>
+hcv_parse_chunk_map(const std::string& filepath)
+{
+  std::map<std::string,std::string> resultmap;
+  auto chf = hcv_load_chunk_file(filepath);
+  for (auto& ent: chf->hcvcf_entries)
+    resultmap.emplace(std::string(ent.first), std::string(ent.second));
   return resultmap;
 } // end hcv_parse_chunk_map
 
 
+/// compile a textual chunk map file into a binary one, which is
+/// written aside then renamed, so a running helpcovid never sees it
+/// partially written
+void
+hcv_compile_chunk_map(const std::string& srcpath, const std::string& outpath)
+{
+  typedef hcv_compiled_chunkmap_entry_st entry_t;
+  auto chf = hcv_load_chunk_file(srcpath);
+  if (chf->hcvcf_compiled)
+    HCV_CHUNKMAP_ERROR("hcv_compile_chunk_map: " << srcpath << " is already compiled");
+  std::map<std::string_view,std::string_view> sortedmap;
+  for (auto& ent: chf->hcvcf_entries)
+    sortedmap.insert(ent);
+  std::vector<entry_t> entvec;
+  entvec.reserve(sortedmap.size());
+  std::string pool;
+  for (auto& it: sortedmap)
+    {
+      entry_t ent;
+      ent.hcvcce_nameoff = pool.size();
+      ent.hcvcce_namelen = it.first.size();
+      pool.append(it.first);
+      ent.hcvcce_valoff = pool.size();
+      ent.hcvcce_vallen = it.second.size();
+      pool.append(it.second);
+      entvec.push_back(ent);
+    }
+  hcv_compiled_chunkmap_header_st hd;
+  memset (&hd, 0, sizeof(hd));
+  memcpy(hd.hcvcch_magic, HCV_COMPILED_CHUNKMAP_MAGIC, 8);
+  hd.hcvcch_count = entvec.size();
+  hd.hcvcch_poolsize = pool.size();
+  std::string tmppath = outpath + "%";
+  {
+    std::ofstream out(tmppath, std::ios::binary|std::ios::trunc);
+    out.write((const char*)&hd, sizeof(hd));
+    out.write((const char*)entvec.data(), entvec.size()*sizeof(entry_t));
+    out.write(pool.data(), pool.size());
+    out.close();
+    if (!out)
+      HCV_CHUNKMAP_ERROR("hcv_compile_chunk_map failed to write " << tmppath);
+  }
+  if (rename(tmppath.c_str(), outpath.c_str()))
+    HCV_CHUNKMAP_ERROR("hcv_compile_chunk_map failed to rename " << tmppath
+                       << " to " << outpath << " (" << strerror(errno) << ")");
+  HCV_SYSLOGOUT(LOG_NOTICE, "hcv_compile_chunk_map compiled " << srcpath
+                << " into " << outpath << " with " << entvec.size() << " entries");
+} // end hcv_compile_chunk_map
+
+
 
 
 
 ////////////////////////////////////////////////////////////////
 /******* global chunk map *********/
 
+/// The global chunk map is published as an immutable flat hash table:
+/// open addressing with linear probing over a power of two array of
+/// slots, pointing into the chunk files which the table keeps
+/// alive. Like the other snapshots, it is a shared pointer replaced
+/// with std::atomic_store, so a reader holding it keeps the views it
+/// got valid, even if the chunk map is reloaded meanwhile.
+struct hcv_chunk_slot_st
+{
+  uint64_t hcvcs_hash;
+  const char*hcvcs_name;	// null for an empty slot
+  const char*hcvcs_val;
+  uint32_t hcvcs_namelen;
+  uint32_t hcvcs_vallen;
+};
+
+typedef std::vector<std::shared_ptr<const hcv_chunk_file_st>> hcv_chunk_file_vector_t;
+
+struct hcv_chunk_table_st
+{
+  std::vector<hcv_chunk_slot_st> hcvct_slots;
+  hcv_chunk_file_vector_t hcvct_files;
+  size_t hcvct_count;
+  /// sorted lowercase suffixes of names like WELCOME_fr, for language negotiation
+  std::vector<std::string> hcvct_languages;
+  std::string_view find(std::string_view key) const;
+};
+
 std::mutex hcv_globchunkmap_mtx;
-std::map<std::string,std::string> hcv_globchunk_map;
+/// the chunk files of the global chunk map, in order, protected by hcv_globchunkmap_mtx
+static hcv_chunk_file_vector_t hcv_globchunk_files;
+static std::shared_ptr<const hcv_chunk_table_st> hcv_globchunk_table;
+/// incremented after each publication of hcv_globchunk_table
+static std::atomic<long> hcv_globchunk_generation;
+
+
+static inline uint64_t
+hcv_chunk_hash(std::string_view key)
+{
+  return std::hash<std::string_view> {}(key);
+} // end hcv_chunk_hash
+
+
+std::string_view
+hcv_chunk_table_st::find(std::string_view key) const
+{
+  if (key.empty() || hcvct_slots.empty())
+    return std::string_view();
+  uint64_t h = hcv_chunk_hash(key);
+  size_t mask = hcvct_slots.size() - 1;
+  for (size_t ix = h & mask; ; ix = (ix+1) & mask)
+    {
+      const hcv_chunk_slot_st& slot = hcvct_slots[ix];
+      if (!slot.hcvcs_name)
+        return std::string_view();
+      if (slot.hcvcs_hash == h && slot.hcvcs_namelen == key.size()
+          && !memcmp(slot.hcvcs_name, key.data(), key.size()))
+        return std::string_view(slot.hcvcs_val, slot.hcvcs_vallen);
+    }
+} // end hcv_chunk_table_st::find
+
+
+static std::shared_ptr<const hcv_chunk_table_st>
+hcv_build_chunk_table(const hcv_chunk_file_vector_t&filevec)
+{
+  auto tbl = std::make_shared<hcv_chunk_table_st>();
+  size_t nbentries = 0;
+  for (auto& chf: filevec)
+    nbentries += chf->hcvcf_entries.size();
+  size_t nbslots = 16;
+  while (nbslots < 2*nbentries)
+    nbslots *= 2;
+  tbl->hcvct_slots.resize(nbslots);
+  memset ((void*)tbl->hcvct_slots.data(), 0, nbslots*sizeof(hcv_chunk_slot_st));
+  tbl->hcvct_files = filevec;
+  tbl->hcvct_count = 0;
+  for (auto& chf: filevec)
+    for (auto& ent: chf->hcvcf_entries)
+      {
+        if (ent.first.empty())
+          continue;
+        hcv_chunk_slot_st slot;
+        slot.hcvcs_hash = hcv_chunk_hash(ent.first);
+        slot.hcvcs_name = ent.first.data();
+        slot.hcvcs_namelen = ent.first.size();
+        slot.hcvcs_val = ent.second.data();
+        slot.hcvcs_vallen = ent.second.size();
+        size_t ix = slot.hcvcs_hash & (nbslots-1);
+        while (tbl->hcvct_slots[ix].hcvcs_name)
+          {
+            /// the first entry of a given name wins
+            if (tbl->hcvct_slots[ix].hcvcs_hash == slot.hcvcs_hash
+                && tbl->hcvct_slots[ix].hcvcs_namelen == slot.hcvcs_namelen
+                && !memcmp(tbl->hcvct_slots[ix].hcvcs_name, slot.hcvcs_name, slot.hcvcs_namelen))
+              break;
+            ix = (ix+1) & (nbslots-1);
+          }
+        if (tbl->hcvct_slots[ix].hcvcs_name)
+          continue;
+        tbl->hcvct_slots[ix] = slot;
+        tbl->hcvct_count++;
+        size_t undpos = ent.first.rfind('_');
+        if (undpos != std::string_view::npos && undpos > 0
+            && (ent.first.size()-undpos == 3 || ent.first.size()-undpos == 4)
+            && islower(ent.first[undpos+1]) && islower(ent.first[undpos+2])
+            && (ent.first.size()-undpos == 3 || islower(ent.first[undpos+3])))
+          tbl->hcvct_languages.emplace_back(ent.first.substr(undpos+1));
+      }
+  std::sort(tbl->hcvct_languages.begin(), tbl->hcvct_languages.end());
+  tbl->hcvct_languages.erase(std::unique(tbl->hcvct_languages.begin(), tbl->hcvct_languages.end()),
+                             tbl->hcvct_languages.end());
+  return tbl;
+} // end hcv_build_chunk_table
+
+
+/// publish a new table built from hcv_globchunk_files; its mutex is locked
+static void
+hcv_publish_chunk_table_locked(void)
+{
+  /// the previous table is freed by its last reader
+  std::atomic_store(&hcv_globchunk_table, hcv_build_chunk_table(hcv_globchunk_files));
+  hcv_globchunk_generation++;
+} // end hcv_publish_chunk_table_locked
+
 
 void
 hcv_add_chunkmap_file(const std::string& filepath)
@@ -254,30 +530,92 @@ hcv_add_chunkmap_file(const std::string& filepath)
                  << Glib::shell_quote(filepath) << " not ending with letter or digit");
   HCV_DEBUGOUT("hcv_add_chunkmap_file should parse "
                << Glib::shell_quote(filepath));
-  std::map<std::string,std::string> gotmap =  hcv_parse_chunk_map(filepath);
-  HCV_DEBUGOUT("hcv_add_chunkmap_file parsed "
-               << Glib::shell_quote(filepath)
-               << " with " << gotmap.size() << " entries.");
+  std::shared_ptr<const hcv_chunk_file_st> chf;
+  try
+    {
+      chf = hcv_load_chunk_file(filepath);
+    }
+  catch (std::exception&exc)
+    {
+      HCV_FATALOUT("hcv_add_chunkmap_file failed: " << exc.what());
+    }
   std::lock_guard<std::mutex> gu(hcv_globchunkmap_mtx);
-  hcv_globchunk_map.merge(gotmap);
+  hcv_globchunk_files.push_back(chf);
+  hcv_publish_chunk_table_locked();
   HCV_DEBUGOUT("hcv_add_chunkmap_file merged "
-               << Glib::shell_quote(filepath)
-               << " so cumulating " << gotmap.size() << " entries.");
+               << Glib::shell_quote(filepath) << " with "
+               << chf->hcvcf_entries.size() << " entries, so cumulating "
+               << std::atomic_load(&hcv_globchunk_table)->hcvct_count << " entries.");
 } // end hcv_add_chunkmap_file
 
 
 
+/// parse aside all the given chunk map files, then publish them as the
+/// new global chunk map. On error, keep the current one.
+bool
+hcv_replace_chunkmap_files(const std::vector<std::string>& pathvec)
+{
+  hcv_chunk_file_vector_t newfiles;
+  for (const std::string& filepath: pathvec)
+    {
+      try
+        {
+          if (filepath.empty() || !isalnum(filepath[filepath.size()-1]))
+            throw std::runtime_error("bad chunk map file path " + Glib::shell_quote(filepath));
+          newfiles.push_back(hcv_load_chunk_file(filepath));
+        }
+      catch (std::exception&exc)
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_replace_chunkmap_files keeps the current chunk map: "
+                        << exc.what());
+          return false;
+        }
+    }
+  std::lock_guard<std::mutex> gu(hcv_globchunkmap_mtx);
+  hcv_globchunk_files.swap(newfiles);
+  hcv_publish_chunk_table_locked();
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_replace_chunkmap_files loaded "
+                << std::atomic_load(&hcv_globchunk_table)->hcvct_count
+                << " entries from " << pathvec.size() << " files");
+  return true;
+} // end hcv_replace_chunkmap_files
+
+
+
+std::string_view
+hcv_get_chunkmap_view(std::string_view chunkname, hcv_snapshot_ref_t&ref)
+{
+  std::shared_ptr<const hcv_chunk_table_st> tbl = std::atomic_load(&hcv_globchunk_table);
+  if (!tbl)
+    return std::string_view();
+  std::string_view view = tbl->find(chunkname);
+  ref = std::move(tbl);
+  return view;
+} // end hcv_get_chunkmap_view
+
+
+bool
+hcv_chunkmap_has_language(std::string_view lang)
+{
+  std::shared_ptr<const hcv_chunk_table_st> tbl = std::atomic_load(&hcv_globchunk_table);
+  if (!tbl)
+    return false;
+  return std::binary_search(tbl->hcvct_languages.begin(), tbl->hcvct_languages.end(), lang);
+} // end hcv_chunkmap_has_language
+
+
+long
+hcv_chunkmap_generation(void)
+{
+  return hcv_globchunk_generation.load();
+} // end hcv_chunkmap_generation
+
 
 const std::string
 hcv_get_chunkmap_entry(const std::string&chunkname)
 {
-  if (chunkname.empty())
-    return "";
-  std::lock_guard<std::mutex> gu(hcv_globchunkmap_mtx);
-  auto it = hcv_globchunk_map.find(chunkname);
-  if (it != hcv_globchunk_map.end())
-    return it->second;
-  return "";
+  hcv_snapshot_ref_t ref;
+  return std::string(hcv_get_chunkmap_view(chunkname, ref));
 } // end hcv_get_chunkmap_entry
 
 /// end of file hcv_chunkmap.cc
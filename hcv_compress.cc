@@ -0,0 +1,232 @@
+/****************************************************************
+ * file hcv_compress.cc
+ *
+ * Description:
+ *      HTTP gzip compression of https://github.com/bstarynk/helpcovid
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+
+extern "C" const char hcv_compress_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcv_compress_date[] = __DATE__;
+
+/// smaller dynamic contents are not worth compressing
+const unsigned hcv_min_compressed_size = 256;
+
+
+/// parse the Accept-Encoding: request header, see
+/// https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/Accept-Encoding
+bool
+hcv_request_accepts_gzip(const httplib::Request&req)
+{
+  if (!req.has_header("Accept-Encoding"))
+    return false;
+  std::string accenc = req.get_header_value("Accept-Encoding");
+  bool gotstar = false, gotgzip = false;
+  double starq = 0.0, gzipq = 0.0;
+  size_t pos = 0;
+  while (pos < accenc.size())
+    {
+      size_t comma = accenc.find(',', pos);
+      if (comma == std::string::npos)
+        comma = accenc.size();
+      std::string item = accenc.substr(pos, comma-pos);
+      pos = comma+1;
+      double q = 1.0;
+      size_t semicol = item.find(';');
+      std::string coding = item.substr(0, semicol);
+      coding.erase(0, coding.find_first_not_of(" \t"));
+      coding.erase(coding.find_last_not_of(" \t")+1);
+      if (semicol != std::string::npos)
+        {
+          const char*qstr = strstr(item.c_str()+semicol, "q=");
+          if (qstr)
+            q = atof(qstr+2);
+        }
+      if (!strcasecmp(coding.c_str(), "gzip") || !strcasecmp(coding.c_str(), "x-gzip"))
+        {
+          gotgzip = true;
+          gzipq = q;
+        }
+      else if (coding == "*")
+        {
+          gotstar = true;
+          starq = q;
+        }
+    }
+  if (gotgzip)
+    return gzipq > 0.0;
+  return gotstar && starq > 0.0;
+} // end hcv_request_accepts_gzip
+
+
+
+bool
+hcv_compressible_content_type(const std::string&ctype)
+{
+  return !ctype.compare(0, 5, "text/")
+         || ctype.find("javascript") != std::string::npos
+         || ctype.find("json") != std::string::npos
+         || ctype.find("xml") != std::string::npos;
+} // end hcv_compressible_content_type
+
+
+
+/// run deflate with the given window bits (15+16 for gzip, -15 for raw
+/// deflate) and flush mode on some data
+static std::string
+hcv_run_deflate(const char*data, size_t len, int level, int windowbits, int flush)
+{
+  z_stream zs;
+  memset (&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, level, Z_DEFLATED, windowbits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    HCV_FATALOUT("hcv_run_deflate: deflateInit2 failed");
+  std::string out;
+  out.resize(deflateBound(&zs, len) + 16);
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  zs.avail_in = len;
+  zs.next_out = reinterpret_cast<Bytef*>(out.data());
+  zs.avail_out = out.size();
+  int ret = deflate(&zs, flush);
+  if ((flush == Z_FINISH && ret != Z_STREAM_END)
+      || (flush != Z_FINISH && ret != Z_OK) || zs.avail_in != 0)
+    HCV_FATALOUT("hcv_run_deflate: deflate failed ret=" << ret
+                 << " for " << len << " bytes");
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+} // end hcv_run_deflate
+
+
+std::string
+hcv_gzip_compress(const char*data, size_t len, int level)
+{
+  return hcv_run_deflate(data, len, level, 15+16, Z_FINISH);
+} // end hcv_gzip_compress
+
+
+std::string
+hcv_raw_deflate_sync_flush(const char*data, size_t len)
+{
+  return hcv_run_deflate(data, len, Z_BEST_COMPRESSION, -15, Z_SYNC_FLUSH);
+} // end hcv_raw_deflate_sync_flush
+
+
+
+////////////////
+Hcv_gzip_builder::Hcv_gzip_builder(size_t reserved)
+  : _hcvgz_out(), _hcvgz_crc(crc32(0L, Z_NULL, 0)), _hcvgz_size(0)
+{
+  static const char gzipheader[10] =
+  {
+    '\x1f', '\x8b', Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3 /*Unix*/
+  };
+  _hcvgz_out.reserve(reserved + 64);
+  _hcvgz_out.append(gzipheader, sizeof(gzipheader));
+} // end Hcv_gzip_builder::Hcv_gzip_builder
+
+
+void
+Hcv_gzip_builder::add_deflated(const std::string&rawdeflated, unsigned long crc, size_t len)
+{
+  if (len == 0)
+    return;
+  _hcvgz_out.append(rawdeflated);
+  _hcvgz_crc = crc32_combine(_hcvgz_crc, crc, len);
+  _hcvgz_size += len;
+} // end Hcv_gzip_builder::add_deflated
+
+
+/// uncompressed data goes into stored deflate blocks; we are always on
+/// a byte boundary after a Z_SYNC_FLUSH piece or a stored block.
+void
+Hcv_gzip_builder::add_stored(const char*data, size_t len)
+{
+  if (len == 0)
+    return;
+  _hcvgz_crc = crc32(_hcvgz_crc, reinterpret_cast<const Bytef*>(data), len);
+  _hcvgz_size += len;
+  while (len > 0)
+    {
+      unsigned blen = (len > 65535)?65535:len;
+      char blkhead[5] =
+      {
+        0 /*not final, stored*/, (char)(blen & 0xff), (char)(blen >> 8),
+        (char)(~blen & 0xff), (char)((~blen >> 8) & 0xff)
+      };
+      _hcvgz_out.append(blkhead, sizeof(blkhead));
+      _hcvgz_out.append(data, blen);
+      data += blen;
+      len -= blen;
+    }
+} // end Hcv_gzip_builder::add_stored
+
+
+std::string
+Hcv_gzip_builder::finish(void)
+{
+  /// an empty final stored block, then the gzip trailer
+  static const char finalblock[5] = { 1, 0, 0, '\xff', '\xff' };
+  _hcvgz_out.append(finalblock, sizeof(finalblock));
+  char trailer[8];
+  for (int i=0; i<4; i++)
+    trailer[i] = (char)((_hcvgz_crc >> (8*i)) & 0xff);
+  for (int i=0; i<4; i++)
+    trailer[4+i] = (char)((_hcvgz_size >> (8*i)) & 0xff);
+  _hcvgz_out.append(trailer, sizeof(trailer));
+  std::string res;
+  res.swap(_hcvgz_out);
+  return res;
+} // end Hcv_gzip_builder::finish
+
+
+
+/// set the content of some dynamic response, gzip-ed when the client
+/// accepts it.  HTML rendered from a compiled template reuses its
+/// precompressed literal segments.
+void
+hcv_web_set_compressible_content(const httplib::Request&req, httplib::Response&resp,
+                                 std::string&&content, const char*ctype)
+{
+  if (content.size() < hcv_min_compressed_size
+      || !hcv_compressible_content_type(ctype))
+    {
+      resp.set_content(std::move(content), ctype);
+      return;
+    }
+  resp.set_header("Vary", "Accept-Encoding");
+  if (!hcv_request_accepts_gzip(req))
+    {
+      resp.set_content(std::move(content), ctype);
+      return;
+    }
+  std::string gzcontent;
+  if (!hcv_template_gzip_last_rendering(&resp, content, gzcontent))
+    gzcontent = hcv_gzip_compress(content.data(), content.size(), HCV_DYNAMIC_GZIP_LEVEL);
+  HCV_DEBUGOUT("hcv_web_set_compressible_content " << req.path
+               << " " << content.size() << " bytes gzipped to " << gzcontent.size());
+  resp.set_header("Content-Encoding", "gzip");
+  resp.set_content(std::move(gzcontent), ctype);
+} // end hcv_web_set_compressible_content
+
+//////////////////// end of file hcv_compress.cc of github.com/bstarynk/helpcovid
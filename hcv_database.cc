@@ -35,7 +35,8 @@ extern "C" const char hcv_database_date[] = __DATE__;
 extern "C" std::unique_ptr<pqxx::connection> hcv_dbconn;
 extern "C" std::recursive_mutex hcv_dbmtx;
 
-/// the database connection
+/// the administrative database connection, used at initialization,
+/// by plugins and at exit; web requests use the pool below.
 std::unique_ptr<pqxx::connection> hcv_dbconn;
 
 /// the short PostGreSQL server version
@@ -47,52 +48,427 @@ std::recursive_mutex hcv_dbmtx;
 extern "C" std::atomic<long> hcv_database_serial;
 std::atomic<long> hcv_database_serial;
 extern "C" void hcv_prepare_statements_in_database(void);
+static void hcv_start_cookie_writer(void);
+static void hcv_adopt_plugin_prepared_statements(void);
+static void hcv_stop_cookie_writer(void);
 
 
-Hcv_PreparedStatement::Hcv_PreparedStatement(const std::string& name)
-  : m_name(name)
+////////////////////////////////////////////////////////////////
+//// Pool of PostGreSQL connections, for concurrent web worker
+//// threads. The pool size is given by the database_connections key
+//// in the [helpcovid] configuration group.  Every registered prepared
+//// statement is lazily prepared on each pooled connection when it is
+//// checked out.  A connection idle for a while, or given back during
+//// some exception, is checked by a trivial query and reconnected if
+//// broken.
+struct hcv_dbpool_entry_st
 {
-  std::lock_guard<std::recursive_mutex> guard(hcv_dbmtx);
-  m_txn = new pqxx::work(*hcv_dbconn);
-  m_inv = new pqxx::prepare::invocation(m_txn->prepared(m_name));
-#warning TODO: pqxx::transaction_base::prepared is deprecated and should not be used.
+  std::unique_ptr<pqxx::connection> hcvdbe_conn;
+  double hcvdbe_lastuse;	// monotonic time of last checkin
+  bool hcvdbe_suspect;		// given back during an exception
+  size_t hcvdbe_nbprepared;	// number of statements prepared on it
+};
+static std::vector<hcv_dbpool_entry_st> hcv_dbpool;
+static std::vector<int> hcv_dbpool_free; // indexes of idle connections
+static std::mutex hcv_dbpool_mtx;
+static std::condition_variable hcv_dbpool_cond;
+static std::string hcv_dbpool_connstr;
+
+/// registered prepared statements, in registration order, under hcv_dbmtx
+static std::vector<std::pair<std::string,std::string>> hcv_dbprepared_vec;
+
+static std::atomic<long> hcv_dbpool_checkouts;
+static std::atomic<long> hcv_dbpool_waits; // checkouts which had to wait
+static std::atomic<long> hcv_dbpool_wait_microseconds;
+static std::atomic<long> hcv_dbpool_max_wait_microseconds;
+static std::atomic<long> hcv_dbpool_reconnects;
+
+/// the waiting time of every checkout, also the immediate ones, for /metrics
+Hcv_latency_histogram hcv_database_pool_wait_histogram;
+
+#define HCV_DBPOOL_DEFAULT_SIZE 4
+#define HCV_DBPOOL_MAX_SIZE 64
+#define HCV_DBPOOL_IDLE_CHECK_DELAY 60.0 /*seconds*/
+#define HCV_DBPOOL_WAIT_WARNING_DELAY 10 /*seconds*/
+
+
+/// called by the owner of a checked out pool entry, outside of hcv_dbpool_mtx
+static void
+hcv_dbpool_check_entry(hcv_dbpool_entry_st&ent, int ix)
+{
+  double nowt = hcv_monotonic_real_time();
+  bool ok = ent.hcvdbe_conn && ent.hcvdbe_conn->is_open();
+  if (ok && (ent.hcvdbe_suspect
+             || nowt - ent.hcvdbe_lastuse > HCV_DBPOOL_IDLE_CHECK_DELAY))
+    {
+      try
+        {
+          pqxx::nontransaction checkwork(*ent.hcvdbe_conn);
+          checkwork.exec("SELECT 1");
+        }
+      catch (const std::exception&exc)
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbpool_check_entry: pooled connection #" << ix
+                        << " is broken: " << exc.what());
+          ok = false;
+        }
+    }
+  ent.hcvdbe_suspect = false;
+  if (!ok)
+    {
+      ent.hcvdbe_conn.reset();
+      ent.hcvdbe_nbprepared = 0;
+      hcv_dbpool_reconnects++;
+      ent.hcvdbe_conn.reset(new pqxx::connection(hcv_dbpool_connstr));
+      HCV_SYSLOGOUT(LOG_NOTICE, "hcv_dbpool_check_entry: reconnected pooled connection #" << ix);
+    }
+  std::vector<std::pair<std::string,std::string>> missingvec;
+  {
+    std::lock_guard<std::recursive_mutex> gu(hcv_dbmtx);
+    if (ent.hcvdbe_nbprepared < hcv_dbprepared_vec.size())
+      missingvec.assign(hcv_dbprepared_vec.begin()+ent.hcvdbe_nbprepared,
+                        hcv_dbprepared_vec.end());
+  }
+  for (auto& namesql: missingvec)
+    {
+      ent.hcvdbe_conn->prepare(namesql.first, namesql.second);
+      ent.hcvdbe_nbprepared++;
+    }
+} // end hcv_dbpool_check_entry
+
+
+Hcv_DatabaseConnection::Hcv_DatabaseConnection()
+  : _hcvdbc_conn(nullptr), _hcvdbc_index(-1),
+    _hcvdbc_uncaught(std::uncaught_exceptions())
+{
+  HCV_TRACE_SPAN("database checkout");
+  double startime = hcv_monotonic_real_time();
+  bool waited = false;
+  {
+    std::unique_lock<std::mutex> lk(hcv_dbpool_mtx);
+    if (hcv_dbpool.empty())
+      HCV_FATALOUT("Hcv_DatabaseConnection: no PostGreSQL connection pool");
+    while (hcv_dbpool_free.empty())
+      {
+        waited = true;
+        if (!hcv_dbpool_cond.wait_for(lk, std::chrono::seconds(HCV_DBPOOL_WAIT_WARNING_DELAY),
+                                      [] {return !hcv_dbpool_free.empty();}))
+          HCV_SYSLOGOUT(LOG_WARNING, "Hcv_DatabaseConnection: waited "
+                        << (hcv_monotonic_real_time() - startime)
+                        << " seconds for one of " << hcv_dbpool.size()
+                        << " PostGreSQL connections");
+      }
+    _hcvdbc_index = hcv_dbpool_free.back();
+    hcv_dbpool_free.pop_back();
+  }
+  hcv_dbpool_checkouts++;
+  double waitime = hcv_monotonic_real_time() - startime;
+  hcv_database_pool_wait_histogram.record(waitime);
+  if (waited)
+    {
+      long waitmicrosec = (long)(waitime*1.0e6);
+      hcv_dbpool_waits++;
+      hcv_dbpool_wait_microseconds += waitmicrosec;
+      long oldmax = hcv_dbpool_max_wait_microseconds.load();
+      while (waitmicrosec > oldmax
+             && !hcv_dbpool_max_wait_microseconds.compare_exchange_weak(oldmax, waitmicrosec));
+    }
+  hcv_dbpool_entry_st& ent = hcv_dbpool[_hcvdbc_index];
+  try
+    {
+      hcv_dbpool_check_entry(ent, _hcvdbc_index);
+    }
+  catch (...)
+    {
+      /// give back the index, the next checkout will retry connecting
+      ent.hcvdbe_suspect = true;
+      {
+        std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+        hcv_dbpool_free.push_back(_hcvdbc_index);
+      }
+      hcv_dbpool_cond.notify_one();
+      throw;
+    }
+  _hcvdbc_conn = ent.hcvdbe_conn.get();
+} // end Hcv_DatabaseConnection::Hcv_DatabaseConnection
+
+
+Hcv_DatabaseConnection::~Hcv_DatabaseConnection()
+{
+  if (_hcvdbc_index < 0)
+    return;
+  hcv_dbpool_entry_st& ent = hcv_dbpool[_hcvdbc_index];
+  ent.hcvdbe_lastuse = hcv_monotonic_real_time();
+  if (std::uncaught_exceptions() > _hcvdbc_uncaught)
+    ent.hcvdbe_suspect = true;
+  {
+    std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+    hcv_dbpool_free.push_back(_hcvdbc_index);
+  }
+  hcv_dbpool_cond.notify_one();
+  _hcvdbc_conn = nullptr;
+  _hcvdbc_index = -1;
+} // end Hcv_DatabaseConnection::~Hcv_DatabaseConnection
+
+
+void
+Hcv_DatabaseConnection::mark_suspect(void)
+{
+  if (_hcvdbc_index >= 0)
+    hcv_dbpool[_hcvdbc_index].hcvdbe_suspect = true;
+} // end Hcv_DatabaseConnection::mark_suspect
+
+
+static void
+hcv_database_initialize_pool(const std::string&connstr)
+{
+  int nbconn = HCV_DBPOOL_DEFAULT_SIZE;
+  if (hcv_config_has_group("helpcovid"))
+    hcv_config_do([&nbconn](const Glib::KeyFile*kf)
+    {
+      if (kf->has_key("helpcovid", "database_connections"))
+        nbconn = kf->get_integer("helpcovid", "database_connections");
+    });
+  if (nbconn < 1)
+    nbconn = 1;
+  else if (nbconn > HCV_DBPOOL_MAX_SIZE)
+    nbconn = HCV_DBPOOL_MAX_SIZE;
+  std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+  hcv_dbpool_connstr = connstr;
+  hcv_dbpool.clear();
+  hcv_dbpool_free.clear();
+  hcv_dbpool.resize(nbconn);
+  for (int ix=0; ix<nbconn; ix++)
+    {
+      hcv_dbpool_entry_st& ent = hcv_dbpool[ix];
+      ent.hcvdbe_conn.reset(new pqxx::connection(connstr));
+      ent.hcvdbe_lastuse = hcv_monotonic_real_time();
+      ent.hcvdbe_suspect = false;
+      ent.hcvdbe_nbprepared = 0;
+      hcv_dbpool_free.push_back(ix);
+    }
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_database_initialize_pool made " << nbconn
+                << " PostGreSQL connections");
+} // end hcv_database_initialize_pool
+
+
+static void
+hcv_database_close_pool(void)
+{
+  std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+  if (hcv_dbpool_free.size() != hcv_dbpool.size())
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_database_close_pool with "
+                  << (hcv_dbpool.size() - hcv_dbpool_free.size())
+                  << " connections still in use");
+  hcv_dbpool_free.clear();
+  hcv_dbpool.clear();
+} // end hcv_database_close_pool
+
+
+hcv_database_pool_stats_st
+hcv_database_pool_statistics(void)
+{
+  hcv_database_pool_stats_st st;
+  memset (&st, 0, sizeof(st));
+  {
+    std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+    st.dbpool_size = hcv_dbpool.size();
+    st.dbpool_idle = hcv_dbpool_free.size();
+  }
+  st.dbpool_checkouts = hcv_dbpool_checkouts.load();
+  st.dbpool_waits = hcv_dbpool_waits.load();
+  st.dbpool_total_wait = 1.0e-6 * hcv_dbpool_wait_microseconds.load();
+  st.dbpool_max_wait = 1.0e-6 * hcv_dbpool_max_wait_microseconds.load();
+  st.dbpool_reconnects = hcv_dbpool_reconnects.load();
+  return st;
+} // end hcv_database_pool_statistics
+
+
+
+////////////////////////////////////////////////////////////////
+//// per prepared statement latency counters, created when the
+//// statement is registered and never removed.
+struct hcv_pstm_counters_st
+{
+  std::atomic<long> pstmc_count;
+  std::atomic<long> pstmc_errors;
+  std::atomic<long> pstmc_total_microseconds;
+  std::atomic<long> pstmc_max_microseconds;
+  unsigned pstmc_traceid;	// trace name of the statement
+};
+static std::mutex hcv_pstm_counters_mtx;
+static std::map<std::string,hcv_pstm_counters_st,std::less<>> hcv_pstm_counters_map;
+
+static hcv_pstm_counters_st*
+hcv_find_pstm_counters(std::string_view name)
+{
+  std::lock_guard<std::mutex> gu(hcv_pstm_counters_mtx);
+  auto it = hcv_pstm_counters_map.find(name);
+  if (it == hcv_pstm_counters_map.end())
+    return nullptr;
+  return &it->second;
+} // end hcv_find_pstm_counters
+
+
+std::vector<hcv_prepared_statement_stats_st>
+hcv_database_prepared_statement_statistics(void)
+{
+  std::vector<hcv_prepared_statement_stats_st> vec;
+  std::lock_guard<std::mutex> gu(hcv_pstm_counters_mtx);
+  vec.reserve(hcv_pstm_counters_map.size());
+  for (auto& it: hcv_pstm_counters_map)
+    {
+      const hcv_pstm_counters_st& cnt = it.second;
+      vec.push_back({it.first, cnt.pstmc_count.load(), cnt.pstmc_errors.load(),
+                     1.0e-6 * cnt.pstmc_total_microseconds.load(),
+                     1.0e-6 * cnt.pstmc_max_microseconds.load()});
+    }
+  return vec;
+} // end hcv_database_prepared_statement_statistics
+
+
+Hcv_PreparedStatement::Hcv_PreparedStatement(const char* name)
+  : m_name(name), m_counters(hcv_find_pstm_counters(name)),
+    m_dbconn(), m_owntxn(), m_txn(nullptr), m_nbparams(0)
+{
+  HCV_ASSERT(name != nullptr);
+  m_dbconn.emplace();
+  m_owntxn.emplace(**m_dbconn);
+  m_txn = &*m_owntxn;
 } // end Hcv_PreparedStatement::Hcv_PreparedStatement
 
 
+Hcv_PreparedStatement::Hcv_PreparedStatement(pqxx::work& txn, const char* name)
+  : m_name(name), m_counters(hcv_find_pstm_counters(name)),
+    m_dbconn(), m_owntxn(), m_txn(&txn), m_nbparams(0)
+{
+  HCV_ASSERT(name != nullptr);
+} // end Hcv_PreparedStatement::Hcv_PreparedStatement with shared transaction
+
+
+/// an uncommitted own transaction is aborted by the pqxx::work destructor
 Hcv_PreparedStatement::~Hcv_PreparedStatement()
 {
-  delete m_inv;
-  delete m_txn;
-}
+  m_txn = nullptr;
+  m_owntxn.reset();
+  m_dbconn.reset();
+} // end Hcv_PreparedStatement::~Hcv_PreparedStatement
+
+
+std::string&
+Hcv_PreparedStatement::next_param(void)
+{
+  if (m_nbparams >= HCV_PSTM_MAX_PARAMS)
+    HCV_FATALOUT("Hcv_PreparedStatement: too many parameters for " << m_name);
+  return m_params[m_nbparams++];
+} // end Hcv_PreparedStatement::next_param
 
 
 void
 Hcv_PreparedStatement::bind(const std::string& arg)
 {
-  if (m_inv)
-    (*m_inv)(arg);
-}
+  next_param().assign(arg);
+} // end Hcv_PreparedStatement::bind string
+
+
+void
+Hcv_PreparedStatement::bind(const char* arg)
+{
+  HCV_ASSERT(arg != nullptr);
+  next_param().assign(arg);
+} // end Hcv_PreparedStatement::bind C string
+
+
+void
+Hcv_PreparedStatement::bind(char arg)
+{
+  next_param().assign(1, arg);
+} // end Hcv_PreparedStatement::bind char
 
 
 void
 Hcv_PreparedStatement::bind(std::int64_t arg)
 {
-  if (m_inv)
-    (*m_inv)(arg);
-}
+  char buf[24];
+  int len = snprintf(buf, sizeof(buf), "%lld", (long long)arg);
+  next_param().assign(buf, len);
+} // end Hcv_PreparedStatement::bind integer
 
 
-pqxx::result
-Hcv_PreparedStatement::query()
+void
+Hcv_PreparedStatement::bind(double arg)
 {
-  if (!m_inv)
-    HCV_FATALOUT("Invcation not initialised!");
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%.17g", arg);
+  next_param().assign(buf, len);
+} // end Hcv_PreparedStatement::bind double
 
-  pqxx::result res = m_inv->exec();
-  m_txn->commit();
 
+pqxx::result
+Hcv_PreparedStatement::query()
+{
+  HCV_ASSERT(m_txn != nullptr);
+  HCV_TRACE_SPAN_ID(m_counters?m_counters->pstmc_traceid:0);
+  double startime = hcv_monotonic_real_time();
+  pqxx::result res;
+  std::string* p = m_params;
+  try
+    {
+      switch (m_nbparams)
+        {
+        case 0:
+          res = m_txn->exec_prepared(m_name);
+          break;
+        case 1:
+          res = m_txn->exec_prepared(m_name, p[0]);
+          break;
+        case 2:
+          res = m_txn->exec_prepared(m_name, p[0], p[1]);
+          break;
+        case 3:
+          res = m_txn->exec_prepared(m_name, p[0], p[1], p[2]);
+          break;
+        case 4:
+          res = m_txn->exec_prepared(m_name, p[0], p[1], p[2], p[3]);
+          break;
+        case 5:
+          res = m_txn->exec_prepared(m_name, p[0], p[1], p[2], p[3], p[4]);
+          break;
+        case 6:
+          res = m_txn->exec_prepared(m_name, p[0], p[1], p[2], p[3], p[4], p[5]);
+          break;
+        case 7:
+          res = m_txn->exec_prepared(m_name, p[0], p[1], p[2], p[3], p[4], p[5], p[6]);
+          break;
+        case 8:
+          res = m_txn->exec_prepared(m_name, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+          break;
+        default:
+          HCV_FATALOUT("Hcv_PreparedStatement::query bad parameter count " << m_nbparams);
+        }
+      if (m_owntxn)
+        m_owntxn->commit();
+    }
+  catch (...)
+    {
+      if (m_counters)
+        m_counters->pstmc_errors++;
+      if (m_dbconn)
+        m_dbconn->mark_suspect();
+      throw;
+    }
+  m_nbparams = 0;
+  if (m_counters)
+    {
+      long elapsedmicrosec = (long)((hcv_monotonic_real_time() - startime)*1.0e6);
+      m_counters->pstmc_count++;
+      m_counters->pstmc_total_microseconds += elapsedmicrosec;
+      long oldmax = m_counters->pstmc_max_microseconds.load();
+      while (elapsedmicrosec > oldmax
+             && !m_counters->pstmc_max_microseconds.compare_exchange_weak(oldmax, elapsedmicrosec));
+    }
   return res;
-}
+} // end Hcv_PreparedStatement::query
 
 
 const std::string
@@ -180,6 +556,8 @@ sql_tb_email_confirmation(pqxx::work& transact)
             confirm_expiry TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP 
                 + interval '1 hour'
         );
+        CREATE INDEX IF NOT EXISTS ix_confirm_expiry
+            ON tb_email_confirmation(confirm_expiry);
     )confsql");
 } // end sql_tb_email_confirmation
 
@@ -236,6 +614,8 @@ sql_tb_session(pqxx::work& transact)
                 ip INET NOT NULL,
                 start TIMESTAMP NOT NULL DEFAULT now(),
                 expiry TIMESTAMP NOT NULL DEFAULT now() + interval '1 hour');
+        CREATE INDEX IF NOT EXISTS ix_session_expiry
+            ON tb_session(expiry);
     )sqltbsession");
 }
 
@@ -724,7 +1104,10 @@ hcv_initialize_database(const std::string&uri, bool cleardata)
   }
   HCV_DEBUGOUT("hcv_initialize_database before preparing statements in " << connstr);
   hcv_prepare_statements_in_database();
+  hcv_database_initialize_pool(connstr);
+  hcv_start_cookie_writer();
   hcv_initialize_plugins_for_database(hcv_dbconn.get());
+  hcv_adopt_plugin_prepared_statements();
   HCV_SYSLOGOUT(LOG_NOTICE, "PostGreSQL database " << connstr << " successfully initialized");
 } // end hcv_initialize_database
 
@@ -735,12 +1118,12 @@ prepare_user_model_statements(void)
   // user_crtime is updated by default
   hcv_database_register_prepared_statement
   ("user_create_pstm",
-   "INSERT INTO tb_user (user_firstname, user_familyname, user_email, user_gender "
+   "INSERT INTO tb_user (user_firstname, user_familyname, user_email, user_gender)"
    " VALUES ($1, $2, $3, $4);");
 
   hcv_database_register_prepared_statement("user_get_password_by_email_pstm",
-      "SELECT passwd_encr FROM tb_password WHERE passw_userid = "
-      "(SELECT user_id WHERE user_email = $1) ORDER BY passw_mtime DESC"
+      "SELECT passw_encr FROM tb_password WHERE passw_userid = "
+      "(SELECT user_id FROM tb_user WHERE user_email = $1) ORDER BY passw_mtime DESC"
       " LIMIT 1;");
 } // end prepare_user_model_statements
 
@@ -753,28 +1136,114 @@ hcv_prepare_statements_in_database(void)
   std::lock_guard<std::recursive_mutex> gu(hcv_dbmtx);
   ////// find a user by his/her email
   HCV_DEBUGOUT("preparing find_user_by_email_pstm");
-  hcv_dbconn->prepare
+  hcv_database_register_prepared_statement
   ("find_user_by_email_pstm",
    R"finduseremail(
 SELECT user_id FROM tb_user WHERE user_email=$1
 )finduseremail");
-  ///// insert a fresh web cookie; see also for LASTVAL
-  ///// https://www.postgresql.org/docs/current/functions-sequence.html
-  hcv_dbconn->prepare
+  ///// insert a fresh web cookie, giving its serial in the same round trip; see
+  ///// https://www.postgresql.org/docs/current/dml-returning.html
+  hcv_database_register_prepared_statement
     ("add_web_cookie_pstm",
      R"addwebcookie(
 INSERT INTO tb_web_cookie
      (wcookie_random, wcookie_exptime, wcookie_webagenthash)
 VALUES ($1, to_timestamp($2), $3)
+RETURNING wcookie_id
 )addwebcookie");
-  hcv_dbconn->prepare
-    ("lastval_pstm", "SELECT LASTVAL()");
+  ///// find a stored web cookie, giving its expiry time in seconds
+  ///// since epoch; wcookie_exptime is a local TIMESTAMP written by
+  ///// to_timestamp(), so convert it back with the server time zone
+  hcv_database_register_prepared_statement
+    ("find_web_cookie_pstm",
+     R"findwebcookie(
+SELECT EXTRACT(EPOCH FROM wcookie_exptime AT TIME ZONE current_setting('TimeZone'))::BIGINT
+  FROM tb_web_cookie
+ WHERE wcookie_id = $1 AND wcookie_random = $2 AND wcookie_webagenthash = $3
+)findwebcookie");
+  ///// a signed web cookie is signed again with its wcookie_id once
+  ///// stored, see hcv_web_persist_signed_cookie in hcv_web.cc
+  hcv_database_register_prepared_statement
+    ("set_web_cookie_random_pstm",
+     "UPDATE tb_web_cookie SET wcookie_random = $2 WHERE wcookie_id = $1");
+  ///// web sessions, see also hcv_session.cc
+  hcv_database_register_prepared_statement
+    ("open_session_pstm",
+     "SELECT open_session($1, $2, $3::INET), EXTRACT(EPOCH FROM now() + INTERVAL '1 hour')::BIGINT");
+  hcv_database_register_prepared_statement
+    ("find_session_pstm",
+     R"findsession(
+SELECT user_id, http_ua, host(ip),
+       EXTRACT(EPOCH FROM expiry AT TIME ZONE current_setting('TimeZone'))::BIGINT
+  FROM tb_session WHERE id = $1::UUID
+)findsession");
+  ///// a session closed meanwhile has its expiry at or before now(),
+  ///// and should stay closed
+  hcv_database_register_prepared_statement
+    ("update_session_expiries_pstm",
+     R"updsessions(
+UPDATE tb_session AS s SET expiry = to_timestamp(u.uexpiry)
+  FROM unnest($1::UUID[], $2::FLOAT8[]) AS u(uid, uexpiry)
+ WHERE s.id = u.uid AND s.expiry > now()
+)updsessions");
+  hcv_database_register_prepared_statement
+    ("close_session_pstm", "CALL close_session($1::UUID)");
+  ///// periodic cleanup, deleting at most $1 rows per statement, see
+  ///// hcv_run_database_cleanup in hcv_background.cc
+  hcv_database_register_prepared_statement
+    ("purge_web_cookies_pstm",
+     R"purgecookies(
+DELETE FROM tb_web_cookie WHERE wcookie_id IN
+  (SELECT wcookie_id FROM tb_web_cookie WHERE wcookie_exptime < now() LIMIT $1)
+)purgecookies");
+  ///// the latest session of each user is kept for delete_dormant_users()
+  hcv_database_register_prepared_statement
+    ("purge_sessions_pstm",
+     R"purgesessions(
+DELETE FROM tb_session WHERE id IN
+  (SELECT s.id FROM tb_session AS s WHERE s.expiry < now() - INTERVAL '1 day'
+     AND EXISTS (SELECT 1 FROM tb_session AS s2
+                  WHERE s2.user_id = s.user_id AND s2.expiry > s.expiry)
+   LIMIT $1)
+)purgesessions");
+  hcv_database_register_prepared_statement
+    ("purge_email_confirmations_pstm",
+     R"purgeconfirms(
+DELETE FROM tb_email_confirmation WHERE confirm_id IN
+  (SELECT confirm_id FROM tb_email_confirmation WHERE confirm_expiry < now() LIMIT $1)
+)purgeconfirms");
+  hcv_database_register_prepared_statement
+    ("delete_dormant_users_pstm", "CALL delete_dormant_users()");
+  ///// insert several web cookies given as three arrays, see
+  ///// https://www.postgresql.org/docs/current/functions-array.html
+  hcv_database_register_prepared_statement
+    ("add_web_cookies_batch_pstm",
+     R"addwebcookies(
+INSERT INTO tb_web_cookie
+     (wcookie_random, wcookie_exptime, wcookie_webagenthash)
+SELECT wrandom, to_timestamp(wexptime), whash
+  FROM unnest($1::TEXT[], $2::FLOAT8[], $3::INT[]) AS wc(wrandom, wexptime, whash)
+RETURNING wcookie_id, wcookie_random
+)addwebcookies");
   prepare_user_model_statements();
 } // end hcv_prepare_statements_in_database
 
 
 
 
+/// record a statement for pooled connections, which prepare it
+/// lazily at their next checkout; under hcv_dbmtx
+static void
+hcv_database_record_prepared_statement(const std::string& name,
+                                       const std::string& sql)
+{
+  hcv_dbprepared_vec.push_back({name, sql});
+  std::lock_guard<std::mutex> gu(hcv_pstm_counters_mtx);
+  auto it = hcv_pstm_counters_map.try_emplace(name).first;
+  it->second.pstmc_traceid = hcv_trace_intern("database " + name);
+} // end hcv_database_record_prepared_statement
+
+
 void
 hcv_database_register_prepared_statement(const std::string& name, 
                                          const std::string& sql)
@@ -782,10 +1251,43 @@ hcv_database_register_prepared_statement(const std::string& name,
     HCV_DEBUGOUT("Registering prepared SQL statement " << name);
 
     std::lock_guard<std::recursive_mutex> guard(hcv_dbmtx);
-    hcv_dbconn->prepare(name, sql);
+    hcv_database_record_prepared_statement(name, sql);
+    if (hcv_dbconn)
+      hcv_dbconn->prepare(name, sql);
 } // end hcv_database_register_prepared_statement
 
 
+/// Older plugins prepare their statements with pqxx::connection::prepare
+/// on the connection given to hcvplugin_initialize_database, but
+/// Hcv_PreparedStatement runs them on pooled connections.  So record
+/// every statement prepared on hcv_dbconn but not registered, as if
+/// hcv_database_register_prepared_statement was called.
+static void
+hcv_adopt_plugin_prepared_statements(void)
+{
+  std::lock_guard<std::recursive_mutex> guard(hcv_dbmtx);
+  if (!hcv_dbconn)
+    return;
+  std::set<std::string> knownset;
+  for (auto& namesql: hcv_dbprepared_vec)
+    knownset.insert(namesql.first);
+  pqxx::nontransaction work(*hcv_dbconn);
+  pqxx::result res = work.exec("SELECT name, statement FROM pg_prepared_statements"
+                               " WHERE NOT from_sql ORDER BY prepare_time");
+  for (auto rowit : res)
+    {
+      std::string name = rowit[0].as<std::string>();
+      if (knownset.find(name) != knownset.end())
+        continue;
+      HCV_SYSLOGOUT(LOG_NOTICE, "hcv_adopt_plugin_prepared_statements: statement "
+                    << name << " was prepared by some plugin without"
+                    " hcv_database_register_prepared_statement");
+      hcv_database_record_prepared_statement(name, rowit[1].as<std::string>());
+      knownset.insert(name);
+    }
+} // end hcv_adopt_plugin_prepared_statements
+
+
 
 
 
@@ -801,17 +1303,173 @@ hcv_database_with_known_email (const std::string& emailstr)
       HCV_DEBUGOUT("hcv_database_with_known_email bad email" << emailstr);
       return false;
     }
-  std::lock_guard<std::recursive_mutex> gu(hcv_dbmtx);
-  pqxx::work transact(*hcv_dbconn);
-  pqxx::result res = transact.exec_prepared("find_user_by_email_pstm", emailstr);
+  Hcv_PreparedStatement stmt("find_user_by_email_pstm");
+  stmt.bind(emailstr);
+  pqxx::result res = stmt.query();
   long id = -1;
   for (auto rowit : res) {
     id = rowit[0].as<long>();
   }
-  transact.commit();
   return id>0;
 } // end hcv_database_with_known_email
 
+
+////////////////////////////////////////////////////////////////
+//// Batched web cookie insertion.  Concurrent web worker threads
+//// registering fresh cookies enqueue them, and a single writer thread
+//// inserts everything queued so far with one multi-row INSERT, so a
+//// burst of anonymous visitors costs a few round trips.  A lone
+//// cookie is inserted at once, without any added delay.  Disabled by
+//// batched_web_cookies=false in the [helpcovid] configuration group.
+struct hcv_pending_web_cookie_st
+{
+  std::string hcvpwc_random;
+  time_t hcvpwc_exptime;
+  int hcvpwc_webagenthash;
+  std::promise<long> hcvpwc_promise;
+};
+static std::mutex hcv_cookie_writer_mtx;
+static std::condition_variable hcv_cookie_writer_cond;
+static std::deque<hcv_pending_web_cookie_st*> hcv_cookie_writer_queue;
+static std::thread hcv_cookie_writer_thread;
+static bool hcv_cookie_writer_running;
+static bool hcv_cookie_writer_stopping;
+#define HCV_COOKIE_BATCH_MAX_SIZE 128
+
+/// append a PostGreSQL array literal element, double-quoted
+static void
+hcv_append_sql_array_element(std::string&arr, const std::string&elem)
+{
+  if (arr.size() > 1)
+    arr.push_back(',');
+  arr.push_back('"');
+  for (char c: elem)
+    {
+      if (c == '"' || c == '\\')
+        arr.push_back('\\');
+      arr.push_back(c);
+    }
+  arr.push_back('"');
+} // end hcv_append_sql_array_element
+
+
+static void
+hcv_cookie_writer_insert_batch(std::vector<hcv_pending_web_cookie_st*>&batch)
+{
+  std::string randarr = "{", exparr = "{", hasharr = "{";
+  for (hcv_pending_web_cookie_st* pwc: batch)
+    {
+      char numbuf[32];
+      hcv_append_sql_array_element(randarr, pwc->hcvpwc_random);
+      snprintf(numbuf, sizeof(numbuf), "%lld", (long long)pwc->hcvpwc_exptime);
+      hcv_append_sql_array_element(exparr, numbuf);
+      snprintf(numbuf, sizeof(numbuf), "%d", pwc->hcvpwc_webagenthash);
+      hcv_append_sql_array_element(hasharr, numbuf);
+    }
+  randarr.push_back('}');
+  exparr.push_back('}');
+  hasharr.push_back('}');
+  try
+    {
+      Hcv_PreparedStatement stmt("add_web_cookies_batch_pstm");
+      stmt.bind(randarr);
+      stmt.bind(exparr);
+      stmt.bind(hasharr);
+      pqxx::result res = stmt.query();
+      /// RETURNING gives no guaranteed order, so match on the random string
+      for (auto rowit : res)
+        {
+          long id = rowit[0].as<long>();
+          std::string randstr = rowit[1].as<std::string>();
+          for (hcv_pending_web_cookie_st*& pwc: batch)
+            {
+              if (pwc && pwc->hcvpwc_random == randstr)
+                {
+                  pwc->hcvpwc_promise.set_value(id);
+                  pwc = nullptr;
+                  break;
+                }
+            }
+        }
+      HCV_DEBUGOUT("hcv_cookie_writer_insert_batch inserted " << res.size()
+                   << " cookies for a batch of " << batch.size());
+    }
+  catch (std::exception& exc)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING,
+                    "hcv_cookie_writer_insert_batch of " << batch.size()
+                    << " cookies got exception:" << exc.what());
+    }
+  for (hcv_pending_web_cookie_st* pwc: batch)
+    if (pwc)
+      pwc->hcvpwc_promise.set_value(-2);
+} // end hcv_cookie_writer_insert_batch
+
+
+static void
+hcv_cookie_writer_loop(void)
+{
+  pthread_setname_np(pthread_self(), "hcv_cookiewr");
+  std::vector<hcv_pending_web_cookie_st*> batch;
+  batch.reserve(HCV_COOKIE_BATCH_MAX_SIZE);
+  for (;;)
+    {
+      {
+        std::unique_lock<std::mutex> lk(hcv_cookie_writer_mtx);
+        hcv_cookie_writer_cond.wait(lk, [] {return hcv_cookie_writer_stopping
+                                                  || !hcv_cookie_writer_queue.empty();});
+        if (hcv_cookie_writer_queue.empty() && hcv_cookie_writer_stopping)
+          break;
+        while (!hcv_cookie_writer_queue.empty() && batch.size() < HCV_COOKIE_BATCH_MAX_SIZE)
+          {
+            batch.push_back(hcv_cookie_writer_queue.front());
+            hcv_cookie_writer_queue.pop_front();
+          }
+      }
+      hcv_cookie_writer_insert_batch(batch);
+      batch.clear();
+    }
+} // end hcv_cookie_writer_loop
+
+
+static void
+hcv_start_cookie_writer(void)
+{
+  bool batched = true;
+  if (hcv_config_has_group("helpcovid"))
+    hcv_config_do([&batched](const Glib::KeyFile*kf)
+    {
+      if (kf->has_key("helpcovid", "batched_web_cookies"))
+        batched = kf->get_boolean("helpcovid", "batched_web_cookies");
+    });
+  if (!batched)
+    {
+      HCV_SYSLOGOUT(LOG_INFO, "web cookies are inserted one by one");
+      return;
+    }
+  std::lock_guard<std::mutex> gu(hcv_cookie_writer_mtx);
+  hcv_cookie_writer_stopping = false;
+  hcv_cookie_writer_thread = std::thread(hcv_cookie_writer_loop);
+  hcv_cookie_writer_running = true;
+} // end hcv_start_cookie_writer
+
+
+static void
+hcv_stop_cookie_writer(void)
+{
+  {
+    std::lock_guard<std::mutex> gu(hcv_cookie_writer_mtx);
+    if (!hcv_cookie_writer_running)
+      return;
+    hcv_cookie_writer_stopping = true;
+  }
+  hcv_cookie_writer_cond.notify_all();
+  hcv_cookie_writer_thread.join();
+  std::lock_guard<std::mutex> gu(hcv_cookie_writer_mtx);
+  hcv_cookie_writer_running = false;
+} // end hcv_stop_cookie_writer
+
+
 long
 hcv_database_get_id_of_added_web_cookie(const std::string& randomstr, time_t exptime, int webagenthash)
 {
@@ -820,23 +1478,30 @@ hcv_database_get_id_of_added_web_cookie(const std::string& randomstr, time_t exp
   HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie start randomstr='"
 	       << randomstr << " exptime=" << exptime
 	       << " webagenthash=" << webagenthash);
-  std::lock_guard<std::recursive_mutex> gu(hcv_dbmtx);
+  {
+    std::unique_lock<std::mutex> lk(hcv_cookie_writer_mtx);
+    if (hcv_cookie_writer_running && !hcv_cookie_writer_stopping)
+      {
+        hcv_pending_web_cookie_st pwc {randomstr, exptime, webagenthash, std::promise<long>()};
+        std::future<long> fut = pwc.hcvpwc_promise.get_future();
+        hcv_cookie_writer_queue.push_back(&pwc);
+        lk.unlock();
+        hcv_cookie_writer_cond.notify_one();
+        id = fut.get();
+        HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie batched randomstr='"
+                     << randomstr << "' => id=" << id);
+        return id;
+      }
+  }
   try {
-  pqxx::work transact(*hcv_dbconn);
-  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie before add_web_cookie_pstm randomstr="
-	       << randomstr);
-  pqxx::result res;
-  res = transact.exec_prepared("add_web_cookie_pstm",
-			       randomstr, (double)exptime, webagenthash);
-  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie add_web_cookie_pstm res size:"
-	       << res.size() << " affected rows:" << res.affected_rows());
-  res = transact.exec_prepared("lastval_pstm");
-  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie lastval_pstm res size:"
-	       << res.size());
+  Hcv_PreparedStatement addstmt("add_web_cookie_pstm");
+  addstmt.bind(randomstr);
+  addstmt.bind((double)exptime);
+  addstmt.bind(webagenthash);
+  pqxx::result res = addstmt.query();
   for (auto rowit : res) {
     id = rowit[0].as<long>();
   }
-  transact.commit();
   HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie randomstr='"
 	       << randomstr << "', exptime=" << exptime
 	       << ", webagenthash=" << webagenthash
@@ -851,11 +1516,181 @@ hcv_database_get_id_of_added_web_cookie(const std::string& randomstr, time_t exp
 } // end hcv_database_get_id_of_added_web_cookie
 
 
+time_t
+hcv_database_web_cookie_expiry(long id, const std::string& randomstr, int webagenthash)
+{
+  time_t exptime = 0;
+  try {
+    Hcv_PreparedStatement stmt("find_web_cookie_pstm");
+    stmt.bind((std::int64_t)id);
+    stmt.bind(randomstr);
+    stmt.bind(webagenthash);
+    pqxx::result res = stmt.query();
+    for (auto rowit : res)
+      exptime = (time_t) rowit[0].as<long>();
+  } catch (std::exception& exc) {
+    HCV_SYSLOGOUT(LOG_WARNING,
+		  "hcv_database_web_cookie_expiry id=" << id
+		  << " got exception:" << exc.what());
+    exptime = 0;
+  }
+  return exptime;
+} // end hcv_database_web_cookie_expiry
+
+
+bool
+hcv_database_set_web_cookie_random(long id, const std::string& randomstr)
+{
+  try {
+    Hcv_PreparedStatement stmt("set_web_cookie_random_pstm");
+    stmt.bind((std::int64_t)id);
+    stmt.bind(randomstr);
+    pqxx::result res = stmt.query();
+    return res.affected_rows() == 1;
+  } catch (std::exception& exc) {
+    HCV_SYSLOGOUT(LOG_WARNING,
+		  "hcv_database_set_web_cookie_random id=" << id
+		  << " got exception:" << exc.what());
+  }
+  return false;
+} // end hcv_database_set_web_cookie_random
+
+
+std::string
+hcv_database_open_session(long userid, const std::string& http_ua,
+                          const std::string& ip, time_t*pexpiry)
+{
+  std::string uuid;
+  try {
+    Hcv_PreparedStatement stmt("open_session_pstm");
+    stmt.bind((std::int64_t)userid);
+    stmt.bind(http_ua);
+    stmt.bind(ip);
+    pqxx::result res = stmt.query();
+    for (auto rowit : res) {
+      uuid = rowit[0].as<std::string>();
+      if (pexpiry)
+        *pexpiry = (time_t) rowit[1].as<long>();
+    }
+  } catch (std::exception& exc) {
+    HCV_SYSLOGOUT(LOG_WARNING,
+		  "hcv_database_open_session userid=" << userid
+		  << " got exception:" << exc.what());
+    uuid.clear();
+  }
+  return uuid;
+} // end hcv_database_open_session
+
+
+bool
+hcv_database_fetch_session(const std::string& uuid, long*puserid,
+                           std::string& http_ua, std::string& ip,
+                           time_t*pexpiry)
+{
+  try {
+    Hcv_PreparedStatement stmt("find_session_pstm");
+    stmt.bind(uuid);
+    pqxx::result res = stmt.query();
+    for (auto rowit : res) {
+      if (puserid)
+        *puserid = rowit[0].as<long>();
+      http_ua = rowit[1].as<std::string>();
+      ip = rowit[2].as<std::string>();
+      if (pexpiry)
+        *pexpiry = (time_t) rowit[3].as<long>();
+      return true;
+    }
+  } catch (std::exception& exc) {
+    HCV_SYSLOGOUT(LOG_WARNING,
+		  "hcv_database_fetch_session uuid=" << uuid
+		  << " got exception:" << exc.what());
+  }
+  return false;
+} // end hcv_database_fetch_session
+
+
+bool
+hcv_database_update_session_expiries(const std::vector<std::pair<std::string,time_t>>& uuidexpvec)
+{
+  std::string uuidarr = "{", exparr = "{";
+  for (auto& uuidexp: uuidexpvec)
+    {
+      char numbuf[32];
+      hcv_append_sql_array_element(uuidarr, uuidexp.first);
+      snprintf(numbuf, sizeof(numbuf), "%lld", (long long)uuidexp.second);
+      hcv_append_sql_array_element(exparr, numbuf);
+    }
+  uuidarr.push_back('}');
+  exparr.push_back('}');
+  try {
+    Hcv_PreparedStatement stmt("update_session_expiries_pstm");
+    stmt.bind(uuidarr);
+    stmt.bind(exparr);
+    stmt.query();
+  } catch (std::exception& exc) {
+    HCV_SYSLOGOUT(LOG_WARNING,
+		  "hcv_database_update_session_expiries of " << uuidexpvec.size()
+		  << " sessions got exception:" << exc.what());
+    return false;
+  }
+  return true;
+} // end hcv_database_update_session_expiries
+
+
+void
+hcv_database_close_session(const std::string& uuid)
+{
+  try {
+    Hcv_PreparedStatement stmt("close_session_pstm");
+    stmt.bind(uuid);
+    stmt.query();
+  } catch (std::exception& exc) {
+    HCV_SYSLOGOUT(LOG_WARNING,
+		  "hcv_database_close_session uuid=" << uuid
+		  << " got exception:" << exc.what());
+  }
+} // end hcv_database_close_session
+
+
+long
+hcv_database_purge_batch(const char*pstmname, long batchsize)
+{
+  HCV_ASSERT(pstmname != nullptr);
+  try {
+    Hcv_PreparedStatement stmt(pstmname);
+    stmt.bind((std::int64_t)batchsize);
+    pqxx::result res = stmt.query();
+    return res.affected_rows();
+  } catch (std::exception& exc) {
+    HCV_SYSLOGOUT(LOG_WARNING,
+		  "hcv_database_purge_batch " << pstmname
+		  << " got exception:" << exc.what());
+  }
+  return -1;
+} // end hcv_database_purge_batch
+
+
+bool
+hcv_database_delete_dormant_users(void)
+{
+  try {
+    Hcv_PreparedStatement stmt("delete_dormant_users_pstm");
+    stmt.query();
+    return true;
+  } catch (std::exception& exc) {
+    HCV_SYSLOGOUT(LOG_WARNING,
+		  "hcv_database_delete_dormant_users got exception:" << exc.what());
+  }
+  return false;
+} // end hcv_database_delete_dormant_users
+
 
 void
 hcv_close_database(void)
 {
   HCV_DEBUGOUT("hcv_close_database start");
+  /// the cookie writer thread may need hcv_dbmtx to check out a connection
+  hcv_stop_cookie_writer();
   std::lock_guard<std::recursive_mutex> gu(hcv_dbmtx);
   HCV_ASSERT(hcv_dbconn);
   std::string dbnamestr(hcv_dbconn->dbname());
@@ -866,6 +1701,7 @@ hcv_close_database(void)
     finaltransact.commit();
   }
   HCV_DEBUGOUT("hcv_close_database before resetting database connection");
+  hcv_database_close_pool();
   hcv_dbconn.reset(nullptr);
   HCV_SYSLOGOUT(LOG_NOTICE, "closed database " << dbnamestr);
 } // end hcv_close_database
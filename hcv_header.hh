@@ -31,6 +31,8 @@
 #include <map>
 #include <deque>
 #include <variant>
+#include <optional>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <new>
@@ -46,6 +48,7 @@
 #include <shared_mutex>
 #include <thread>
 #include <condition_variable>
+#include <future>
 #include <atomic>
 #include <stdexcept>
 #include <functional>
@@ -56,12 +59,14 @@
 #include <cassert>
 #include <cstring>
 #include <cmath>
+#include <cstdarg>
 #include <cstdio>
 #include <clocale>
 
 #include <argp.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -115,6 +120,15 @@ extern "C" unsigned hcv_http_payload_max;
 #include "glibmm.h"
 #include "giomm.h"
 
+// zlib https://zlib.net/ for gzip Content-Encoding
+#include <zlib.h>
+
+// OpenSSL https://www.openssl.org/ for signed web cookies
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
 // in generated __timestamp.c
 extern "C" const char hcv_timestamp[];
 extern "C" const unsigned long hcv_timelong;
@@ -199,25 +213,44 @@ extern "C" const char*hcv_get_locale(void);
 ////////////////////////////////////////////////////////////////
 // syslog facility
 
+/// Log messages are queued in a per-thread ring buffer, and written to
+/// syslog(3) or to the --log-file by a dedicated logger thread; see
+/// file hcv_log.cc.  Messages of priority above HCV_LOG_MAXPRIO are
+/// compiled out, so building with -DHCV_LOG_MAXPRIO=LOG_INFO removes
+/// every HCV_DEBUGOUT.
+#ifndef HCV_LOG_MAXPRIO
+#define HCV_LOG_MAXPRIO LOG_DEBUG
+#endif /*HCV_LOG_MAXPRIO*/
+
+extern "C" void hcv_syslog_at (const char *fil, int lin, int prio, std::string&&str);
+/// unused, but still defined for plugins compiled with older
+/// HCV_SYSLOGOUT macros, which locked it
 extern "C" std::recursive_mutex hcv_syslogmtx;
-extern "C" void hcv_syslog_at (const char *fil, int lin, int prio,const std::string&str);
 #define HCV_SYSLOGOUT_AT_BIS(Fil,Lin,Prio,...) do {		\
+  if ((Prio) <= HCV_LOG_MAXPRIO) {				\
   int err##Lin = errno;						\
-  std::lock_guard<std::recursive_mutex>				\
-    gu##Lin(hcv_syslogmtx);					\
   std::ostringstream outs##Lin;					\
   outs##Lin << " !! "						\
 	 << __VA_ARGS__ << std::endl;				\
   if (err##Lin)							\
     outs##Lin << "-: " << strerror(err##Lin);			\
   hcv_syslog_at ((Fil), (Lin), (Prio), (outs##Lin.str()));	\
-  } while(0)
+  } } while(0)
 
 #define HCV_SYSLOGOUT_AT(Fil,Lin,Prio,...) HCV_SYSLOGOUT_AT_BIS(Fil,Lin,(Prio),##__VA_ARGS__)
 
 // typical usage would be HCV_SYSLOGOUT(LOG_NOTICE,"x=" << x)
 #define HCV_SYSLOGOUT(Prio,...) HCV_SYSLOGOUT_AT(__FILE__,__LINE__,(Prio),##__VA_ARGS__)
 
+/// start the logger thread, writing to the given file if not empty,
+/// else to syslog; before it is started or once it is stopped,
+/// messages are written synchronously
+extern "C" void hcv_start_logger(const std::string&logpath);
+extern "C" void hcv_stop_logger(void);
+/// write every queued message now, e.g. before a fatal stop
+extern "C" void hcv_log_flush(void);
+extern "C" void hcv_log_statistics(long*pnblogged, long*pnbdropped);
+
 
 
 // debug facility
@@ -227,13 +260,18 @@ extern "C" std::atomic<bool> hcv_debugging;
 extern "C" const Json::StreamWriterBuilder& hcv_get_json_builder(void);
 
 extern "C" void hcv_debug_at (const char *fil, int lin, std::ostringstream&outs);
-#define HCV_DEBUGOUT_AT_BIS(Fil,Lin,...) do {	\
-  if (hcv_debugging.load()) {			\
-  std::ostringstream outs##Lin;			\
-  outs##Lin << " "				\
-	    << __VA_ARGS__ << std::flush;	\
-  hcv_debug_at ((Fil),(Lin),(outs##Lin));	\
+#if HCV_LOG_MAXPRIO >= LOG_DEBUG
+#define HCV_DEBUGOUT_AT_BIS(Fil,Lin,...) do {			\
+  if (HCV_UNLIKELY(hcv_debugging.load(std::memory_order_relaxed))) { \
+  std::ostringstream outs##Lin;					\
+  outs##Lin << " "						\
+	    << __VA_ARGS__ << std::flush;			\
+  hcv_debug_at ((Fil),(Lin),(outs##Lin));			\
   } } while(0)
+#else
+#define HCV_DEBUGOUT_AT_BIS(Fil,Lin,...) do { if (false)	\
+      std::clog << __VA_ARGS__; } while(0)
+#endif /*HCV_LOG_MAXPRIO >= LOG_DEBUG*/
 
 #define HCV_DEBUGOUT_AT(Fil,Lin,...) HCV_DEBUGOUT_AT_BIS(Fil,Lin,##__VA_ARGS__)
 
@@ -259,18 +297,46 @@ extern "C" void hcv_config_do(const std::function<void(const Glib::KeyFile*)>&do
 
 extern "C" void hcv_load_config_file(const char*configfile=nullptr);
 
+/// reload on SIGHUP the configuration file, the chunk maps and the
+/// compiled templates, each published as a new snapshot; on failure
+/// the previous configuration is kept and false is returned
+extern "C" bool hcv_reload_configuration(void);
+
 //////////////// in file hcv_chunkmap.cc
 
 /// parse a file of chunk maps, inspired by C++ raw literal strings
-/// associating a message key to a multi-line message.
+/// associating a message key to a multi-line message.  Throws a
+/// std::runtime_error on syntax errors.
 extern "C" std::map<std::string,std::string>
 hcv_parse_chunk_map(const std::string& filepath);
 
 /// add a given chunkmap file to the global chunk map
 extern "C" void hcv_add_chunkmap_file(const std::string& filepath);
 
+/// replace the global chunk map by the one parsed from the given files
+extern "C" bool hcv_replace_chunkmap_files(const std::vector<std::string>& pathvec);
+
+/// compile a textual chunk map file into a binary one, loaded faster;
+/// throws a std::runtime_error on failure
+extern "C" void hcv_compile_chunk_map(const std::string& srcpath, const std::string& outpath);
+
 /// retrieve safely an entry into the global chunk map
 extern "C" const std::string hcv_get_chunkmap_entry(const std::string&chunkname);
+
+/// keeps alive the snapshot into which some returned string views point
+typedef std::shared_ptr<const void> hcv_snapshot_ref_t;
+
+/// retrieve without copying nor locking an entry into the global chunk
+/// map, or an empty view; it stays valid while ref is kept, even if
+/// the chunk map is reloaded meanwhile
+extern "C" std::string_view hcv_get_chunkmap_view(std::string_view chunkname,
+    hcv_snapshot_ref_t&ref);
+
+/// true if some chunk name ends with _LANG, e.g. _fr for "fr"
+extern "C" bool hcv_chunkmap_has_language(std::string_view lang);
+
+/// incremented after each change of the global chunk map
+extern "C" long hcv_chunkmap_generation(void);
 ////////////////
 
 //// get a string in [html] section of configuration file.
@@ -282,24 +348,109 @@ extern "C" std::string hcv_get_config_html(const std::string &name);
 //// if missing, return an empty string
 //// useful for <?hcv confmsg MESSAGEID ....?>
 extern "C" std::string hcv_get_config_message(const char*msgid);
+
+//// the same, without copying nor locking; the views stay valid
+//// while ref is kept, even if the configuration is reloaded
+extern "C" std::string_view hcv_get_config_html_view(std::string_view name,
+    hcv_snapshot_ref_t&ref);
+extern "C" std::string_view hcv_get_config_message_view(std::string_view msgid,
+    hcv_snapshot_ref_t&ref);
 ////////////////////////////////////////////////////////////////
 
+/// RAII checkout of a connection from the PostGreSQL connection pool,
+/// waiting for some idle one; it is given back when destroyed.
+class Hcv_DatabaseConnection
+{
+  pqxx::connection* _hcvdbc_conn;
+  int _hcvdbc_index;		// index in the pool
+  int _hcvdbc_uncaught;		// std::uncaught_exceptions at checkout
+public:
+  Hcv_DatabaseConnection();
+  ~Hcv_DatabaseConnection();
+  Hcv_DatabaseConnection(const Hcv_DatabaseConnection&) = delete;
+  Hcv_DatabaseConnection& operator = (const Hcv_DatabaseConnection&) = delete;
+  pqxx::connection& operator * () const
+  {
+    return *_hcvdbc_conn;
+  };
+  pqxx::connection* operator -> () const
+  {
+    return _hcvdbc_conn;
+  };
+  pqxx::connection* get() const
+  {
+    return _hcvdbc_conn;
+  };
+  /// the connection will be checked before its next use
+  void mark_suspect(void);
+};				// end Hcv_DatabaseConnection
+
+struct hcv_database_pool_stats_st
+{
+  long dbpool_size;		// number of pooled connections
+  long dbpool_idle;		// currently idle ones
+  long dbpool_checkouts;	// total number of checkouts
+  long dbpool_waits;		// checkouts which had to wait
+  double dbpool_total_wait;	// total waiting time, in seconds
+  double dbpool_max_wait;	// longest wait, in seconds
+  long dbpool_reconnects;	// broken connections reopened
+};
+extern "C" hcv_database_pool_stats_st hcv_database_pool_statistics(void);
+/// waiting times of every checkout, for /metrics; see hcv_metrics.cc
+class Hcv_latency_histogram;
+extern "C" Hcv_latency_histogram hcv_database_pool_wait_histogram;
+
+
+/// A registered prepared statement (its name ending with _pstm), run
+/// with bound parameters.  Parameters are kept in an inline array, and
+/// the statement runs either in its own transaction on a pooled
+/// connection (committed by query) or in some caller's transaction,
+/// shared by several statements.  Latencies are counted per statement.
+struct hcv_pstm_counters_st;	// opaque, in hcv_database.cc
+#define HCV_PSTM_MAX_PARAMS 8
 class Hcv_PreparedStatement
 {
 public:
-  Hcv_PreparedStatement(const std::string& name);
+  Hcv_PreparedStatement(const char* name);
+  Hcv_PreparedStatement(pqxx::work& txn, const char* name);
   ~Hcv_PreparedStatement();
+  Hcv_PreparedStatement(const Hcv_PreparedStatement&) = delete;
+  Hcv_PreparedStatement& operator = (const Hcv_PreparedStatement&) = delete;
 
   void bind(const std::string& arg);
+  void bind(const char* arg);
   void bind(char arg);
+  void bind(int arg)
+  {
+    bind((std::int64_t)arg);
+  };
   void bind(std::int64_t arg);
+  void bind(double arg);
+  /// execute the statement, then forget its bound parameters; with
+  /// our own transaction, it is committed.
   pqxx::result query();
 
 private:
-  std::string m_name;
-  pqxx::prepare::invocation* m_inv;
+  std::string& next_param(void);
+  const char* m_name;
+  hcv_pstm_counters_st* m_counters;
+  std::optional<Hcv_DatabaseConnection> m_dbconn;
+  std::optional<pqxx::work> m_owntxn;
   pqxx::work* m_txn;
+  unsigned m_nbparams;
+  std::string m_params[HCV_PSTM_MAX_PARAMS];
+};				// end Hcv_PreparedStatement
+
+struct hcv_prepared_statement_stats_st
+{
+  std::string pstm_name;
+  long pstm_count;		// number of executions
+  long pstm_errors;		// number of failed executions
+  double pstm_total_time;	// cumulated latency, in seconds
+  double pstm_max_time;		// largest latency, in seconds
 };
+extern "C" std::vector<hcv_prepared_statement_stats_st>
+hcv_database_prepared_statement_statistics(void);
 
 
 //// PostGreSQL database
@@ -321,6 +472,59 @@ extern "C" bool hcv_database_with_known_email(const std::string&emailstr);
 extern "C" long
 hcv_database_get_id_of_added_web_cookie(const std::string& randomstr,
                                         time_t exptime, int webagenthash);
+
+// give the expiry time of some stored web cookie, or 0 if unknown
+extern "C" time_t
+hcv_database_web_cookie_expiry(long id, const std::string& randomstr,
+                               int webagenthash);
+
+// replace the random string of some stored web cookie
+extern "C" bool
+hcv_database_set_web_cookie_random(long id, const std::string& randomstr);
+
+// open a session in tb_session, giving its UUID and expiry time
+extern "C" std::string
+hcv_database_open_session(long userid, const std::string& http_ua,
+                          const std::string& ip, time_t*pexpiry);
+
+// fetch a session from tb_session, or return false
+extern "C" bool
+hcv_database_fetch_session(const std::string& uuid, long*puserid,
+                           std::string& http_ua, std::string& ip,
+                           time_t*pexpiry);
+
+// write several session expiry times in one UPDATE
+extern "C" bool
+hcv_database_update_session_expiries(const std::vector<std::pair<std::string,time_t>>& uuidexpvec);
+
+// close a session in tb_session
+extern "C" void hcv_database_close_session(const std::string& uuid);
+
+// run a purge prepared statement deleting at most batchsize rows,
+// giving the number of deleted rows, or -1 on failure
+extern "C" long hcv_database_purge_batch(const char*pstmname, long batchsize);
+extern "C" bool hcv_database_delete_dormant_users(void);
+
+////////////////////////////////////////////////////////////////
+//// web sessions, cached in memory in front of tb_session, see hcv_session.cc
+#define HCV_SESSION_DURATION 3600 /*seconds, as in tb_session*/
+extern "C" std::string hcv_session_open(long userid, const std::string&http_ua,
+                                        const std::string&ip);
+extern "C" bool hcv_session_is_valid(const std::string&uuid, const std::string&http_ua,
+                                     const std::string&ip, long*puserid);
+/// extend the expiry of a valid session, written later to the database
+extern "C" bool hcv_session_ping(const std::string&uuid);
+extern "C" void hcv_session_close(const std::string&uuid);
+extern "C" void hcv_session_flush_expiries(void);
+extern "C" void hcv_session_periodic_flush(void);
+struct hcv_session_cache_stats_st
+{
+  long sesscache_size;		// number of cached sessions
+  long sesscache_hits;
+  long sesscache_misses;	// fetched from the database
+  long sesscache_flushed;	// expiry times written to the database
+};
+extern "C" hcv_session_cache_stats_st hcv_session_cache_statistics(void);
 ////////////////////////////////////////////////////////////////
 
 //// Web service
@@ -347,11 +551,93 @@ void hcv_stop_web(void);
 
 extern "C" void hcv_webserver_run(void);
 
+/// wrap a web handler so that each request it serves is traced as one
+/// span of the given name, and timed into the latency histogram of
+/// that route shown by /metrics; plugins can use it for their own
+/// handlers
+extern "C" httplib::Server::Handler hcv_web_traced_handler(const char*spanname,
+    const httplib::Server::Handler&handler);
+
+//// metrics in the Prometheus text format, in hcv_metrics.cc
+
+/// A latency histogram with logarithmic buckets, two per power of two
+/// of microseconds, from 32 microseconds to about 30 seconds.  Its
+/// counters are spread on shards, each thread recording into one of
+/// them, so that recording is a few relaxed atomic increments which
+/// rarely share a cache line.
+#define HCV_HISTOGRAM_NB_BUCKETS 42 /* the last one is unbounded */
+#define HCV_HISTOGRAM_NB_SHARDS 16
+class Hcv_latency_histogram
+{
+  struct alignas(64) hcv_histogram_shard_st
+  {
+    std::atomic<long> hcvhsh_buckets[HCV_HISTOGRAM_NB_BUCKETS];
+    std::atomic<long> hcvhsh_sum_microseconds;
+  };
+  hcv_histogram_shard_st _hcvhist_shards[HCV_HISTOGRAM_NB_SHARDS];
+public:
+  Hcv_latency_histogram();
+  /// upper bound of a bucket, in seconds, or infinity for the last one
+  static double bucket_upper_bound(unsigned ix);
+  void record(double seconds);
+  /// sum the shards into counts, giving the sum of all latencies in seconds
+  double snapshot(long counts[HCV_HISTOGRAM_NB_BUCKETS]) const;
+};				// end class Hcv_latency_histogram
+
+/// find or create the latency histogram of a web route
+extern "C" Hcv_latency_histogram* hcv_metrics_route_histogram(const std::string&route);
+/// the /metrics handler
+extern "C" void hcv_web_get_metrics(const httplib::Request&req, httplib::Response&resp);
+
 extern "C" void hcv_output_encoded_html(std::ostream&out, const std::string&str);
 extern "C" void hcv_output_cstr_encoded_html(std::ostream&out, const char*cstr);
+/// append to outstr the HTML encoding of the len bytes at str
+extern "C" void hcv_append_encoded_html(std::string&outstr, const char*str, size_t len);
+/// the same without vector instructions, to cross-check and benchmark them
+extern "C" void hcv_append_encoded_html_scalar(std::string&outstr, const char*str, size_t len);
 
 extern "C" std::string hcv_get_web_root(void);
 
+//// static files under the webroot, cached in memory, in hcv_static.cc
+//// serve the file of the request path, or return false if none
+extern "C" bool hcv_serve_static_file(const httplib::Request&req, httplib::Response&resp, long reqnum);
+extern "C" void hcv_clear_static_file_cache(void);
+extern "C" void hcv_static_file_cache_statistics(long*phits, long*pmisses, long*pnotmodified, long*pnbentries);
+
+//// gzip compression of HTTP responses, in hcv_compress.cc
+extern "C" const unsigned hcv_min_compressed_size;
+extern "C" bool hcv_request_accepts_gzip(const httplib::Request&req);
+extern "C" bool hcv_compressible_content_type(const std::string&ctype);
+/// a whole gzip member, by default with the best compression, which
+/// is worth its CPU time only for contents compressed once and cached
+extern "C" std::string hcv_gzip_compress(const char*data, size_t len,
+    int level = Z_BEST_COMPRESSION);
+/// the compression level of responses compressed at each request
+#ifndef HCV_DYNAMIC_GZIP_LEVEL
+#define HCV_DYNAMIC_GZIP_LEVEL Z_DEFAULT_COMPRESSION
+#endif /*HCV_DYNAMIC_GZIP_LEVEL*/
+/// a raw deflate piece, ending on a byte boundary with Z_SYNC_FLUSH, to
+/// be given to Hcv_gzip_builder::add_deflated
+extern "C" std::string hcv_raw_deflate_sync_flush(const char*data, size_t len);
+
+/// builds a gzip member from precompressed raw deflate pieces and
+/// uncompressed data put in stored blocks
+class Hcv_gzip_builder
+{
+  std::string _hcvgz_out;
+  unsigned long _hcvgz_crc;
+  size_t _hcvgz_size;
+public:
+  Hcv_gzip_builder(size_t reserved=0);
+  void add_deflated(const std::string&rawdeflated, unsigned long crc, size_t len);
+  void add_stored(const char*data, size_t len);
+  std::string finish(void);
+};				// end Hcv_gzip_builder
+
+/// set the response content, gzip-ed if the request accepts it
+extern "C" void hcv_web_set_compressible_content(const httplib::Request&req, httplib::Response&resp,
+    std::string&&content, const char*ctype);
+
 
 
 #define HCV_HTML_RESPONSE_MAX_LEN  (128*1024)
@@ -361,8 +647,23 @@ extern "C" std::string hcv_get_web_root(void);
 
 /// return a string, perhaps 0123-9wI1QOXiH0M03Pf1ef14ab69-1abc4, for a fresh web cookie for HCV_COOKIE_NAME
 extern "C" std::string hcv_web_register_fresh_cookie(Hcv_http_template_data*);
+/// store the HCV_COOKIE_NAME cookie of a request opening a session
+/// into tb_web_cookie, giving its wcookie_id; see hcv_web.cc
+extern "C" long hcv_web_persist_signed_cookie(Hcv_http_template_data*htpl);
 /// forget our HCV_COOKIE_NAME cookie
 extern "C" void hcv_web_forget_cookie(Hcv_http_template_data*htpl);
+/// check a HCV_COOKIE_NAME cookie value sent with a request, giving its id
+extern "C" bool hcv_web_validate_cookie(const std::string&cookiestr,
+                                        const httplib::Request&req, long*pid);
+/// find and check the HCV_COOKIE_NAME cookie in the Cookie: request header
+extern "C" bool hcv_web_request_cookie(const httplib::Request&req, long*pid);
+
+/// the cookie of an authenticated session, holding its UUID
+#define HCV_SESSION_COOKIE_NAME "HelpCovid_SESSION"
+/// open a session for a logged in user and set its cookie, giving its UUID
+extern "C" std::string hcv_web_open_session(Hcv_http_template_data*htpl, long userid);
+/// check and ping the session of a request, giving its user id
+extern "C" bool hcv_web_request_session(const httplib::Request&req, long*puserid);
 
 ////////////////////////////////////////////////////////////////
 
@@ -372,6 +673,68 @@ extern "C" void hcv_web_forget_cookie(Hcv_http_template_data*htpl);
 
 extern "C" const unsigned hcv_max_template_size;
 
+
+//// a stream buffer appending into a growable std::string, whose
+//// contents can be moved out without copying, e.g. into some
+//// httplib::Response body.
+class Hcv_string_streambuf : public std::streambuf
+{
+  std::string _hcvsbuf_str;
+protected:
+  virtual int_type overflow(int_type ch)
+  {
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+      _hcvsbuf_str.push_back(traits_type::to_char_type(ch));
+    return traits_type::not_eof(ch);
+  };
+  virtual std::streamsize xsputn(const char*s, std::streamsize n)
+  {
+    _hcvsbuf_str.append(s, n);
+    return n;
+  };
+public:
+  Hcv_string_streambuf() : std::streambuf(), _hcvsbuf_str() {};
+  void reserve(size_t sz)
+  {
+    _hcvsbuf_str.reserve(sz);
+  };
+  size_t size() const
+  {
+    return _hcvsbuf_str.size();
+  };
+  std::string take_string()
+  {
+    std::string res;
+    res.swap(_hcvsbuf_str);
+    return res;
+  };
+};				// end Hcv_string_streambuf
+
+class Hcv_string_ostream : public std::ostream
+{
+  Hcv_string_streambuf _hcvsos_buf;
+public:
+  Hcv_string_ostream() : std::ostream(nullptr), _hcvsos_buf()
+  {
+    rdbuf(&_hcvsos_buf);
+  };
+  void reserve(size_t sz)
+  {
+    _hcvsos_buf.reserve(sz);
+  };
+  size_t size() const
+  {
+    return _hcvsos_buf.size();
+  };
+  /// move out the accumulated output, leaving this stream empty
+  std::string take_string()
+  {
+    flush();
+    return _hcvsos_buf.take_string();
+  };
+};				// end Hcv_string_ostream
+
+
 class Hcv_template_data
 {
 protected:
@@ -412,12 +775,12 @@ protected:
   const httplib::Request* _hcvhttp_request;
   httplib::Response* _hcvhttp_response;
   long _hcvhttp_reqnum;
-  mutable std::ostringstream _hcvhttp_outs;
+  mutable Hcv_string_ostream _hcvhttp_outs;
   std::string _hcvhttp_cookie_header;
   /// from cached Accept-Language: HTTP header request
   /// see https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/Accept-Language
   /// see https://tools.ietf.org/html/bcp47
-  mutable std::string _hcvhttp_language; // eg "fr" or "en", assume UTF-8 encoding
+  mutable std::shared_ptr<const std::vector<std::string>> _hcvhttp_languages; // eg "fr" then "en", assume UTF-8 encoding
 public:
   Hcv_http_template_data(const httplib::Request& req, httplib::Response&resp, long reqnum)
     : Hcv_template_data(TmplKind_en::hcvtk_http),
@@ -426,7 +789,7 @@ public:
       _hcvhttp_reqnum(reqnum),
       _hcvhttp_outs(),
       _hcvhttp_cookie_header(),
-      _hcvhttp_language()
+      _hcvhttp_languages()
   {
   };
 protected:
@@ -437,7 +800,7 @@ protected:
       _hcvhttp_reqnum(reqnum),
       _hcvhttp_outs(),
       _hcvhttp_cookie_header(),
-      _hcvhttp_language()
+      _hcvhttp_languages()
   {
   };
 public:
@@ -454,6 +817,9 @@ public:
     else
       return "";
   };
+  /// the languages we have, best first, accepted by the request
+  virtual std::shared_ptr<const std::vector<std::string>> request_languages(void) const;
+  /// the best of them, or an empty string
   virtual std::string request_language(void) const;
   //
   std::string cookie_header() const
@@ -539,7 +905,7 @@ class Hcv_email_template_data : public Hcv_template_data
   std::string _hcvemail_subject; // subject of the email
   /// see subdirectory helpcovid/emailtempl/ containing template files
   std::string _hcvemail_template;		// path of HTML template file
-  mutable std::ostringstream _hcvemail_outbody;  // output stream for email body
+  mutable Hcv_string_ostream _hcvemail_outbody;  // output stream for email body
   static std::atomic<long> _hcvemail_counter_;
   static long incremented_email_counter(void);
 public:
@@ -587,6 +953,36 @@ extern "C" std::string hcv_expand_template_input_stream(std::istream&srcinp, con
 
 extern "C" std::string hcv_expand_template_string(const std::string&inpstr, const char*inpname, Hcv_template_data*templdata);
 
+/// template files are compiled once and cached by path, this forgets
+/// all compiled templates.
+extern "C" void hcv_clear_template_cache(void);
+
+/// recompile aside every cached template, then publish them at once
+extern "C" void hcv_rebuild_template_cache(void);
+
+/// give the number of hits, misses and entries of the compiled template cache
+extern "C" void hcv_template_cache_statistics(long*phits, long*pmisses, long*pnbentries);
+
+/// per-language variants of compiled templates, reused or built
+extern "C" void hcv_template_variant_statistics(long*phits, long*pbuilds);
+
+/// parse an Accept-Language: HTTP header into primary language
+/// subtags, ranked by decreasing q-value
+extern "C" std::vector<std::string> hcv_parse_accept_language(std::string_view header);
+
+/// the languages we have among those of an Accept-Language: header, best first
+extern "C" std::shared_ptr<const std::vector<std::string>> hcv_negotiate_languages(const std::string&header);
+
+/// register the languages having a gettext catalog in a text domain directory
+extern "C" void hcv_register_gettext_languages(const char*textdomdir);
+
+extern "C" void hcv_language_cache_statistics(long*phits, long*pmisses, long*pnbentries);
+
+/// if body is the last HTML template rendered by this thread for that
+/// response, build its gzip encoding from the precompressed literal
+/// segments of its compiled template, and return true.
+extern "C" bool hcv_template_gzip_last_rendering(const httplib::Response*resp, const std::string&body, std::string&gzbody);
+
 typedef std::function<void(Hcv_template_data*templdata, const std::string &procinstr, const char*filename, int lineno, long offset)> hcv_template_expanding_closure_t;
 // the name should be like a C identifier
 extern "C" void hcv_register_template_expander_closure(const std::string&name, const hcv_template_expanding_closure_t&expfun);
@@ -640,6 +1036,72 @@ hcv_thread_cpu_time(void)
   return 1.0*ts.tv_sec + 1.0e-9*ts.tv_nsec;
 } // end hcv_thread_cpu_time
 
+
+///////////////////////////////////////////////////////////////////////////////
+// tracing of timed spans, see file hcv_trace.cc
+
+/// While hcv_tracing is true, each Hcv_trace_span records its real
+/// and thread CPU elapsed times, its nesting depth and the current web
+/// request number into a per-thread buffer, dumped in binary form
+/// into the trace file by the background thread.  Tracing is started
+/// by --trace-file and toggled by SIGUSR1.  Span names are interned
+/// into small integers.
+extern "C" std::atomic<bool> hcv_tracing;
+extern "C" unsigned hcv_trace_intern(const std::string&name);
+extern "C" unsigned hcv_trace_enter(void);
+extern "C" void hcv_trace_record_span(unsigned nameid, unsigned depth, double startime, double startcpu);
+extern "C" void hcv_trace_set_request(long reqnum);
+extern "C" void hcv_set_trace_file(const std::string&tracepath);
+extern "C" bool hcv_start_tracing(void);
+extern "C" void hcv_stop_tracing(void);
+extern "C" void hcv_trace_periodic_dump(void);
+extern "C" void hcv_trace_statistics(long*pnbspans, long*pnbdropped);
+
+class Hcv_trace_span
+{
+  unsigned _hcvspan_name;
+  unsigned _hcvspan_depth;
+  bool _hcvspan_on;
+  double _hcvspan_start;
+  double _hcvspan_startcpu;
+public:
+  Hcv_trace_span(unsigned nameid)
+    : _hcvspan_name(nameid), _hcvspan_depth(0),
+      _hcvspan_on(hcv_tracing.load(std::memory_order_relaxed)),
+      _hcvspan_start(0.0), _hcvspan_startcpu(0.0)
+  {
+    if (HCV_UNLIKELY(_hcvspan_on))
+      {
+        _hcvspan_depth = hcv_trace_enter();
+        _hcvspan_startcpu = hcv_thread_cpu_time();
+        _hcvspan_start = hcv_monotonic_real_time();
+      }
+  };
+  ~Hcv_trace_span()
+  {
+    if (HCV_UNLIKELY(_hcvspan_on))
+      hcv_trace_record_span(_hcvspan_name, _hcvspan_depth,
+                            _hcvspan_start, _hcvspan_startcpu);
+  };
+  Hcv_trace_span(const Hcv_trace_span&) = delete;
+  Hcv_trace_span& operator = (const Hcv_trace_span&) = delete;
+};				// end class Hcv_trace_span
+
+#define HCV_TRACE_SPAN_AT_BIS(Lin,Name)				\
+  static const unsigned hcvtrname##Lin = hcv_trace_intern(Name); \
+  Hcv_trace_span hcvtrspan##Lin(hcvtrname##Lin)
+#define HCV_TRACE_SPAN_AT(Lin,Name) HCV_TRACE_SPAN_AT_BIS(Lin,Name)
+
+// typical usage would be HCV_TRACE_SPAN("template render"), tracing
+// until the end of the enclosing block
+#define HCV_TRACE_SPAN(Name) HCV_TRACE_SPAN_AT(__LINE__,Name)
+
+#define HCV_TRACE_SPAN_ID_AT_BIS(Lin,Id) Hcv_trace_span hcvtrspan##Lin(Id)
+#define HCV_TRACE_SPAN_ID_AT(Lin,Id) HCV_TRACE_SPAN_ID_AT_BIS(Lin,Id)
+
+// the same, for some name interned beforehand by hcv_trace_intern
+#define HCV_TRACE_SPAN_ID(Id) HCV_TRACE_SPAN_ID_AT(__LINE__,(Id))
+
 ///////////////////////////////////////////////////////////////////////////////
 // random numbers - shameless copied from code of http://refpersys.org/
 
@@ -764,22 +1226,47 @@ public:
  * the time, and wakes up every ten seconds to run some cleanup.
  *******/
 extern "C" void hcv_start_background_thread(void);
+// stop the background thread and the worker threads, and join them
+extern "C" void hcv_join_background_thread(void);
 
 
 // register a closure and some data to be executed in the background
-// thread postponed by some delay (at least 0.01 seconds, at most 1000
-// seconds).
+// thread postponed by some delay (at least 0.01 seconds, at most one
+// day).
 #define HCV_POSTPONE_MINIMAL_DELAY 0.01
-#define HCV_POSTPONE_MAXIMAL_DELAY 1000.0
+#define HCV_POSTPONE_MAXIMAL_DELAY 86400.0
 extern "C" void hcv_do_postpone_background(double delay, const std::string&name, void*data,
     const std::function<void(void*)>& todofun);
+// the same, but the task is run by some worker thread, with at most
+// a configured number of running tasks in its task class
+extern "C" void hcv_do_postpone_background_task(double delay, const char*taskclass,
+    const std::string&name, void*data,
+    const std::function<void(void*)>& todofun);
+// number of postponed tasks still pending
+extern "C" long hcv_background_pending_count(void);
+extern "C" void hcv_stop_background_workers(void);
+struct hcv_task_class_stats_st
+{
+  std::string tcl_name;
+  int tcl_limit;		// maximal number of running tasks
+  int tcl_running;
+  long tcl_queued;		// due tasks waiting for a worker
+  long tcl_completed;
+  double tcl_total_wait;	// cumulated queue wait, in seconds
+  double tcl_max_wait;
+  double tcl_total_run;		// cumulated running time, in seconds
+};
+extern "C" std::vector<hcv_task_class_stats_st> hcv_background_task_class_statistics(void);
 
 
 /*****
  * a cleanup function to be run in the background thread every five
- * minutes, or with the --cleanup program argument
+ * minutes
  *****/
 extern "C" void hcv_background_periodic_cleanup(void);
+// the cleanup engine, also run with the --cleanup program argument
+// with an infinite time budget; gives true if every table was purged
+extern "C" bool hcv_run_database_cleanup(double timebudget);
 ///////////////////////////////////////////////////////////////////////////////
 
 
@@ -878,6 +1365,11 @@ hcv_profile_view_get(const httplib::Request& req, httplib::Response& resp,
 ///////////////////////////////////////////////////////////////////////////////
 // message views - to emit some message (usually request specific, e.g. localized)
 ///////////////////////////////////////////////////////////////////////////////
+/// resolve a message id for some languages, best first, or give rawmsg
+extern "C" std::string
+hcv_view_resolve_msg(const char*msgid, const std::vector<std::string>&langs,
+                     std::string_view rawmsg, const char*filename, int lineno);
+
 /// expand a message using locale(7) related tricks <?hcg msg MESSAGEID etc...?>
 extern "C" std::string
 hcv_view_expand_msg(Hcv_http_template_data*tdata, const std::string &procinstr,
@@ -899,6 +1391,28 @@ extern "C" void hcv_load_plugin(const char*plugin_name, const char*plugin_arg);
 /// called once from hcv_web.cc
 extern "C" void hcv_initialize_plugins_for_web(httplib::Server*);
 
+/// plugins register their web handlers thru this, so that each of them
+/// is a traced span and has its latency histogram in /metrics
+class Hcv_plugin_web_registrar
+{
+  httplib::Server* _hcvreg_server;
+  std::string _hcvreg_plugin;	// the plugin name
+public:
+  Hcv_plugin_web_registrar(httplib::Server*server, const std::string&plugin)
+    : _hcvreg_server(server), _hcvreg_plugin(plugin) {};
+  /// for other settings of the web server, not to register handlers
+  httplib::Server* server(void) const
+  {
+    return _hcvreg_server;
+  };
+  const std::string& plugin_name(void) const
+  {
+    return _hcvreg_plugin;
+  };
+  Hcv_plugin_web_registrar& get(const char*pattern, const httplib::Server::Handler&handler);
+  Hcv_plugin_web_registrar& post(const char*pattern, const httplib::Server::Handler&handler);
+};				// end class Hcv_plugin_web_registrar
+
 /// called once from hcv_database.cc
 extern "C" void hcv_initialize_plugins_for_database(pqxx::connection*);
 
@@ -910,6 +1424,10 @@ extern "C" const char hcvplugin_version[];
 extern "C" const char hcvplugin_gpl_compatible_license[];
 extern "C" const char hcvplugin_gitapi[]; // our git id
 /// every plugin should have
+extern "C" void hcvplugin_initialize_web_registrar(Hcv_plugin_web_registrar&,const char*);
+/// ... whose signature is
+typedef void hcvplugin_web_registrar_initializer_sig_t(Hcv_plugin_web_registrar&,const char*);
+/// older plugins have instead, with untraced web handlers, their
 extern "C" void hcvplugin_initialize_web(httplib::Server*,const char*);
 /// ... whose signature is
 typedef void hcvplugin_web_initializer_sig_t(httplib::Server*,const char*);
@@ -0,0 +1,403 @@
+/****************************************************************
+ * file hcv_log.cc
+ *
+ * Description:
+ *      Asynchronous logging of https://github.com/bstarynk/helpcovid
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+
+extern "C" const char hcv_log_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcv_log_date[] = __DATE__;
+
+
+/// Every thread logging something owns a ring buffer of log records.
+/// Only that thread writes into it and moves its head, and only the
+/// logger thread reads it and moves its tail, so queuing a message
+/// takes no lock and no system call, except waking up a sleeping
+/// logger.  When the ring is full the message is dropped and counted.
+/// The logger thread writes the records to syslog(3), or to the file
+/// given by --log-file.
+#define HCV_LOG_RING_SIZE 1024 /* records per thread, a power of two */
+#define HCV_LOG_IDLE_POLL_MILLISECONDS 500
+
+struct hcv_log_record_st
+{
+  const char*hcvlog_file;	// some __FILE__ string
+  int hcvlog_line;
+  int hcvlog_prio;
+  bool hcvlog_debug;		// from HCV_DEBUGOUT
+  double hcvlog_elapsed;	// seconds since start
+  struct timespec hcvlog_realtime;
+  std::string hcvlog_msg;
+};
+
+struct hcv_log_ring_st
+{
+  std::atomic<unsigned long> hcvring_head; // next record to write, by the owning thread
+  std::atomic<unsigned long> hcvring_tail; // next record to read, by the logger
+  std::atomic<bool> hcvring_orphan;	  // the owning thread has exited
+  hcv_log_record_st hcvring_records[HCV_LOG_RING_SIZE];
+};
+
+/// marks the ring as orphan when its thread exits, so that the logger
+/// frees it once drained
+struct hcv_log_ring_owner_st
+{
+  hcv_log_ring_st*hcvown_ring;
+  ~hcv_log_ring_owner_st()
+  {
+    if (hcvown_ring)
+      hcvown_ring->hcvring_orphan.store(true, std::memory_order_release);
+  };
+};
+
+static thread_local hcv_log_ring_owner_st hcv_log_thread_owner;
+
+static std::mutex hcv_log_rings_mtx;
+static std::vector<hcv_log_ring_st*> hcv_log_rings;
+
+/// serializes the readers of the rings and the writes to the log file
+static std::timed_mutex hcv_log_drain_mtx;
+static FILE* hcv_log_file;
+
+static std::atomic<bool> hcv_log_running;
+static std::atomic<bool> hcv_log_stopping;
+static std::atomic<bool> hcv_log_sleeping;
+static int hcv_log_event_fd = -1;
+static std::thread hcv_log_thread;
+static thread_local bool hcv_log_in_logger_thread;
+
+static std::atomic<long> hcv_log_written;
+static std::atomic<long> hcv_log_dropped;
+static long hcv_log_reported_drops;	// by the drainer
+static long hcv_log_debug_count;	// by the drainer
+
+
+static hcv_log_ring_st*
+hcv_log_thread_ring(void)
+{
+  hcv_log_ring_st* ring = hcv_log_thread_owner.hcvown_ring;
+  if (HCV_LIKELY(ring != nullptr))
+    return ring;
+  ring = new hcv_log_ring_st;
+  ring->hcvring_head.store(0);
+  ring->hcvring_tail.store(0);
+  ring->hcvring_orphan.store(false);
+  {
+    std::lock_guard<std::mutex> gu(hcv_log_rings_mtx);
+    hcv_log_rings.push_back(ring);
+  }
+  hcv_log_thread_owner.hcvown_ring = ring;
+  return ring;
+} // end hcv_log_thread_ring
+
+
+/// write one record, with hcv_log_drain_mtx locked
+static void
+hcv_log_write_locked(hcv_log_record_st&rec)
+{
+  const char*fil = rec.hcvlog_file;
+  if (!fil)
+    fil = "??";
+  else if (rec.hcvlog_debug)
+    {
+      auto ls = strrchr(fil, '/');
+      if (ls && ls[1])
+        fil = ls+1;
+    }
+  std::string&msg = rec.hcvlog_msg;
+  while (!msg.empty() && msg.back() == '\n')
+    msg.pop_back();
+  if (rec.hcvlog_debug && ++hcv_log_debug_count % 100 == 0)
+    {
+      struct tm nowtm = {};
+      localtime_r(&rec.hcvlog_realtime.tv_sec, &nowtm);
+      char timbuf[64];
+      strftime(timbuf, sizeof(timbuf), "%c %Z", &nowtm);
+      if (hcv_log_file)
+        fprintf(hcv_log_file, "========== DEBUG timestamp %s #%ld ==========\n",
+                timbuf, hcv_log_debug_count);
+      else
+        syslog(LOG_DEBUG, "========== DEBUG timestamp %s #%ld ==========",
+               timbuf, hcv_log_debug_count);
+    }
+  if (hcv_log_file)
+    {
+      struct tm msgtm = {};
+      localtime_r(&rec.hcvlog_realtime.tv_sec, &msgtm);
+      char timbuf[48];
+      strftime(timbuf, sizeof(timbuf), "%Y-%m-%d %H:%M:%S", &msgtm);
+      // we use the Δ U+0394 GREEK CAPITAL LETTER DELTA and ▪ U+25AA BLACK SMALL SQUARE and ‣ U+2023 TRIANGULAR BULLET
+      if (rec.hcvlog_debug)
+        fprintf(hcv_log_file, "%s.%03ld <%d> ΔBG!%s:%d▪ %05.2f s‣ %s\n",
+                timbuf, rec.hcvlog_realtime.tv_nsec / 1000000, rec.hcvlog_prio,
+                fil, rec.hcvlog_line, rec.hcvlog_elapsed, msg.c_str());
+      else
+        fprintf(hcv_log_file, "%s.%03ld <%d> %s:%d - %s\n",
+                timbuf, rec.hcvlog_realtime.tv_nsec / 1000000, rec.hcvlog_prio,
+                fil, rec.hcvlog_line, msg.c_str());
+    }
+  else if (rec.hcvlog_debug)
+    syslog(LOG_DEBUG, "ΔBG!%s:%d▪ %05.2f s‣ %s", fil, rec.hcvlog_line,
+           rec.hcvlog_elapsed, msg.c_str());
+  else
+    syslog(rec.hcvlog_prio, "%s:%d - %s", fil, rec.hcvlog_line, msg.c_str());
+  hcv_log_written++;
+} // end hcv_log_write_locked
+
+
+/// write every queued record, with hcv_log_drain_mtx locked; return
+/// the number of written records
+static long
+hcv_log_drain_locked(void)
+{
+  std::vector<hcv_log_ring_st*> ringvec;
+  {
+    std::lock_guard<std::mutex> gu(hcv_log_rings_mtx);
+    ringvec = hcv_log_rings;
+  }
+  long nbwritten = 0;
+  bool gotorphan = false;
+  for (hcv_log_ring_st* ring: ringvec)
+    {
+      bool orphan = ring->hcvring_orphan.load(std::memory_order_acquire);
+      unsigned long tail = ring->hcvring_tail.load(std::memory_order_relaxed);
+      unsigned long head = ring->hcvring_head.load();
+      while (tail < head)
+        {
+          hcv_log_record_st& rec = ring->hcvring_records[tail % HCV_LOG_RING_SIZE];
+          hcv_log_write_locked(rec);
+          rec.hcvlog_msg.clear();
+          tail++;
+          ring->hcvring_tail.store(tail, std::memory_order_release);
+          nbwritten++;
+        }
+      if (orphan)
+        gotorphan = true;
+    }
+  if (gotorphan)
+    {
+      std::lock_guard<std::mutex> gu(hcv_log_rings_mtx);
+      hcv_log_rings.erase
+      (std::remove_if(hcv_log_rings.begin(), hcv_log_rings.end(),
+                      [](hcv_log_ring_st*ring)
+      {
+        if (!ring->hcvring_orphan.load(std::memory_order_acquire)
+            || ring->hcvring_tail.load() != ring->hcvring_head.load())
+          return false;
+        delete ring;
+        return true;
+      }),
+      hcv_log_rings.end());
+    }
+  long nbdropped = hcv_log_dropped.load();
+  if (nbdropped > hcv_log_reported_drops)
+    {
+      hcv_log_record_st droprec
+      {
+        __FILE__, __LINE__, LOG_WARNING, false, 0.0, {0, 0}, ""
+      };
+      clock_gettime(CLOCK_REALTIME, &droprec.hcvlog_realtime);
+      droprec.hcvlog_msg = std::string(" !! logger dropped ")
+                           + std::to_string(nbdropped - hcv_log_reported_drops)
+                           + " messages on full ring buffers";
+      hcv_log_reported_drops = nbdropped;
+      hcv_log_write_locked(droprec);
+    }
+  if (nbwritten > 0 && hcv_log_file)
+    fflush(hcv_log_file);
+  return nbwritten;
+} // end hcv_log_drain_locked
+
+
+static long
+hcv_log_drain(void)
+{
+  std::lock_guard<std::timed_mutex> gu(hcv_log_drain_mtx);
+  return hcv_log_drain_locked();
+} // end hcv_log_drain
+
+
+/// queue a record in the ring of the current thread, or write it
+/// synchronously when the logger thread is not running
+static void
+hcv_log_queue(const char*fil, int lin, int prio, bool debug, std::string&&msg)
+{
+  double elapsed = 0.0;
+  if (debug)
+    elapsed = hcv_monotonic_real_time() - hcv_monotonic_start_time;
+  struct timespec ts = {0, 0};
+  clock_gettime(CLOCK_REALTIME, &ts);
+  if (!hcv_log_running.load(std::memory_order_acquire)
+      || hcv_log_in_logger_thread)
+    {
+      hcv_log_record_st rec {fil, lin, prio, debug, elapsed, ts, std::move(msg)};
+      std::lock_guard<std::timed_mutex> gu(hcv_log_drain_mtx);
+      hcv_log_write_locked(rec);
+      if (hcv_log_file)
+        fflush(hcv_log_file);
+      return;
+    }
+  hcv_log_ring_st* ring = hcv_log_thread_ring();
+  unsigned long head = ring->hcvring_head.load(std::memory_order_relaxed);
+  if (HCV_UNLIKELY(head - ring->hcvring_tail.load(std::memory_order_acquire)
+                   >= HCV_LOG_RING_SIZE))
+    {
+      hcv_log_dropped++;
+      return;
+    }
+  hcv_log_record_st& rec = ring->hcvring_records[head % HCV_LOG_RING_SIZE];
+  rec.hcvlog_file = fil;
+  rec.hcvlog_line = lin;
+  rec.hcvlog_prio = prio;
+  rec.hcvlog_debug = debug;
+  rec.hcvlog_elapsed = elapsed;
+  rec.hcvlog_realtime = ts;
+  rec.hcvlog_msg = std::move(msg);
+  /// sequentially consistent, paired with the logger setting
+  /// hcv_log_sleeping then looking at the heads again
+  ring->hcvring_head.store(head+1);
+  if (hcv_log_sleeping.load() && hcv_log_sleeping.exchange(false))
+    {
+      uint64_t one = 1;
+      if (write(hcv_log_event_fd, &one, sizeof(one)) < 0)
+        { /* the logger will wake up by itself */ };
+    }
+} // end hcv_log_queue
+
+
+/// this hcv_syslog_at function is used by the HCV_SYSLOGOUT macro
+void
+hcv_syslog_at (const char *fil, int lin, int prio, std::string&&str)
+{
+  hcv_log_queue(fil, lin, prio, false, std::move(str));
+} // end hcv_syslog_at....
+
+
+/// this hcv_debug_at function is used by the HCV_DEBUGOUT macro
+void
+hcv_debug_at (const char*fil, int lin, std::ostringstream&outs)
+{
+  outs.flush();
+  hcv_log_queue(fil, lin, LOG_DEBUG, true, outs.str());
+} // end hcv_debug_at
+
+
+static void
+hcv_log_thread_loop(void)
+{
+  pthread_setname_np(pthread_self(), "hcv_logger");
+  hcv_log_in_logger_thread = true;
+  while (!hcv_log_stopping.load())
+    {
+      if (hcv_log_drain() > 0)
+        continue;
+      hcv_log_sleeping.store(true);
+      if (hcv_log_drain() > 0)
+        {
+          hcv_log_sleeping.store(false);
+          continue;
+        }
+      struct pollfd pfd = {hcv_log_event_fd, POLLIN, 0};
+      if (poll(&pfd, 1, HCV_LOG_IDLE_POLL_MILLISECONDS) > 0)
+        {
+          uint64_t cnt = 0;
+          if (read(hcv_log_event_fd, &cnt, sizeof(cnt)) < 0)
+            { /* the eventfd is non-blocking */ };
+        }
+      hcv_log_sleeping.store(false);
+    }
+  hcv_log_drain();
+} // end hcv_log_thread_loop
+
+
+void
+hcv_start_logger(const std::string&logpath)
+{
+  if (hcv_log_running.load())
+    return;
+  if (!logpath.empty())
+    {
+      FILE* fil = fopen(logpath.c_str(), "ae");
+      if (!fil)
+        HCV_FATALOUT("hcv_start_logger: cannot open log file " << logpath);
+      std::lock_guard<std::timed_mutex> gu(hcv_log_drain_mtx);
+      hcv_log_file = fil;
+    }
+  hcv_log_event_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+  if (hcv_log_event_fd < 0)
+    HCV_FATALOUT("hcv_start_logger: eventfd failed");
+  hcv_log_stopping.store(false);
+  hcv_log_thread = std::thread(hcv_log_thread_loop);
+  hcv_log_running.store(true, std::memory_order_release);
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_start_logger logging to "
+                << (logpath.empty()?std::string("syslog"):logpath));
+} // end hcv_start_logger
+
+
+void
+hcv_stop_logger(void)
+{
+  if (!hcv_log_running.exchange(false))
+    return;
+  hcv_log_stopping.store(true);
+  {
+    uint64_t one = 1;
+    if (write(hcv_log_event_fd, &one, sizeof(one)) < 0)
+      { /* the logger wakes up by itself */ };
+  }
+  hcv_log_thread.join();
+  /// some thread could have queued just before hcv_log_running was cleared
+  std::lock_guard<std::timed_mutex> gu(hcv_log_drain_mtx);
+  hcv_log_drain_locked();
+  if (hcv_log_file)
+    fclose(hcv_log_file), hcv_log_file = nullptr;
+  close(hcv_log_event_fd), hcv_log_event_fd = -1;
+} // end hcv_stop_logger
+
+
+/// called by hcv_fatal_stop_at, so should not wait for long on a stuck
+/// logger thread
+void
+hcv_log_flush(void)
+{
+  if (hcv_log_in_logger_thread)
+    return;
+  if (!hcv_log_drain_mtx.try_lock_for(std::chrono::milliseconds(500)))
+    return;
+  hcv_log_drain_locked();
+  hcv_log_drain_mtx.unlock();
+} // end hcv_log_flush
+
+
+void
+hcv_log_statistics(long*pnblogged, long*pnbdropped)
+{
+  if (pnblogged)
+    *pnblogged = hcv_log_written.load();
+  if (pnbdropped)
+    *pnbdropped = hcv_log_dropped.load();
+} // end hcv_log_statistics
+
+//////////////////// end of file hcv_log.cc of github.com/bstarynk/helpcovid
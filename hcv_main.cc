@@ -90,6 +90,9 @@ enum hcv_progoption_en
   HCVPROGOPT_PLUGIN=1002,
   HCVPROGOPT_CLEARDATABASE=1003,
   HCVPROGOPT_CLEANUP=1004,
+  HCVPROGOPT_COMPILECHUNKMAP=1005,
+  HCVPROGOPT_LOGFILE=1006,
+  HCVPROGOPT_TRACEFILE=1007,
 };
 
 struct argp_option hcv_progoptions[] =
@@ -200,6 +203,23 @@ struct argp_option hcv_progoptions[] =
     /*doc:*/ "write debug messages to syslog(LOG_DEBUG, ...)", ///
     /*group:*/0 ///
   },
+  /* ======= log into a file ======= */
+  {/*name:*/ "log-file", ///
+    /*key:*/ HCVPROGOPT_LOGFILE, ///
+    /*arg:*/ "LOGFILE", ///
+    /*flags:*/0, ///
+    /*doc:*/ "append log and debug messages to LOGFILE instead of syslog(3)", ///
+    /*group:*/0 ///
+  },
+  /* ======= trace timed spans into a file ======= */
+  {/*name:*/ "trace-file", ///
+    /*key:*/ HCVPROGOPT_TRACEFILE, ///
+    /*arg:*/ "TRACEFILE", ///
+    /*flags:*/0, ///
+    /*doc:*/ "start tracing timed spans, appended in binary form to TRACEFILE;\n"
+    " ... SIGUSR1 toggles tracing, see print-trace.py", ///
+    /*group:*/0 ///
+  },
   /* ======= cleanup the database ======= */
   {/*name:*/ "cleanup", ///
     /*key:*/ HCVPROGOPT_CLEANUP, ///
@@ -216,6 +236,16 @@ struct argp_option hcv_progoptions[] =
     /*doc:*/ "clear database entirely", ///
     /*group:*/0 ///
   },
+  /* ======= compile a chunk map file ======= */
+  {/*name:*/ "compile-chunkmap", ///
+    /*key:*/ HCVPROGOPT_COMPILECHUNKMAP, ///
+    /*arg:*/ "SOURCE:COMPILED", ///
+    /*flags:*/0, ///
+    /*doc:*/ "compile the textual chunk map file SOURCE into the binary\n"
+    " ... chunk map file COMPILED, faster to load, then exit.\n"
+    " ... see CUSTOMIZATION.md and [helpcovid] custom_messages_file.", ///
+    /*group:*/0 ///
+  },
   /* ======= load a plugin ======= */
   {/*name:*/ "plugin", ///
     /*key:*/ HCVPROGOPT_PLUGIN, ///
@@ -250,6 +280,8 @@ struct hcv_progarguments
   std::string hcvprog_opensslcert;
   std::string hcvprog_opensslkey;
   std::string hcvprog_pidfile;
+  std::string hcvprog_logfile;
+  std::string hcvprog_tracefile;
 };
 
 static struct hcv_progarguments hcv_progargs =
@@ -264,6 +296,8 @@ static struct hcv_progarguments hcv_progargs =
   .hcvprog_opensslcert = "",
   .hcvprog_opensslkey = "",
   .hcvprog_pidfile = "",
+  .hcvprog_logfile = "",
+  .hcvprog_tracefile = "",
 };
 
 static char hcv_hostname[64];
@@ -275,6 +309,7 @@ void hcv_fatal_stop_at (const char *fil, int lin, int err)
   std::clog << "**** FATAL ERROR " << fil << ":" << lin << std::endl;
   if (err>0)
     std::clog << " errno: " << strerror(err) << std::endl;
+  hcv_log_flush();
   syslog(LOG_EMERG, "FATAL STOP %s:%d (%s)\n"
          "* version %s",
          fil, lin, strerror(err), hcv_versionmsg);
@@ -282,35 +317,6 @@ void hcv_fatal_stop_at (const char *fil, int lin, int err)
   abort();
 } // end hcv_fatal_stop_at
 
-void
-hcv_debug_at (const char*fil, int lin, std::ostringstream&outs)
-{
-  static std::recursive_mutex dbgmtx;
-  static long dbgcnt;
-  outs.flush();
-  if (!fil) fil="??";
-  if (fil)
-    {
-      auto ls = strrchr(fil, '/');
-      if (ls && ls[1]) fil = ls+1;
-    };
-  std::lock_guard<std::recursive_mutex> gu(dbgmtx);
-  dbgcnt++;
-  auto elapsed = hcv_monotonic_real_time() - hcv_monotonic_start_time;
-  if (dbgcnt % 100 == 0)
-    {
-      time_t nowt = 0;
-      time(&nowt);
-      struct tm nowtm = {};
-      localtime_r(&nowt, &nowtm);
-      char timbuf[64];
-      strftime(timbuf, sizeof(timbuf), "%c %Z", &nowtm);
-      syslog(LOG_DEBUG, "========== DEBUG timestamp %s #%ld ==========", timbuf, dbgcnt);
-    }
-  // we use the Δ U+0394 GREEK CAPITAL LETTER DELTA and ▪ U+25AA BLACK SMALL SQUARE and ‣ U+2023 TRIANGULAR BULLET
-  syslog(LOG_DEBUG, "ΔBG!%s:%d▪ %05.2f s‣ %s", fil, lin, elapsed, outs.str().c_str());
-} // end hcv_debug_at
-
 // parse a single program option
 static error_t
 hcv_parse1opt (int key, char *arg, struct argp_state *state)
@@ -336,6 +342,14 @@ hcv_parse1opt (int key, char *arg, struct argp_state *state)
       HCV_SYSLOGOUT(LOG_NOTICE, "helpcovid will cleanup database");
       return 0;
 
+    case HCVPROGOPT_LOGFILE:
+      progargs->hcvprog_logfile = std::string(arg);
+      return 0;
+
+    case HCVPROGOPT_TRACEFILE:
+      progargs->hcvprog_tracefile = std::string(arg);
+      return 0;
+
     case HCVPROGOPT_WEBURL:
       progargs->hcvprog_weburl = std::string(arg);
       return 0;
@@ -428,6 +442,23 @@ hcv_parse1opt (int key, char *arg, struct argp_state *state)
       hcv_should_clear_database = true;
       return 0;
 
+    case HCVPROGOPT_COMPILECHUNKMAP:
+    {
+      const char*colon = strchr(arg, ':');
+      if (!colon || colon == arg || !colon[1])
+        HCV_FATALOUT("bad --compile-chunkmap option " << arg <<std::endl
+                     << "... (expected SOURCE:COMPILED file paths)");
+      try
+        {
+          hcv_compile_chunk_map(std::string(arg, colon-arg), std::string(colon+1));
+        }
+      catch (std::exception&exc)
+        {
+          HCV_FATALOUT("--compile-chunkmap " << arg << " failed: " << exc.what());
+        }
+      exit(EXIT_SUCCESS);
+    }
+
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -600,16 +631,26 @@ hcv_parse_program_arguments(int &argc, char**argv)
 
 
 
-/// this hcv_syslog_at function is used by the HCV_SYSLOGOUT macro
-void
-hcv_syslog_at (const char *fil, int lin, int prio, const std::string&str)
-{
-  syslog(prio, "%s:%d - %s", fil, lin, str.c_str());
-} // end hcv_syslog_at....
-
 ////////////////////////////////////////////////// configuration
-extern "C" Glib::KeyFile hcv_config_key_file;
-Glib::KeyFile hcv_config_key_file;
+/// The configuration is an immutable snapshot, replaced as a whole
+/// when reloading on SIGHUP, so that readers keep the snapshot they
+/// got and never wait for a reload. hcv_config_mtx only serializes
+/// the loading of configuration files.
+///
+/// The [html] and [message] groups, expanded by <?hcv html_config ...?>
+/// and <?hcv confmsg ...?> in most web pages, are copied into the
+/// snapshot as hash tables of string views, so readers take no lock
+/// and get string views valid while they keep the snapshot.
+struct hcv_config_snapshot_st
+{
+  std::shared_ptr<const Glib::KeyFile> hcvcs_keyfile;
+  std::deque<std::string> hcvcs_pool; // never moves its strings
+  std::unordered_map<std::string_view,std::string_view> hcvcs_html;
+  std::unordered_map<std::string_view,std::string_view> hcvcs_message;
+};
+static std::shared_ptr<const hcv_config_snapshot_st> hcv_config_snapshot
+  = std::make_shared<const hcv_config_snapshot_st>
+    (hcv_config_snapshot_st {std::make_shared<const Glib::KeyFile>(), {}, {}, {}});
 extern "C" std::recursive_mutex hcv_config_mtx;
 std::recursive_mutex hcv_config_mtx;
 std::string hcv_config_file_path;
@@ -617,9 +658,83 @@ std::string hcv_config_file_path;
 std::string
 hcv_get_config_file_path(void)
 {
+  std::lock_guard<std::recursive_mutex> gu(hcv_config_mtx);
   return   hcv_config_file_path;
 } // end of hcv_get_config_file_path
 
+
+/// read and check some configuration file; on failure, return null
+/// and explain why in errmsg
+static std::shared_ptr<const Glib::KeyFile>
+hcv_read_config_file(const std::string&configpath, std::string&errmsg)
+{
+  std::ostringstream errout;
+  errno=0;
+  struct stat configstat;
+  memset (&configstat, 0, sizeof(configstat));
+  if (stat(configpath.c_str(), &configstat))
+    errout << "failed to stat configuration file " << configpath
+           << " (" << strerror(errno) << ")";
+  else if (!S_ISREG(configstat.st_mode))
+    errout << "configuration file " << configpath
+           << " is not a regular file.";
+  else if (configstat.st_mode & S_IRWXO)
+    errout << "configuration file " << configpath
+           << " is world readable or writable but should not be. Run chmod o-rwx " << configpath;
+  else
+    {
+      try
+        {
+          auto kf = std::make_shared<Glib::KeyFile>();
+          if (kf->load_from_file(configpath))
+            return kf;
+          errout << "configuration file " << configpath << " failed to load";
+        }
+      catch (Glib::KeyFileError &kferr)
+        {
+          errout << "configuration load of " << configpath << " got Glib::KeyFileError "
+                 << kferr.what() << " of code#" << kferr.code();
+        }
+      catch (std::exception &sex)
+        {
+          errout << "configuration load of " << configpath << " got standard exception " << sex.what();
+        }
+      catch (Glib::Exception &gex)
+        {
+          errout << "configuration load of " << configpath << " got Glib exception " << gex.what();
+        }
+    }
+  errmsg = errout.str();
+  errno = 0;
+  return nullptr;
+} // end hcv_read_config_file
+
+
+/// publish a new configuration, with its [html] and [message]
+/// strings; hcv_config_mtx is locked
+static void
+hcv_publish_config_locked(const std::shared_ptr<const Glib::KeyFile>&kf)
+{
+  auto newsnap = std::make_shared<hcv_config_snapshot_st>();
+  newsnap->hcvcs_keyfile = kf;
+  for (const char*grp: {"html", "message"})
+    {
+      if (!kf->has_group(grp))
+        continue;
+      auto& grpmap = strcmp(grp, "html")?newsnap->hcvcs_message:newsnap->hcvcs_html;
+      for (const Glib::ustring& key: kf->get_keys(grp))
+        {
+          const std::string& keystr = newsnap->hcvcs_pool.emplace_back(key);
+          const std::string& valstr = newsnap->hcvcs_pool.emplace_back(kf->get_string(grp, key));
+          grpmap.insert({keystr, valstr});
+        }
+    }
+  /// the previous snapshot is freed by its last reader
+  std::atomic_store(&hcv_config_snapshot,
+                    std::shared_ptr<const hcv_config_snapshot_st>(std::move(newsnap)));
+} // end hcv_publish_config_locked
+
+
 void
 hcv_load_config_file(const char*configfile)
 {
@@ -637,42 +752,14 @@ hcv_load_config_file(const char*configfile)
     configpath = defaultconfigpath;
   else
     configpath=HCV_DEFAULT_CONFIG_PATH;
-  errno=0;
-  struct stat configstat;
-  memset (&configstat, 0, sizeof(configstat));
-  if (stat(configpath.c_str(), &configstat))
-    HCV_FATALOUT("helpcovid failed to stat configuration file " << configpath);
-  if (!S_ISREG(configstat.st_mode))
-    HCV_FATALOUT("helpcovid configuration file " << configpath
-                 << " is not a regular file.");
-  if (configstat.st_mode & S_IRWXO)
-    HCV_FATALOUT("helpcovid configuration file " << configpath
-                 << " is world readable or writable but should not be. Run chmod o-rwx " << configpath);
   HCV_SYSLOGOUT(LOG_NOTICE, "loading configuration file " << configpath);
-  try
-    {
-      bool ok = hcv_config_key_file.load_from_file(configpath);
-      if (ok)
-        {
-          HCV_SYSLOGOUT(LOG_NOTICE, "helpcovid loaded configuration file " << configpath);
-          hcv_config_file_path = configpath;
-        }
-      else
-        HCV_FATALOUT("helpcovid configuration file " << configpath << " failed to load");
-    }
-  catch (Glib::KeyFileError &kferr)
-    {
-      HCV_FATALOUT("helpcovid configuration load of " << configpath << " got Glib::KeyFileError " << kferr.what() << " of code#" << kferr.code());
-    }
-  catch (std::exception &sex)
-    {
-      HCV_FATALOUT("helpcovid configuration load of " << configpath << " got standard exception " << sex.what());
-    }
-  catch (Glib::Exception &gex)
-    {
-      HCV_FATALOUT("helpcovid configuration load of " << configpath << " got Glib exception " << gex.what());
-    }
-  errno = 0;
+  std::string errmsg;
+  auto kf = hcv_read_config_file(configpath, errmsg);
+  if (!kf)
+    HCV_FATALOUT("helpcovid " << errmsg);
+  hcv_publish_config_locked(kf);
+  hcv_config_file_path = configpath;
+  HCV_SYSLOGOUT(LOG_NOTICE, "helpcovid loaded configuration file " << configpath);
 } // end hcv_load_config_file
 
 bool
@@ -680,8 +767,7 @@ hcv_config_has_group(const char*grpname)
 {
   if (!grpname || !std::isalpha(grpname[0]))
     HCV_FATALOUT("helpcovid bad configuration group name " << (grpname?:"**null**"));
-  std::lock_guard<std::recursive_mutex> gu(hcv_config_mtx);
-  return hcv_config_key_file.has_group(grpname);
+  return std::atomic_load(&hcv_config_snapshot)->hcvcs_keyfile->has_group(grpname);
 } // end of hcv_config_has_group
 
 bool
@@ -691,8 +777,7 @@ hcv_config_has_key(const char*grpname, const char*keyname)
     HCV_FATALOUT("helpcovid bad configuration group name " << (grpname?:"**null**"));
   if (!keyname || !std::isalpha(keyname[0]))
     HCV_FATALOUT("helpcovid bad configuration key name " << (keyname?:"**null**"));
-  std::lock_guard<std::recursive_mutex> gu(hcv_config_mtx);
-  return hcv_config_key_file.has_key(grpname,keyname);
+  return std::atomic_load(&hcv_config_snapshot)->hcvcs_keyfile->has_key(grpname,keyname);
 } // end of hcv_config_has_key
 
 
@@ -701,62 +786,124 @@ hcv_config_do(const std::function<void(const Glib::KeyFile*)>&dofun)
 {
   if (!dofun)
     HCV_FATALOUT("helpcovid missing function to hcv_config_do");
-  std::lock_guard<std::recursive_mutex> gu(hcv_config_mtx);
-  dofun(&hcv_config_key_file);
+  /// the snapshot stays alive during dofun, even if reloaded meanwhile
+  std::shared_ptr<const hcv_config_snapshot_st> snap = std::atomic_load(&hcv_config_snapshot);
+  dofun(snap->hcvcs_keyfile.get());
 } // end hcv_config_do
 
 
+std::string_view
+hcv_get_config_html_view(std::string_view name, hcv_snapshot_ref_t&ref)
+{
+  std::shared_ptr<const hcv_config_snapshot_st> snap = std::atomic_load(&hcv_config_snapshot);
+  if (name.empty())
+    return std::string_view();
+  auto it = snap->hcvcs_html.find(name);
+  if (it == snap->hcvcs_html.end())
+    return std::string_view();
+  ref = std::move(snap);
+  return it->second;
+} // end hcv_get_config_html_view
+
+
 std::string
 hcv_get_config_html(const std::string &name)
 {
-  std::string restr;
-  if (name.empty() || !isalpha(name[0]))
-    return "";
-  char nambuf[HCV_CONFIG_HTML_NAME_MAXLEN+4];
-  memset(nambuf, 0, sizeof(nambuf));
-  int nbc = 0;
-  for (auto c: name)
-    {
-      if (nbc>=HCV_CONFIG_HTML_NAME_MAXLEN)
-        return "";
-      if (!isalnum(c) && c!='_')
-        return "";
-      nambuf[nbc++] = c;
-    };
-  hcv_config_do([&](const Glib::KeyFile*kf)
-  {
-    HCV_ASSERT(kf != nullptr);
-    if (kf->has_key("html", nambuf))
-      {
-        //restr = std::string(kf->get_string("html", nambuf));
-        const char*ps = kf->get_string("html", nambuf).data();
-        restr = std::string(ps);
-      }
-  });
-  HCV_DEBUGOUT("hcv_get_config_html name='" << name << "' -> '"
-               << restr << "'");
-  return restr;
+  hcv_snapshot_ref_t ref;
+  return std::string(hcv_get_config_html_view(name, ref));
 } // end hcv_get_config_html
 
 
+std::string_view
+hcv_get_config_message_view(std::string_view msgid, hcv_snapshot_ref_t&ref)
+{
+  std::shared_ptr<const hcv_config_snapshot_st> snap = std::atomic_load(&hcv_config_snapshot);
+  if (msgid.empty())
+    return std::string_view();
+  auto it = snap->hcvcs_message.find(msgid);
+  if (it == snap->hcvcs_message.end())
+    return std::string_view();
+  ref = std::move(snap);
+  return it->second;
+} // end hcv_get_config_message_view
+
+
 /// useful for <?hcv confmsg MESSAGEID ....?>
 std::string
 hcv_get_config_message(const char*msgid)
 {
   HCV_ASSERT(msgid != nullptr && msgid[0] != (char)0);
-  std::string msg;
-  hcv_config_do([&](const Glib::KeyFile*kf)
-  {
-    HCV_ASSERT(kf != nullptr);
-    if (kf->has_key("message", msgid))
-      msg = kf->get_string("message", msgid);
-  });
-  return msg;
+  hcv_snapshot_ref_t ref;
+  return std::string(hcv_get_config_message_view(msgid?:"", ref));
 } // end hcv_get_config_message
 
 
 
 
+/// expand with wordexp(3) the custom_messages_file= of [helpcovid]
+/// into chunk map file paths; on failure, explain why in errmsg
+static bool
+hcv_expand_custom_messages_files(const std::string&custmsgpath,
+                                 std::vector<std::string>&pathvec, std::string&errmsg)
+{
+  std::ostringstream errout;
+  // we should use http://man7.org/linux/man-pages/man3/wordexp.3.html
+  wordexp_t wx;
+  memset (&wx, 0, sizeof(wx));
+  int resw = wordexp(custmsgpath.c_str(), &wx,
+                     WRDE_SHOWERR | WRDE_UNDEF);
+  switch (resw)
+    {
+    case 0: // wordexp succeeded
+    {
+      int nbf = wx.we_wordc;
+      if (nbf <= 0)
+        errout << "configuration [helpcovid] custom_messages_file="
+               << custmsgpath << " expanded to no files by wordexp(3)";
+      for (int ix=0; ix<nbf && errout.tellp() == 0; ix++)
+        {
+          std::string curpath = wx.we_wordv[ix];
+          if (curpath.empty())
+            errout << "configuration [helpcovid] custom_messages_file="
+                   << custmsgpath << "  expanded by wordexp(3) to empty for ix#" << ix;
+          else
+            {
+              HCV_DEBUGOUT("configuration [helpcovid] custom_messages_file="
+                           << custmsgpath
+                           << " ix#" << ix
+                           << " gives chunkmap file " << Glib::shell_quote(curpath));
+              pathvec.push_back(curpath);
+            }
+        }
+      wordfree (&wx);
+    }
+    break;
+    case WRDE_BADCHAR:
+      errout << "configuration [helpcovid] custom_messages_file="
+             << custmsgpath << " has bad characters for wordexp(3)";
+      break;
+    case WRDE_BADVAL:
+      errout << "configuration [helpcovid] custom_messages_file="
+             << custmsgpath << " has undefined shell variable for wordexp(3)";
+      break;
+    case WRDE_CMDSUB:
+      errout << "configuration [helpcovid] custom_messages_file="
+             << custmsgpath << " has wrong command substitution for wordexp(3)";
+      break;
+    case WRDE_SYNTAX:
+      errout << "configuration [helpcovid] custom_messages_file="
+             << custmsgpath << " has shell syntax error for wordexp(3)";
+      break;
+    default: // should not happen
+      errout << "configuration  [helpcovid] custom_messages_file="
+             << custmsgpath << " has error#" << resw << " for wordexp(3)";
+      break;
+    }
+  errmsg = errout.str();
+  return errmsg.empty();
+} // end hcv_expand_custom_messages_files
+
+
 void
 hcv_config_handle_helpcovid_config_group(void)
 {
@@ -876,6 +1023,7 @@ hcv_config_handle_helpcovid_config_group(void)
           if (!hcv_textdomain_dir)
             HCV_FATALOUT("hcv_config_handle_helpcovid_config_group failed to bindtextdomain for  text_domain=" << textdomdir
                          << " in configuration file [helpcovid] section");
+          hcv_register_gettext_languages(textdomdir);
           HCV_SYSLOGOUT(LOG_INFO, "helpcovid did bindtextdomain " << hcv_textdomain_dir
                         << " for text_domain=" << textdomstr << " in configuration file [helpcovid] section.");
         }
@@ -892,52 +1040,18 @@ hcv_config_handle_helpcovid_config_group(void)
       else
         {
           HCV_DEBUGOUT("helpcovid configured [helpcovid] custom_messages_file=" << custmsgpath);
-          // we should use http://man7.org/linux/man-pages/man3/wordexp.3.html
-          wordexp_t wx;
-          memset (&wx, 0, sizeof(wx));
-          int resw = wordexp(custmsgpath.c_str(), &wx,
-                             WRDE_SHOWERR | WRDE_UNDEF);
-          switch (resw)
-            {
-            case 0: // wordexp succeeded
+          std::vector<std::string> pathvec;
+          std::string errmsg;
+          if (!hcv_expand_custom_messages_files(custmsgpath, pathvec, errmsg))
+            HCV_FATALOUT(errmsg);
+          int ix = 0;
+          for (const std::string& curpath: pathvec)
             {
-              int nbf = wx.we_wordc;
-              if (nbf <= 0)
-                HCV_FATALOUT("configuration [helpcovid] custom_messages_file="
-                             << custmsgpath << " expanded to no files by wordexp(3)");
-              for (int ix=0; ix<nbf; ix++)
-                {
-                  std::string curpath = wx.we_wordv[ix];
-                  if (curpath.empty())
-                    HCV_FATALOUT("configuration [helpcovid] custom_messages_file="
-                                 << custmsgpath << "  expanded by wordexp(3) to empty for ix#" << ix);
-                  HCV_DEBUGOUT("configuration [helpcovid] custom_messages_file="
-                               << custmsgpath
-                               << " ix#" << ix
-                               << " adding current chunkmap file " << Glib::shell_quote(curpath));
-                  hcv_add_chunkmap_file(curpath);
-                  HCV_SYSLOGOUT(LOG_INFO, "added chunkmap file " << Glib::shell_quote(curpath)
-                                << " ix#" << ix);
-                }
+              hcv_add_chunkmap_file(curpath);
+              HCV_SYSLOGOUT(LOG_INFO, "added chunkmap file " << Glib::shell_quote(curpath)
+                            << " ix#" << ix);
+              ix++;
             }
-            break;
-            case WRDE_BADCHAR:
-              HCV_FATALOUT("configuration [helpcovid] custom_messages_file="
-                           << custmsgpath << " has bad characters for wordexp(3)");
-            case WRDE_BADVAL:
-              HCV_FATALOUT("configuration [helpcovid] custom_messages_file="
-                           << custmsgpath << " has undefined shell variable for wordexp(3)");
-            case WRDE_CMDSUB:
-              HCV_FATALOUT("configuration [helpcovid] custom_messages_file="
-                           << custmsgpath << " has wrong command substitution for wordexp(3)");
-            case WRDE_SYNTAX:
-              HCV_FATALOUT("configuration [helpcovid] custom_messages_file="
-                           << custmsgpath << " has shell syntax error for wordexp(3)");
-            default: // should not happen
-              HCV_FATALOUT("configuration  [helpcovid] custom_messages_file="
-                           << custmsgpath << " has error#" << resw << " for wordexp(3)");
-            }
-          wordfree (&wx);
         }
     };
     //// end of  hcv_config_do with kf
@@ -948,6 +1062,48 @@ hcv_config_handle_helpcovid_config_group(void)
 
 
 
+/// called on SIGHUP by the background thread. The new configuration
+/// and chunk maps are built aside and published only when both are
+/// correct; templates are then recompiled aside. Settings used only at
+/// startup, such as the [web] url or the database connection, still
+/// need a restart.
+bool
+hcv_reload_configuration(void)
+{
+  double startim = hcv_monotonic_real_time();
+  std::lock_guard<std::recursive_mutex> gu(hcv_config_mtx);
+  if (hcv_config_file_path.empty())
+    HCV_FATALOUT("hcv_reload_configuration without any loaded configuration file");
+  HCV_SYSLOGOUT(LOG_NOTICE, "reloading configuration file " << hcv_config_file_path);
+  std::string errmsg;
+  auto kf = hcv_read_config_file(hcv_config_file_path, errmsg);
+  if (!kf)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "helpcovid keeps its current configuration: " << errmsg);
+      return false;
+    }
+  std::vector<std::string> pathvec;
+  if (kf->has_key("helpcovid", "custom_messages_file"))
+    {
+      std::string custmsgpath = kf->get_string("helpcovid","custom_messages_file");
+      if (!custmsgpath.empty()
+          && !hcv_expand_custom_messages_files(custmsgpath, pathvec, errmsg))
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "helpcovid keeps its current configuration: " << errmsg);
+          return false;
+        }
+    }
+  if (!hcv_replace_chunkmap_files(pathvec))
+    return false;
+  hcv_publish_config_locked(kf);
+  hcv_rebuild_template_cache();
+  HCV_SYSLOGOUT(LOG_NOTICE, "helpcovid reloaded configuration file " << hcv_config_file_path
+                << " in " << (hcv_monotonic_real_time() - startim) << " seconds");
+  return true;
+} // end hcv_reload_configuration
+
+
+
 ////////////////////////////////////////////////////////////////
 
 const char*
@@ -1122,8 +1278,22 @@ main(int argc, char**argv)
                 HCV_SYSLOGOUT(LOG_NOTICE, "helpcovid will use pid_file " << pidpath << " from configuration file");
               }
           };
+        if (kf->has_key("helpcovid","log_file") && hcv_progargs.hcvprog_logfile.empty())
+          hcv_progargs.hcvprog_logfile = kf->get_string("helpcovid","log_file");
+        /// a configured trace file is used when SIGUSR1 starts tracing
+        if (kf->has_key("helpcovid","trace_file") && hcv_progargs.hcvprog_tracefile.empty())
+          hcv_set_trace_file(kf->get_string("helpcovid","trace_file"));
       });
     };
+  errno = 0;
+  /// from now on, log messages are written by the logger thread
+  hcv_start_logger(hcv_progargs.hcvprog_logfile);
+  if (!hcv_progargs.hcvprog_tracefile.empty())
+    {
+      hcv_set_trace_file(hcv_progargs.hcvprog_tracefile);
+      if (!hcv_start_tracing())
+        HCV_FATALOUT("helpcovid failed to start tracing into " << hcv_progargs.hcvprog_tracefile);
+    }
   //////////////// debugging
   errno = 0;
   if (hcv_debugging.load())
@@ -1209,14 +1379,27 @@ main(int argc, char**argv)
   errno = 0;
   HCV_DEBUGOUT("helpcovid here before cleanup or webrun");
   if (hcv_should_cleanup)
-    hcv_background_periodic_cleanup();
+    hcv_run_database_cleanup(HUGE_VAL);
   else
     hcv_webserver_run();
   errno = 0;
+  /// the background thread has stopped the web service on SIGTERM;
+  /// no task runs after this join, so the final flush is complete
+  hcv_join_background_thread();
+  hcv_session_flush_expiries();
+  hcv_close_database();
+  hcv_stop_tracing();
+  errno = 0;
   HCV_DEBUGOUT("helpcovid here before hcv_release_locale_resources");
   hcv_release_locale_resources();
   errno = 0;
+  HCV_SYSLOGOUT(LOG_NOTICE, "HelpCovid terminating on " << hcv_get_hostname()
+                << " process " << (int)getpid()
+                << " built " << hcv_timestamp << std::endl
+                << "... md5sum " << hcv_md5sum
+                << " lastgitcommit " << hcv_lastgitcommit);
   HCV_SYSLOGOUT(LOG_INFO, "normal end of " << argv[0]);
+  hcv_stop_logger();
   hcv_main_argc = 0;
   hcv_main_argv = nullptr;
   return 0;
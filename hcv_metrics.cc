@@ -0,0 +1,347 @@
+/****************************************************************
+ * file hcv_metrics.cc
+ *
+ * Description:
+ *      Prometheus-style /metrics of https://github.com/bstarynk/helpcovid
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+
+extern "C" const char hcv_metrics_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcv_metrics_date[] = __DATE__;
+
+
+/// The /metrics page, in the text exposition format of
+/// https://prometheus.io/docs/instrumenting/exposition_formats/ is
+/// built only from atomic counters and the existing statistics
+/// functions of the other modules; it reads no /proc file and never
+/// sleeps, unlike /status.json and /status.html.
+
+static std::atomic<unsigned> hcv_histogram_shard_counter;
+static thread_local unsigned hcv_histogram_thread_shard
+  = hcv_histogram_shard_counter++ % HCV_HISTOGRAM_NB_SHARDS;
+
+/// route histograms are never removed, so their addresses are stable
+static std::mutex hcv_metrics_routes_mtx;
+static std::map<std::string,std::unique_ptr<Hcv_latency_histogram>> hcv_metrics_routes;
+
+
+Hcv_latency_histogram::Hcv_latency_histogram()
+{
+  for (hcv_histogram_shard_st& sh: _hcvhist_shards)
+    {
+      for (std::atomic<long>& cnt: sh.hcvhsh_buckets)
+        cnt.store(0, std::memory_order_relaxed);
+      sh.hcvhsh_sum_microseconds.store(0, std::memory_order_relaxed);
+    }
+} // end Hcv_latency_histogram::Hcv_latency_histogram
+
+
+/// bucket 0 is below 32 microseconds; then each power of two 2^k of
+/// microseconds, for k from 5 to 24, is split at 1.5 * 2^k in two
+/// buckets; the last bucket is unbounded
+static inline unsigned
+hcv_histogram_bucket_index(long microsec)
+{
+  if (microsec < 32)
+    return 0;
+  unsigned k = 63 - __builtin_clzl((unsigned long) microsec);
+  unsigned ix = 1 + 2*(k-5) + ((microsec >> (k-1)) & 1);
+  return (ix < HCV_HISTOGRAM_NB_BUCKETS-1) ? ix : (HCV_HISTOGRAM_NB_BUCKETS-1);
+} // end hcv_histogram_bucket_index
+
+
+double
+Hcv_latency_histogram::bucket_upper_bound(unsigned ix)
+{
+  if (ix == 0)
+    return 32.0e-6;
+  if (ix >= HCV_HISTOGRAM_NB_BUCKETS-1)
+    return INFINITY;
+  unsigned k = 5 + (ix-1)/2;
+  double bound = ((ix-1) % 2) ? std::ldexp(1.0, k+1) : 3.0*std::ldexp(1.0, k-1);
+  return bound * 1.0e-6;
+} // end Hcv_latency_histogram::bucket_upper_bound
+
+
+void
+Hcv_latency_histogram::record(double seconds)
+{
+  long microsec = (seconds > 0.0) ? (long)(seconds*1.0e6) : 0;
+  hcv_histogram_shard_st& sh = _hcvhist_shards[hcv_histogram_thread_shard];
+  sh.hcvhsh_buckets[hcv_histogram_bucket_index(microsec)].fetch_add(1, std::memory_order_relaxed);
+  sh.hcvhsh_sum_microseconds.fetch_add(microsec, std::memory_order_relaxed);
+} // end Hcv_latency_histogram::record
+
+
+double
+Hcv_latency_histogram::snapshot(long counts[HCV_HISTOGRAM_NB_BUCKETS]) const
+{
+  long summicrosec = 0;
+  for (unsigned ix = 0; ix < HCV_HISTOGRAM_NB_BUCKETS; ix++)
+    counts[ix] = 0;
+  for (const hcv_histogram_shard_st& sh: _hcvhist_shards)
+    {
+      for (unsigned ix = 0; ix < HCV_HISTOGRAM_NB_BUCKETS; ix++)
+        counts[ix] += sh.hcvhsh_buckets[ix].load(std::memory_order_relaxed);
+      summicrosec += sh.hcvhsh_sum_microseconds.load(std::memory_order_relaxed);
+    }
+  return 1.0e-6 * summicrosec;
+} // end Hcv_latency_histogram::snapshot
+
+
+Hcv_latency_histogram*
+hcv_metrics_route_histogram(const std::string&route)
+{
+  std::lock_guard<std::mutex> gu(hcv_metrics_routes_mtx);
+  auto& hist = hcv_metrics_routes[route];
+  if (!hist)
+    hist.reset(new Hcv_latency_histogram);
+  return hist.get();
+} // end hcv_metrics_route_histogram
+
+
+
+////////////////////////////////////////////////////////////////
+//// the text output
+
+static void
+hcv_metrics_printf(std::string&out, const char*fmt, ...)
+__attribute__((format(printf, 2, 3)));
+
+static void
+hcv_metrics_printf(std::string&out, const char*fmt, ...)
+{
+  char buf[512];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (len > 0)
+    out.append(buf, std::min<size_t>(len, sizeof(buf)-1));
+} // end hcv_metrics_printf
+
+
+/// a label value, escaped as required by the exposition format
+static std::string
+hcv_metrics_label(const std::string&str)
+{
+  std::string res;
+  res.reserve(str.size()+8);
+  for (char c: str)
+    {
+      if (c == '\\' || c == '"')
+        {
+          res.push_back('\\');
+          res.push_back(c);
+        }
+      else if (c == '\n')
+        res.append("\\n");
+      else
+        res.push_back(c);
+    }
+  return res;
+} // end hcv_metrics_label
+
+
+static void
+hcv_metrics_header(std::string&out, const char*name, const char*type, const char*help)
+{
+  hcv_metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+} // end hcv_metrics_header
+
+
+/// output the samples of a histogram; labels is empty or like
+/// route="GET /login",
+static void
+hcv_metrics_histogram(std::string&out, const char*name, const std::string&labels,
+                      const Hcv_latency_histogram&hist)
+{
+  long counts[HCV_HISTOGRAM_NB_BUCKETS];
+  double sum = hist.snapshot(counts);
+  long cumul = 0;
+  for (unsigned ix = 0; ix < HCV_HISTOGRAM_NB_BUCKETS; ix++)
+    {
+      cumul += counts[ix];
+      if (ix < HCV_HISTOGRAM_NB_BUCKETS-1)
+        hcv_metrics_printf(out, "%s_bucket{%sle=\"%.6g\"} %ld\n", name, labels.c_str(),
+                           Hcv_latency_histogram::bucket_upper_bound(ix), cumul);
+      else
+        hcv_metrics_printf(out, "%s_bucket{%sle=\"+Inf\"} %ld\n", name, labels.c_str(), cumul);
+    }
+  std::string braced;
+  if (!labels.empty())
+    braced = "{" + labels.substr(0, labels.size()-1) + "}";
+  hcv_metrics_printf(out, "%s_sum%s %.6f\n", name, braced.c_str(), sum);
+  hcv_metrics_printf(out, "%s_count%s %ld\n", name, braced.c_str(), cumul);
+} // end hcv_metrics_histogram
+
+
+static void
+hcv_metrics_simple(std::string&out, const char*name, const char*type, const char*help,
+                   double val)
+{
+  hcv_metrics_header(out, name, type, help);
+  hcv_metrics_printf(out, "%s %.17g\n", name, val);
+} // end hcv_metrics_simple
+
+
+void
+hcv_web_get_metrics(const httplib::Request&req, httplib::Response&resp)
+{
+  HCV_DEBUGOUT("hcv_web_get_metrics start path=" << req.path);
+  std::string out;
+  out.reserve(64*1024);
+  //////////////// process
+  hcv_metrics_simple(out, "process_cpu_seconds_total", "counter",
+                     "Total CPU time of the process in seconds.", hcv_process_cpu_time());
+  hcv_metrics_simple(out, "helpcovid_uptime_seconds", "gauge",
+                     "Elapsed seconds since the start of the process.",
+                     hcv_monotonic_real_time() - hcv_monotonic_start_time);
+  //////////////// web routes
+  hcv_metrics_header(out, "helpcovid_http_request_duration_seconds", "histogram",
+                     "Latency of web requests, per route of hcv_webserver_run.");
+  {
+    std::lock_guard<std::mutex> gu(hcv_metrics_routes_mtx);
+    for (auto& it: hcv_metrics_routes)
+      hcv_metrics_histogram(out, "helpcovid_http_request_duration_seconds",
+                            "route=\"" + hcv_metrics_label(it.first) + "\",",
+                            *it.second);
+  }
+  //////////////// database
+  {
+    hcv_database_pool_stats_st dbst = hcv_database_pool_statistics();
+    hcv_metrics_simple(out, "helpcovid_database_pool_connections", "gauge",
+                       "Number of pooled PostGreSQL connections.", dbst.dbpool_size);
+    hcv_metrics_simple(out, "helpcovid_database_pool_idle_connections", "gauge",
+                       "Number of idle pooled PostGreSQL connections.", dbst.dbpool_idle);
+    hcv_metrics_simple(out, "helpcovid_database_pool_waits_total", "counter",
+                       "Checkouts which had to wait for a pooled connection.", dbst.dbpool_waits);
+    hcv_metrics_simple(out, "helpcovid_database_pool_reconnects_total", "counter",
+                       "Broken pooled connections reopened.", dbst.dbpool_reconnects);
+    hcv_metrics_header(out, "helpcovid_database_pool_wait_seconds", "histogram",
+                       "Waiting time of each checkout of a pooled connection.");
+    hcv_metrics_histogram(out, "helpcovid_database_pool_wait_seconds", "",
+                          hcv_database_pool_wait_histogram);
+  }
+  {
+    auto pstmvec = hcv_database_prepared_statement_statistics();
+    hcv_metrics_header(out, "helpcovid_database_statement_executions_total", "counter",
+                       "Executions of each prepared statement.");
+    for (auto& pst: pstmvec)
+      hcv_metrics_printf(out, "helpcovid_database_statement_executions_total{statement=\"%s\"} %ld\n",
+                         hcv_metrics_label(pst.pstm_name).c_str(), pst.pstm_count);
+    hcv_metrics_header(out, "helpcovid_database_statement_errors_total", "counter",
+                       "Failed executions of each prepared statement.");
+    for (auto& pst: pstmvec)
+      hcv_metrics_printf(out, "helpcovid_database_statement_errors_total{statement=\"%s\"} %ld\n",
+                         hcv_metrics_label(pst.pstm_name).c_str(), pst.pstm_errors);
+    hcv_metrics_header(out, "helpcovid_database_statement_seconds_total", "counter",
+                       "Cumulated latency of each prepared statement.");
+    for (auto& pst: pstmvec)
+      hcv_metrics_printf(out, "helpcovid_database_statement_seconds_total{statement=\"%s\"} %.6f\n",
+                         hcv_metrics_label(pst.pstm_name).c_str(), pst.pstm_total_time);
+  }
+  //////////////// caches
+  {
+    long hits = 0, misses = 0, nbentries = 0;
+    hcv_template_cache_statistics(&hits, &misses, &nbentries);
+    hcv_metrics_simple(out, "helpcovid_template_cache_hits_total", "counter",
+                       "Renderings of an already compiled template.", hits);
+    hcv_metrics_simple(out, "helpcovid_template_cache_misses_total", "counter",
+                       "Template compilations.", misses);
+    hcv_metrics_simple(out, "helpcovid_template_cache_entries", "gauge",
+                       "Cached compiled templates.", nbentries);
+    long builds = 0;
+    hcv_template_variant_statistics(&hits, &builds);
+    hcv_metrics_simple(out, "helpcovid_template_variant_hits_total", "counter",
+                       "Renderings of an already built language variant.", hits);
+    hcv_metrics_simple(out, "helpcovid_template_variant_builds_total", "counter",
+                       "Language variants built.", builds);
+    hcv_language_cache_statistics(&hits, &misses, &nbentries);
+    hcv_metrics_simple(out, "helpcovid_language_cache_hits_total", "counter",
+                       "Accept-Language negotiations found in cache.", hits);
+    hcv_metrics_simple(out, "helpcovid_language_cache_misses_total", "counter",
+                       "Accept-Language negotiations computed.", misses);
+    long notmodified = 0;
+    hcv_static_file_cache_statistics(&hits, &misses, &notmodified, &nbentries);
+    hcv_metrics_simple(out, "helpcovid_static_file_cache_hits_total", "counter",
+                       "Static files served from memory.", hits);
+    hcv_metrics_simple(out, "helpcovid_static_file_cache_misses_total", "counter",
+                       "Static files read from the webroot.", misses);
+    hcv_metrics_simple(out, "helpcovid_static_file_not_modified_total", "counter",
+                       "Static files answered 304 Not Modified.", notmodified);
+    hcv_metrics_simple(out, "helpcovid_static_file_cache_entries", "gauge",
+                       "Static files cached in memory.", nbentries);
+    hcv_session_cache_stats_st sessst = hcv_session_cache_statistics();
+    hcv_metrics_simple(out, "helpcovid_session_cache_hits_total", "counter",
+                       "Web sessions found in memory.", sessst.sesscache_hits);
+    hcv_metrics_simple(out, "helpcovid_session_cache_misses_total", "counter",
+                       "Web sessions fetched from the database.", sessst.sesscache_misses);
+    hcv_metrics_simple(out, "helpcovid_session_cache_entries", "gauge",
+                       "Web sessions cached in memory.", sessst.sesscache_size);
+  }
+  //////////////// background tasks
+  {
+    hcv_metrics_simple(out, "helpcovid_background_pending_tasks", "gauge",
+                       "Postponed tasks not yet run.", hcv_background_pending_count());
+    auto tclvec = hcv_background_task_class_statistics();
+    hcv_metrics_header(out, "helpcovid_task_class_queued", "gauge",
+                       "Due tasks waiting for a worker thread, per task class.");
+    for (auto& tcl: tclvec)
+      hcv_metrics_printf(out, "helpcovid_task_class_queued{class=\"%s\"} %ld\n",
+                         hcv_metrics_label(tcl.tcl_name).c_str(), tcl.tcl_queued);
+    hcv_metrics_header(out, "helpcovid_task_class_running", "gauge",
+                       "Running tasks, per task class.");
+    for (auto& tcl: tclvec)
+      hcv_metrics_printf(out, "helpcovid_task_class_running{class=\"%s\"} %d\n",
+                         hcv_metrics_label(tcl.tcl_name).c_str(), tcl.tcl_running);
+    hcv_metrics_header(out, "helpcovid_task_class_completed_total", "counter",
+                       "Completed tasks, per task class.");
+    for (auto& tcl: tclvec)
+      hcv_metrics_printf(out, "helpcovid_task_class_completed_total{class=\"%s\"} %ld\n",
+                         hcv_metrics_label(tcl.tcl_name).c_str(), tcl.tcl_completed);
+    hcv_metrics_header(out, "helpcovid_task_class_wait_seconds_total", "counter",
+                       "Cumulated queue waiting time, per task class.");
+    for (auto& tcl: tclvec)
+      hcv_metrics_printf(out, "helpcovid_task_class_wait_seconds_total{class=\"%s\"} %.6f\n",
+                         hcv_metrics_label(tcl.tcl_name).c_str(), tcl.tcl_total_wait);
+  }
+  //////////////// logging and tracing
+  {
+    long nbdone = 0, nbdropped = 0;
+    hcv_log_statistics(&nbdone, &nbdropped);
+    hcv_metrics_simple(out, "helpcovid_log_messages_total", "counter",
+                       "Log messages written.", nbdone);
+    hcv_metrics_simple(out, "helpcovid_log_dropped_total", "counter",
+                       "Log messages dropped on full ring buffers.", nbdropped);
+    hcv_trace_statistics(&nbdone, &nbdropped);
+    hcv_metrics_simple(out, "helpcovid_trace_spans_total", "counter",
+                       "Traced spans written.", nbdone);
+    hcv_metrics_simple(out, "helpcovid_trace_dropped_total", "counter",
+                       "Traced spans dropped on full ring buffers.", nbdropped);
+  }
+  resp.set_content(std::move(out), "text/plain; version=0.0.4; charset=utf-8");
+} // end hcv_web_get_metrics
+
+//////////////////// end of file hcv_metrics.cc of github.com/bstarynk/helpcovid
@@ -98,7 +98,7 @@ hcv_user_model_create(const hcv_user_model& model, hcv_user_model& status)
   if (!hcv_user_model_validate(model, status))
     return false;
 
-  Hcv_PreparedStatement stmt("user_create");
+  Hcv_PreparedStatement stmt("user_create_pstm");
   stmt.bind(model.user_first_name);
   stmt.bind(model.user_family_name);
   stmt.bind(model.user_email);
@@ -113,7 +113,7 @@ extern "C" bool
 hcv_user_model_authenticate(const std::string& email,
                             const std::string& passwd)
 {
-  Hcv_PreparedStatement stmt("user_get_password_by_email");
+  Hcv_PreparedStatement stmt("user_get_password_by_email_pstm");
   stmt.bind(email);
 
   auto res = stmt.query();
@@ -122,3 +122,18 @@ hcv_user_model_authenticate(const std::string& email,
   return row[0].as<std::string>() == passwd;
 }
 
+
+extern "C" std::int64_t
+hcv_user_model_find_by_email(const std::string& email)
+{
+  Hcv_PreparedStatement stmt("find_user_by_email_pstm");
+  stmt.bind(email);
+
+  auto res = stmt.query();
+  std::int64_t id = -1;
+  for (auto rowit : res)
+    id = rowit[0].as<std::int64_t>();
+
+  return id;
+}
+
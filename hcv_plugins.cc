@@ -40,7 +40,8 @@ struct Hcv_plugin
   const char* hcvpl_arg;	// argument passed to plugin
   std::string hcvpl_gitid;
   std::string hcvpl_license;
-  hcvplugin_web_initializer_sig_t* hcvpl_initweb;
+  hcvplugin_web_registrar_initializer_sig_t* hcvpl_initwebreg;
+  hcvplugin_web_initializer_sig_t* hcvpl_initweb; // older plugins, if no hcvpl_initwebreg
   hcvplugin_database_initializer_sig_t* hcvpl_initdatabase;
 };
 
@@ -143,10 +144,19 @@ void hcv_load_plugin(const char*plugin_name, const char*plugin_arg)
   if (!plgversion)
     HCV_FATALOUT("hcv_load_plugin " << plugin_name << " plugin " << sobuf
                  << " has no symbol hcvplugin_version: " << dlerror());
-  void* plgwebinit = dlsym(dlh, "hcvplugin_initialize_web");
-  if (!plgwebinit)
-    HCV_FATALOUT("hcv_load_plugin " << plugin_name << " plugin " << sobuf
-                 << " has no symbol hcvplugin_initialize_web: " << dlerror());
+  void* plgwebreginit = dlsym(dlh, "hcvplugin_initialize_web_registrar");
+  void* plgwebinit = nullptr;
+  if (!plgwebreginit)
+    {
+      plgwebinit = dlsym(dlh, "hcvplugin_initialize_web");
+      if (!plgwebinit)
+        HCV_FATALOUT("hcv_load_plugin " << plugin_name << " plugin " << sobuf
+                     << " has no symbol hcvplugin_initialize_web_registrar"
+                     << " nor hcvplugin_initialize_web: " << dlerror());
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_load_plugin " << plugin_name
+                    << " has the older hcvplugin_initialize_web,"
+                    << " so its web handlers are not traced; see PLUGINS.md");
+    }
   HCV_SYSLOGOUT(LOG_NOTICE, "hcv_load_plugin " << plugin_name
                 << " dlopened " << sobuf << " with license " << plglicense
                 << " gitapi " << plgapi << " and version " << plgversion);
@@ -170,6 +180,7 @@ void hcv_load_plugin(const char*plugin_name, const char*plugin_arg)
     .hcvpl_arg= plugin_arg,
     .hcvpl_gitid= std::string(plgapi),
     .hcvpl_license = std::string(plglicense),
+    .hcvpl_initwebreg = reinterpret_cast<hcvplugin_web_registrar_initializer_sig_t*>(plgwebreginit),
     .hcvpl_initweb = reinterpret_cast<hcvplugin_web_initializer_sig_t*>(plgwebinit),
     .hcvpl_initdatabase =  reinterpret_cast<hcvplugin_database_initializer_sig_t*>(plgdatabaseinit)
   });
@@ -180,6 +191,29 @@ void hcv_load_plugin(const char*plugin_name, const char*plugin_arg)
 
 
 
+/// the span of a plugin handler is named like "plugin foo GET /plugin_foo"
+Hcv_plugin_web_registrar&
+Hcv_plugin_web_registrar::get(const char*pattern, const httplib::Server::Handler&handler)
+{
+  HCV_ASSERT(pattern != nullptr && handler);
+  std::string spanname = "plugin " + _hcvreg_plugin + " GET " + pattern;
+  _hcvreg_server->Get(pattern, hcv_web_traced_handler(spanname.c_str(), handler));
+  HCV_DEBUGOUT("Hcv_plugin_web_registrar::get " << spanname);
+  return *this;
+} // end Hcv_plugin_web_registrar::get
+
+
+Hcv_plugin_web_registrar&
+Hcv_plugin_web_registrar::post(const char*pattern, const httplib::Server::Handler&handler)
+{
+  HCV_ASSERT(pattern != nullptr && handler);
+  std::string spanname = "plugin " + _hcvreg_plugin + " POST " + pattern;
+  _hcvreg_server->Post(pattern, hcv_web_traced_handler(spanname.c_str(), handler));
+  HCV_DEBUGOUT("Hcv_plugin_web_registrar::post " << spanname);
+  return *this;
+} // end Hcv_plugin_web_registrar::post
+
+
 void
 hcv_initialize_plugins_for_web(httplib::Server*webserv)
 {
@@ -195,7 +229,16 @@ hcv_initialize_plugins_for_web(httplib::Server*webserv)
       HCV_DEBUGOUT("hcv_initialize_plugins_for_web initializing " << pl.hcvpl_name
                    << (pl.hcvpl_arg?" with argument ":" without argument")
                    << (pl.hcvpl_arg?:"."));
-      (*pl.hcvpl_initweb)(webserv,pl.hcvpl_arg);
+      {
+        HCV_TRACE_SPAN_ID(hcv_trace_intern("plugin web init " + pl.hcvpl_name));
+        if (pl.hcvpl_initwebreg)
+          {
+            Hcv_plugin_web_registrar registrar(webserv, pl.hcvpl_name);
+            (*pl.hcvpl_initwebreg)(registrar,pl.hcvpl_arg);
+          }
+        else
+          (*pl.hcvpl_initweb)(webserv,pl.hcvpl_arg);
+      }
       HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_plugins_for_web initialized plugin "
                     << pl.hcvpl_name << (pl.hcvpl_arg?" with argument ":" without argument")
                     << (pl.hcvpl_arg?:"."));
@@ -224,7 +267,10 @@ hcv_initialize_plugins_for_database(pqxx::connection*dbconn)
       HCV_DEBUGOUT("hcv_initialize_plugins_for_database initializing " << pl.hcvpl_name
                    << (pl.hcvpl_arg?" with argument ":" without argument")
                    << (pl.hcvpl_arg?:"."));
-      (*pl.hcvpl_initdatabase)(dbconn,pl.hcvpl_arg);
+      {
+        HCV_TRACE_SPAN_ID(hcv_trace_intern("plugin database init " + pl.hcvpl_name));
+        (*pl.hcvpl_initdatabase)(dbconn,pl.hcvpl_arg);
+      }
       cnt++;
       HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_plugins_for_database initialized plugin "
                     << pl.hcvpl_name << (pl.hcvpl_arg?" with argument ":" without argument")
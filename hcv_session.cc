@@ -0,0 +1,324 @@
+/****************************************************************
+ * file hcv_session.cc
+ *
+ * Description:
+ *      In memory cache of web sessions of https://github.com/bstarynk/helpcovid
+ *      in front of the tb_session table, see file DATABASE.md
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+
+extern "C" const char hcv_session_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcv_session_date[] = __DATE__;
+
+
+/// Sessions are cached in a few shards, each with its own mutex, keyed
+/// by the session UUID.  They are opened at login, and checked then
+/// pinged with the HCV_SESSION_COOKIE_NAME cookie of requests, see
+/// hcv_web_open_session and hcv_web_request_session in hcv_web.cc.  Validity checks are answered from memory, and
+/// pinging a session only moves its expiry time in memory.  Moved
+/// expiry times are written to tb_session by one batched UPDATE from
+/// the background thread, about once per minute, so each active
+/// session costs roughly one database write per minute.
+/// Closed sessions leave a tombstone in their shard, so that a
+/// concurrent database fetch cannot cache them again as valid.
+struct hcv_session_entry_st
+{
+  long hcvsess_userid;
+  std::string hcvsess_http_ua;
+  std::string hcvsess_ip;
+  time_t hcvsess_expiry;	// expiry time, perhaps moved by pings
+  bool hcvsess_dirty;		// expiry to be written to tb_session
+};
+
+#define HCV_SESSION_NB_SHARDS 16
+#define HCV_SESSION_SHARD_MAX_SIZE 4096
+#define HCV_SESSION_FLUSH_PERIOD 60.0 /*seconds*/
+#define HCV_SESSION_TOMBSTONE_DURATION 600 /*seconds, longer than any fetch or flush*/
+
+struct hcv_session_shard_st
+{
+  std::mutex hcvshard_mtx;
+  std::unordered_map<std::string,hcv_session_entry_st> hcvshard_map;
+  std::unordered_map<std::string,time_t> hcvshard_closed; // uuid -> closing time
+};
+static hcv_session_shard_st hcv_session_shards[HCV_SESSION_NB_SHARDS];
+
+static std::atomic<long> hcv_session_hits;
+static std::atomic<long> hcv_session_misses;
+static std::atomic<long> hcv_session_flushed;
+static std::atomic<double> hcv_session_last_flush_time;
+
+
+static hcv_session_shard_st&
+hcv_session_shard(const std::string&uuid)
+{
+  return hcv_session_shards[std::hash<std::string> {}(uuid) % HCV_SESSION_NB_SHARDS];
+} // end hcv_session_shard
+
+
+/// insert into a locked shard, evicting expired sessions when it is full
+static void
+hcv_session_insert_locked(hcv_session_shard_st&shard, const std::string&uuid,
+                          hcv_session_entry_st&&ent)
+{
+  auto& smap = shard.hcvshard_map;
+  if (smap.size() >= HCV_SESSION_SHARD_MAX_SIZE)
+    {
+      time_t nowt = time(nullptr);
+      for (auto it = smap.begin(); it != smap.end(); )
+        {
+          if (it->second.hcvsess_expiry <= nowt && !it->second.hcvsess_dirty)
+            it = smap.erase(it);
+          else
+            it++;
+        }
+      /// still full: forget some clean session, it would be fetched again
+      for (auto it = smap.begin();
+           smap.size() >= HCV_SESSION_SHARD_MAX_SIZE && it != smap.end(); )
+        {
+          if (!it->second.hcvsess_dirty)
+            it = smap.erase(it);
+          else
+            it++;
+        }
+    }
+  smap.insert_or_assign(uuid, std::move(ent));
+} // end hcv_session_insert_locked
+
+
+std::string
+hcv_session_open(long userid, const std::string&http_ua, const std::string&ip)
+{
+  time_t expiry = 0;
+  std::string uuid = hcv_database_open_session(userid, http_ua, ip, &expiry);
+  if (uuid.empty())
+    return uuid;
+  hcv_session_shard_st& shard = hcv_session_shard(uuid);
+  std::lock_guard<std::mutex> gu(shard.hcvshard_mtx);
+  hcv_session_insert_locked(shard, uuid,
+                            hcv_session_entry_st {userid, http_ua, ip, expiry, false});
+  return uuid;
+} // end hcv_session_open
+
+
+/// fetch a session missing in memory from tb_session and cache it,
+/// unless it was closed during the fetch; ent gets the cached state,
+/// perhaps pinged by another thread meanwhile.  False if unknown or
+/// closed.
+static bool
+hcv_session_fetch(const std::string&uuid, hcv_session_shard_st&shard,
+                  hcv_session_entry_st&ent)
+{
+  hcv_session_misses++;
+  ent = hcv_session_entry_st {-1, "", "", 0, false};
+  if (!hcv_database_fetch_session(uuid, &ent.hcvsess_userid, ent.hcvsess_http_ua,
+                                  ent.hcvsess_ip, &ent.hcvsess_expiry))
+    return false;
+  std::lock_guard<std::mutex> gu(shard.hcvshard_mtx);
+  if (shard.hcvshard_closed.find(uuid) != shard.hcvshard_closed.end())
+    return false;
+  auto it = shard.hcvshard_map.find(uuid);
+  if (it != shard.hcvshard_map.end())
+    ent = it->second;
+  else
+    hcv_session_insert_locked(shard, uuid, hcv_session_entry_st(ent));
+  return true;
+} // end hcv_session_fetch
+
+
+bool
+hcv_session_is_valid(const std::string&uuid, const std::string&http_ua,
+                     const std::string&ip, long*puserid)
+{
+  if (uuid.empty())
+    return false;
+  time_t nowt = time(nullptr);
+  hcv_session_shard_st& shard = hcv_session_shard(uuid);
+  {
+    std::lock_guard<std::mutex> gu(shard.hcvshard_mtx);
+    if (shard.hcvshard_closed.find(uuid) != shard.hcvshard_closed.end())
+      return false;
+    auto it = shard.hcvshard_map.find(uuid);
+    if (it != shard.hcvshard_map.end())
+      {
+        hcv_session_hits++;
+        const hcv_session_entry_st& ent = it->second;
+        if (ent.hcvsess_expiry <= nowt || ent.hcvsess_http_ua != http_ua
+            || ent.hcvsess_ip != ip)
+          return false;
+        if (puserid)
+          *puserid = ent.hcvsess_userid;
+        return true;
+      }
+  }
+  hcv_session_entry_st ent;
+  if (!hcv_session_fetch(uuid, shard, ent))
+    return false;
+  if (ent.hcvsess_expiry <= nowt || ent.hcvsess_http_ua != http_ua
+      || ent.hcvsess_ip != ip)
+    return false;
+  if (puserid)
+    *puserid = ent.hcvsess_userid;
+  return true;
+} // end hcv_session_is_valid
+
+
+/// a session missing in memory, e.g. after a restart or once flushed
+/// out, is fetched from tb_session like in hcv_session_is_valid
+bool
+hcv_session_ping(const std::string&uuid)
+{
+  if (uuid.empty())
+    return false;
+  time_t nowt = time(nullptr);
+  hcv_session_shard_st& shard = hcv_session_shard(uuid);
+  hcv_session_entry_st ent;
+  bool fetched = false;
+  for (;;)
+    {
+      {
+        std::lock_guard<std::mutex> gu(shard.hcvshard_mtx);
+        if (shard.hcvshard_closed.find(uuid) != shard.hcvshard_closed.end())
+          return false;
+        auto it = shard.hcvshard_map.find(uuid);
+        if (it != shard.hcvshard_map.end())
+          {
+            if (it->second.hcvsess_expiry <= nowt)
+              return false;
+            it->second.hcvsess_expiry = nowt + HCV_SESSION_DURATION;
+            it->second.hcvsess_dirty = true;
+            return true;
+          }
+        /// evicted right after being fetched: cache it again, pinged
+        if (fetched)
+          {
+            if (ent.hcvsess_expiry <= nowt)
+              return false;
+            ent.hcvsess_expiry = nowt + HCV_SESSION_DURATION;
+            ent.hcvsess_dirty = true;
+            hcv_session_insert_locked(shard, uuid, std::move(ent));
+            return true;
+          }
+      }
+      if (!hcv_session_fetch(uuid, shard, ent))
+        return false;
+      fetched = true;
+    }
+} // end hcv_session_ping
+
+
+void
+hcv_session_close(const std::string&uuid)
+{
+  {
+    hcv_session_shard_st& shard = hcv_session_shard(uuid);
+    std::lock_guard<std::mutex> gu(shard.hcvshard_mtx);
+    shard.hcvshard_map.erase(uuid);
+    shard.hcvshard_closed.insert_or_assign(uuid, time(nullptr));
+  }
+  hcv_database_close_session(uuid);
+} // end hcv_session_close
+
+
+/// write every moved expiry time in one UPDATE, and forget expired sessions
+void
+hcv_session_flush_expiries(void)
+{
+  std::vector<std::pair<std::string,time_t>> dirtyvec;
+  time_t nowt = time(nullptr);
+  for (hcv_session_shard_st& shard : hcv_session_shards)
+    {
+      std::lock_guard<std::mutex> gu(shard.hcvshard_mtx);
+      auto& smap = shard.hcvshard_map;
+      for (auto it = smap.begin(); it != smap.end(); )
+        {
+          hcv_session_entry_st& ent = it->second;
+          if (ent.hcvsess_dirty)
+            {
+              dirtyvec.push_back({it->first, ent.hcvsess_expiry});
+              ent.hcvsess_dirty = false;
+            }
+          if (ent.hcvsess_expiry <= nowt)
+            it = smap.erase(it);
+          else
+            it++;
+        }
+      /// once expired in tb_session too, a closed session needs no tombstone
+      auto& closedmap = shard.hcvshard_closed;
+      for (auto it = closedmap.begin(); it != closedmap.end(); )
+        {
+          if (it->second + HCV_SESSION_TOMBSTONE_DURATION <= nowt)
+            it = closedmap.erase(it);
+          else
+            it++;
+        }
+    }
+  hcv_session_last_flush_time.store(hcv_monotonic_real_time());
+  if (dirtyvec.empty())
+    return;
+  if (!hcv_database_update_session_expiries(dirtyvec))
+    {
+      /// mark them dirty again, to retry at next flush
+      for (auto& uuidexp: dirtyvec)
+        {
+          hcv_session_shard_st& shard = hcv_session_shard(uuidexp.first);
+          std::lock_guard<std::mutex> gu(shard.hcvshard_mtx);
+          auto it = shard.hcvshard_map.find(uuidexp.first);
+          if (it != shard.hcvshard_map.end())
+            it->second.hcvsess_dirty = true;
+        }
+      return;
+    }
+  hcv_session_flushed += dirtyvec.size();
+  HCV_DEBUGOUT("hcv_session_flush_expiries updated " << dirtyvec.size() << " sessions");
+} // end hcv_session_flush_expiries
+
+
+/// called by the background thread after each poll
+void
+hcv_session_periodic_flush(void)
+{
+  if (hcv_monotonic_real_time() - hcv_session_last_flush_time.load()
+      >= HCV_SESSION_FLUSH_PERIOD)
+    hcv_session_flush_expiries();
+} // end hcv_session_periodic_flush
+
+
+hcv_session_cache_stats_st
+hcv_session_cache_statistics(void)
+{
+  hcv_session_cache_stats_st st;
+  memset (&st, 0, sizeof(st));
+  for (hcv_session_shard_st& shard : hcv_session_shards)
+    {
+      std::lock_guard<std::mutex> gu(shard.hcvshard_mtx);
+      st.sesscache_size += shard.hcvshard_map.size();
+    }
+  st.sesscache_hits = hcv_session_hits.load();
+  st.sesscache_misses = hcv_session_misses.load();
+  st.sesscache_flushed = hcv_session_flushed.load();
+  return st;
+} // end hcv_session_cache_statistics
+
+/// end of file hcv_session.cc
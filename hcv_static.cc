@@ -0,0 +1,384 @@
+/****************************************************************
+ * file hcv_static.cc
+ *
+ * Description:
+ *      In-memory cache of static web files of https://github.com/bstarynk/helpcovid
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+
+extern "C" const char hcv_static_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcv_static_date[] = __DATE__;
+
+
+//// Static files under the webroot (CSS, Javascript, SVG, captcha
+//// images...) are lazily loaded into memory on their first request,
+//// and reloaded when their device, inode, size or mtime changes.
+//// Each cached file has a precomputed ETag and Last-Modified, and is
+//// given to httplib thru a content provider, without copying it.
+//// Compressible files also keep a gzip variant, served to clients
+//// accepting it. Files too big to be cached are neither read nor
+//// compressed in advance, but streamed from the file at each request.
+struct hcv_static_file_st
+{
+  std::string hcvstf_path;	// absolute file path
+  std::string hcvstf_content;	// file contents
+  std::string hcvstf_content_type;
+  std::string hcvstf_etag;	// quoted strong entity tag
+  std::string hcvstf_gzip_content; // gzip variant, or empty
+  std::string hcvstf_gzip_etag;	// entity tag of gzip variant
+  std::string hcvstf_last_modified; // HTTP date of mtime
+  dev_t hcvstf_dev;
+  ino_t hcvstf_ino;
+  off_t hcvstf_size;
+  struct timespec hcvstf_mtim;
+  bool hcvstf_fingerprinted;	// name contains some content hash
+  bool hcvstf_streamed;		// too big, hcvstf_content is empty
+};
+
+typedef std::map<std::string,std::shared_ptr<const hcv_static_file_st>> hcv_static_file_map_t;
+/// an immutable snapshot, replaced under hcv_static_mtx after loading
+static std::shared_ptr<const hcv_static_file_map_t> hcv_static_file_cache
+  = std::make_shared<const hcv_static_file_map_t>();
+static std::recursive_mutex hcv_static_mtx;
+static std::atomic<long> hcv_static_hits;
+static std::atomic<long> hcv_static_misses;
+static std::atomic<long> hcv_static_not_modified;
+
+/// bigger files are not cached but streamed on every request
+const off_t hcv_max_cached_static_file_size = 4*1024*1024;
+
+#define HCV_STATIC_STREAM_BUFSIZE 65536
+
+/// cache lifetime of fingerprinted static files, like style.3fa2b17c.css
+#define HCV_STATIC_IMMUTABLE_CACHE_CONTROL "public, max-age=31536000, immutable"
+/// other static files should be revalidated with their ETag
+#define HCV_STATIC_REVALIDATE_CACHE_CONTROL "public, no-cache"
+
+
+/// a file name is fingerprinted when its last dot is preceded by a dot
+/// or dash and at least 8 hexadecimal digits, e.g. app-0f3c9a1b.js
+static bool
+hcv_static_path_is_fingerprinted(const std::string&path)
+{
+  auto lastslash = path.rfind('/');
+  auto lastdot = path.rfind('.');
+  if (lastdot == std::string::npos
+      || (lastslash != std::string::npos && lastdot < lastslash))
+    return false;
+  size_t nbhex = 0;
+  size_t ix = lastdot;
+  while (ix > 0 && std::isxdigit(path[ix-1]))
+    {
+      ix--;
+      nbhex++;
+    }
+  return nbhex >= 8 && ix > 0 && (path[ix-1] == '.' || path[ix-1] == '-');
+} // end hcv_static_path_is_fingerprinted
+
+
+static std::string
+hcv_static_http_date(time_t t)
+{
+  struct tm tm;
+  memset (&tm, 0, sizeof(tm));
+  gmtime_r(&t, &tm);
+  char datbuf[64];
+  memset (datbuf, 0, sizeof(datbuf));
+  strftime(datbuf, sizeof(datbuf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return std::string(datbuf);
+} // end hcv_static_http_date
+
+
+static bool
+hcv_static_read_file(const std::string&path, std::string&content, off_t size)
+{
+  int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  content.assign(size, '\0');
+  size_t nbread = 0;
+  while (nbread < content.size())
+    {
+      ssize_t nb = read(fd, content.data()+nbread, content.size()-nbread);
+      if (nb < 0 && errno == EINTR)
+        continue;
+      if (nb <= 0)
+        break;
+      nbread += nb;
+    }
+  close(fd);
+  content.resize(nbread);
+  return true;
+} // end hcv_static_read_file
+
+
+static std::shared_ptr<const hcv_static_file_st>
+hcv_load_static_file(const std::string&path, const struct stat&st)
+{
+  auto stf = std::make_shared<hcv_static_file_st>();
+  stf->hcvstf_path = path;
+  stf->hcvstf_streamed = st.st_size > hcv_max_cached_static_file_size;
+  if (!stf->hcvstf_streamed
+      && !hcv_static_read_file(path, stf->hcvstf_content, st.st_size))
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_load_static_file: cannot read " << path);
+      return nullptr;
+    }
+  const char*ctype = httplib::detail::find_content_type(path, {});
+  stf->hcvstf_content_type = ctype?ctype:"application/octet-stream";
+  char etagbuf[80];
+  memset (etagbuf, 0, sizeof(etagbuf));
+  if (stf->hcvstf_streamed)
+    /// a streamed file is not hashed, its inode and mtime identify it
+    snprintf(etagbuf, sizeof(etagbuf), "\"%lx-%lx-%lx.%09ld\"",
+             (long)st.st_ino, (long)st.st_size,
+             (long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+  else
+    {
+      /// FNV-1a hash of the contents, with the size, gives the entity tag
+      uint64_t h = 14695981039346656037ULL;
+      for (char c: stf->hcvstf_content)
+        {
+          h ^= (unsigned char)c;
+          h *= 1099511628211ULL;
+        }
+      snprintf(etagbuf, sizeof(etagbuf), "\"%016llx-%lx\"",
+               (unsigned long long)h, (long)stf->hcvstf_content.size());
+    }
+  stf->hcvstf_etag = etagbuf;
+  if (stf->hcvstf_content.size() >= hcv_min_compressed_size
+      && hcv_compressible_content_type(stf->hcvstf_content_type))
+    {
+      std::string gzcont = hcv_gzip_compress(stf->hcvstf_content.data(),
+                                             stf->hcvstf_content.size());
+      if (gzcont.size() < stf->hcvstf_content.size())
+        {
+          stf->hcvstf_gzip_content = std::move(gzcont);
+          /// the gzip variant needs its own strong entity tag
+          stf->hcvstf_gzip_etag = stf->hcvstf_etag;
+          stf->hcvstf_gzip_etag.insert(stf->hcvstf_gzip_etag.size()-1, "-gz");
+        }
+    }
+  stf->hcvstf_last_modified = hcv_static_http_date(st.st_mtim.tv_sec);
+  stf->hcvstf_dev = st.st_dev;
+  stf->hcvstf_ino = st.st_ino;
+  stf->hcvstf_size = st.st_size;
+  stf->hcvstf_mtim = st.st_mtim;
+  stf->hcvstf_fingerprinted = hcv_static_path_is_fingerprinted(path);
+  HCV_DEBUGOUT("hcv_load_static_file " << path << " of " << stf->hcvstf_content.size()
+               << " bytes, type " << stf->hcvstf_content_type
+               << " etag " << stf->hcvstf_etag
+               << " gzip " << stf->hcvstf_gzip_content.size()
+               << (stf->hcvstf_fingerprinted?" fingerprinted":""));
+  return stf;
+} // end hcv_load_static_file
+
+
+static std::shared_ptr<const hcv_static_file_st>
+hcv_get_static_file(const std::string&path)
+{
+  struct stat st;
+  memset (&st, 0, sizeof(st));
+  if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+    return nullptr;
+  {
+    auto cache = std::atomic_load(&hcv_static_file_cache);
+    auto it = cache->find(path);
+    if (it != cache->end())
+      {
+        auto& stf = it->second;
+        if (stf->hcvstf_dev == st.st_dev
+            && stf->hcvstf_ino == st.st_ino
+            && stf->hcvstf_size == st.st_size
+            && stf->hcvstf_mtim.tv_sec == st.st_mtim.tv_sec
+            && stf->hcvstf_mtim.tv_nsec == st.st_mtim.tv_nsec)
+          {
+            hcv_static_hits++;
+            return stf;
+          }
+      }
+  }
+  hcv_static_misses++;
+  auto stf = hcv_load_static_file(path, st);
+  if (!stf || stf->hcvstf_streamed)
+    return stf;
+  std::lock_guard<std::recursive_mutex> gu(hcv_static_mtx);
+  auto newcache = std::make_shared<hcv_static_file_map_t>(*std::atomic_load(&hcv_static_file_cache));
+  (*newcache)[path] = stf;
+  std::atomic_store(&hcv_static_file_cache,
+                    std::shared_ptr<const hcv_static_file_map_t>(newcache));
+  return stf;
+} // end hcv_get_static_file
+
+
+/// serve a file too big to be cached, reading it piecewise while the
+/// response is sent; the descriptor is closed with the provider
+static bool
+hcv_stream_static_file(const std::shared_ptr<const hcv_static_file_st>&stf,
+                       httplib::Response&resp)
+{
+  int fd = open(stf->hcvstf_path.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_stream_static_file: cannot open " << stf->hcvstf_path);
+      return false;
+    }
+  std::shared_ptr<int> fdptr(new int(fd), [](int*pfd)
+  {
+    close(*pfd);
+    delete pfd;
+  });
+  resp.set_header("Content-Type", stf->hcvstf_content_type);
+  resp.set_content_provider
+  (stf->hcvstf_size,
+   [fdptr](size_t offset, size_t length, httplib::DataSink&sink)
+  {
+    char buf[HCV_STATIC_STREAM_BUFSIZE];
+    ssize_t nb = pread(*fdptr, buf, std::min(length, sizeof(buf)), offset);
+    if (nb < 0 && errno == EINTR)
+      return;
+    if (nb > 0)
+      sink.write(buf, nb);
+    else /// the file was truncated meanwhile, abort the response
+      sink.done();
+  });
+  return true;
+} // end hcv_stream_static_file
+
+
+/// check the If-None-Match request header, a list of entity tags or *
+static bool
+hcv_static_etag_matches(const std::string&ifnonematch, const std::string&etag)
+{
+  if (ifnonematch.empty())
+    return false;
+  size_t pos = 0;
+  while (pos < ifnonematch.size())
+    {
+      size_t comma = ifnonematch.find(',', pos);
+      if (comma == std::string::npos)
+        comma = ifnonematch.size();
+      size_t beg = pos, end = comma;
+      while (beg < end && isspace(ifnonematch[beg]))
+        beg++;
+      while (end > beg && isspace(ifnonematch[end-1]))
+        end--;
+      if (end-beg >= 2 && ifnonematch.compare(beg, 2, "W/") == 0)
+        beg += 2;
+      if ((end-beg == 1 && ifnonematch[beg] == '*')
+          || ifnonematch.compare(beg, end-beg, etag) == 0)
+        return true;
+      pos = comma+1;
+    }
+  return false;
+} // end hcv_static_etag_matches
+
+
+bool
+hcv_serve_static_file(const httplib::Request&req, httplib::Response&resp, long reqnum)
+{
+  std::string webroot = hcv_get_web_root();
+  if (webroot.empty() || req.path.empty() || req.path[0] != '/'
+      || !httplib::detail::is_valid_path(req.path))
+    return false;
+  std::string path = webroot + req.path.substr(1);
+  if (path.back() == '/')
+    path += "index.html";
+  auto stf = hcv_get_static_file(path);
+  if (!stf)
+    {
+      HCV_DEBUGOUT("hcv_serve_static_file req#" << reqnum << " no file for " << req.path);
+      return false;
+    }
+  bool gzipped = !stf->hcvstf_gzip_content.empty() && hcv_request_accepts_gzip(req);
+  const std::string&etag = gzipped?stf->hcvstf_gzip_etag:stf->hcvstf_etag;
+  const std::string&content = gzipped?stf->hcvstf_gzip_content:stf->hcvstf_content;
+  if (!stf->hcvstf_gzip_content.empty())
+    resp.set_header("Vary", "Accept-Encoding");
+  resp.set_header("ETag", etag);
+  resp.set_header("Last-Modified", stf->hcvstf_last_modified);
+  resp.set_header("Cache-Control",
+                  stf->hcvstf_fingerprinted
+                  ?HCV_STATIC_IMMUTABLE_CACHE_CONTROL
+                  :HCV_STATIC_REVALIDATE_CACHE_CONTROL);
+  bool notmodified = false;
+  if (req.has_header("If-None-Match"))
+    notmodified = hcv_static_etag_matches(req.get_header_value("If-None-Match"),
+                                          etag);
+  else if (req.has_header("If-Modified-Since"))
+    notmodified = req.get_header_value("If-Modified-Since") == stf->hcvstf_last_modified;
+  if (notmodified)
+    {
+      hcv_static_not_modified++;
+      resp.status = 304;
+      return true;
+    }
+  resp.status = 200;
+  if (stf->hcvstf_streamed)
+    return hcv_stream_static_file(stf, resp);
+  if (content.empty())
+    {
+      resp.set_content("", 0, stf->hcvstf_content_type.c_str());
+      return true;
+    }
+  resp.set_header("Content-Type", stf->hcvstf_content_type);
+  if (gzipped)
+    resp.set_header("Content-Encoding", "gzip");
+  /// the provider keeps the cached file alive till the response is sent
+  resp.set_content_provider
+  (content.size(),
+   [stf,gzipped](size_t offset, size_t length, httplib::DataSink&sink)
+  {
+    const std::string&cont = gzipped?stf->hcvstf_gzip_content:stf->hcvstf_content;
+    sink.write(cont.data()+offset, length);
+  });
+  return true;
+} // end hcv_serve_static_file
+
+
+void
+hcv_clear_static_file_cache(void)
+{
+  std::lock_guard<std::recursive_mutex> gu(hcv_static_mtx);
+  HCV_DEBUGOUT("hcv_clear_static_file_cache forgetting "
+               << std::atomic_load(&hcv_static_file_cache)->size() << " files");
+  std::atomic_store(&hcv_static_file_cache,
+                    std::make_shared<const hcv_static_file_map_t>());
+} // end hcv_clear_static_file_cache
+
+
+void
+hcv_static_file_cache_statistics(long*phits, long*pmisses, long*pnotmodified, long*pnbentries)
+{
+  if (phits)
+    *phits = hcv_static_hits.load();
+  if (pmisses)
+    *pmisses = hcv_static_misses.load();
+  if (pnotmodified)
+    *pnotmodified = hcv_static_not_modified.load();
+  if (pnbentries)
+    *pnbentries = (long) std::atomic_load(&hcv_static_file_cache)->size();
+} // end hcv_static_file_cache_statistics
+
+//////////////////// end of file hcv_static.cc of github.com/bstarynk/helpcovid
@@ -30,8 +30,19 @@
 extern "C" const char hcv_template_gitid[] = HELPCOVID_GITID;
 extern "C" const char hcv_template_date[] = __DATE__;
 
-static std::map<std::string, hcv_template_expanding_closure_t> hcv_template_expander_dict;
+/// The expander dictionary is an immutable snapshot, replaced (under
+/// hcv_template_mtx) by registration or removal of expanders, and read
+/// without any lock by template expansion.  The generation is
+/// incremented after each new snapshot is published, so compiled
+/// templates know when to rebind their expanders.
+typedef std::map<std::string, hcv_template_expanding_closure_t> hcv_template_expander_dict_t;
+static std::shared_ptr<const hcv_template_expander_dict_t> hcv_template_expander_dict
+  = std::make_shared<const hcv_template_expander_dict_t>();
+static std::atomic<long> hcv_template_expander_generation;
 static std::recursive_mutex hcv_template_mtx;
+/// false once the builtin msg expander has been forgotten or replaced,
+/// then <?hcv msg ...?> are not folded into variants
+static std::atomic<bool> hcv_template_msg_builtin;
 
 ////////////////////////////////////////////////////////////////
 
@@ -51,147 +62,174 @@ Hcv_http_template_data::~Hcv_http_template_data()
 
 
 
+////////////////////////////////////////////////////////////////
+/******* Accept-Language negotiation *********/
+
+/// The Accept-Language: header is parsed into language ranges ranked
+/// by decreasing q-value, reduced to their primary subtag, and
+/// intersected with the languages we have: those with a gettext
+/// catalog, and the suffixes of chunk names like WELCOME_fr. Browsers
+/// send few distinct headers, so results are cached by exact header
+/// string, and recomputed when the chunk map changes.
+#define HCV_LANGUAGE_CACHE_MAX_SIZE 256
+
+struct hcv_language_cache_entry_st
+{
+  long hcvlce_chunkgen;	// the chunk map generation of the ranking
+  std::shared_ptr<const std::vector<std::string>> hcvlce_languages;
+};
+
+static std::mutex hcv_language_mtx;
+/// primary subtags of gettext catalogs, under hcv_language_mtx
+static std::set<std::string,std::less<>> hcv_gettext_languages;
+static std::unordered_map<std::string,hcv_language_cache_entry_st> hcv_language_cache;
+static std::atomic<long> hcv_language_cache_hits;
+static std::atomic<long> hcv_language_cache_misses;
+
+
+std::vector<std::string>
+hcv_parse_accept_language(std::string_view header)
+{
+  std::vector<std::pair<double,std::string>> rangevec;
+  size_t pos = 0;
+  while (pos < header.size())
+    {
+      size_t comma = header.find(',', pos);
+      if (comma == std::string_view::npos)
+        comma = header.size();
+      std::string_view item = header.substr(pos, comma-pos);
+      pos = comma+1;
+      size_t semicol = item.find(';');
+      std::string_view tag = item.substr(0, semicol);
+      while (!tag.empty() && isspace(tag.front()))
+        tag.remove_prefix(1);
+      std::string primary;
+      for (char c: tag)
+        {
+          if (!isalpha(c) || primary.size() > 8)
+            break;
+          primary.push_back(tolower(c));
+        }
+      /// skip the * wildcard and malformed ranges
+      if (primary.size() < 2 || primary.size() > 3)
+        continue;
+      double q = 1.0;
+      if (semicol != std::string_view::npos)
+        {
+          std::string params(item.substr(semicol+1));
+          const char*qstr = strstr(params.c_str(), "q=");
+          if (qstr)
+            q = atof(qstr+2);
+        }
+      if (q <= 0.0)
+        continue;
+      rangevec.push_back({q, primary});
+    }
+  std::stable_sort(rangevec.begin(), rangevec.end(),
+                   [](const std::pair<double,std::string>&l, const std::pair<double,std::string>&r)
+  {
+    return l.first > r.first;
+  });
+  std::vector<std::string> langvec;
+  for (auto& qlang: rangevec)
+    if (std::find(langvec.begin(), langvec.end(), qlang.second) == langvec.end())
+      langvec.push_back(qlang.second);
+  return langvec;
+} // end hcv_parse_accept_language
+
+
+/// called once the text domain is bound, to know which languages have
+/// a gettext catalog DIR/LANG/LC_MESSAGES/HelpCoviD.mo
+void
+hcv_register_gettext_languages(const char*textdomdir)
+{
+  if (!textdomdir)
+    return;
+  DIR*dir = opendir(textdomdir);
+  if (!dir)
+    return;
+  std::lock_guard<std::mutex> gu(hcv_language_mtx);
+  while (struct dirent*de = readdir(dir))
+    {
+      if (!isalpha(de->d_name[0]))
+        continue;
+      std::string mopath = std::string(textdomdir) + "/" + de->d_name
+                           + "/LC_MESSAGES/" + HCV_DGETTEXT_DOMAIN + ".mo";
+      if (access(mopath.c_str(), R_OK))
+        continue;
+      std::string primary;
+      for (const char*pc = de->d_name; isalpha(*pc); pc++)
+        primary.push_back(tolower(*pc));
+      if (primary.size() >= 2 && primary.size() <= 3)
+        hcv_gettext_languages.insert(primary);
+    }
+  closedir(dir);
+  hcv_language_cache.clear();
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_register_gettext_languages found "
+                << hcv_gettext_languages.size() << " languages in " << textdomdir);
+} // end hcv_register_gettext_languages
+
+
+std::shared_ptr<const std::vector<std::string>>
+hcv_negotiate_languages(const std::string&header)
+{
+  long chunkgen = hcv_chunkmap_generation();
+  std::lock_guard<std::mutex> gu(hcv_language_mtx);
+  auto it = hcv_language_cache.find(header);
+  if (it != hcv_language_cache.end() && it->second.hcvlce_chunkgen == chunkgen)
+    {
+      hcv_language_cache_hits++;
+      return it->second.hcvlce_languages;
+    }
+  hcv_language_cache_misses++;
+  auto langvec = std::make_shared<std::vector<std::string>>();
+  for (std::string& lang: hcv_parse_accept_language(header))
+    if (hcv_gettext_languages.find(lang) != hcv_gettext_languages.end()
+        || hcv_chunkmap_has_language(lang))
+      langvec->push_back(std::move(lang));
+  if (hcv_language_cache.size() >= HCV_LANGUAGE_CACHE_MAX_SIZE)
+    hcv_language_cache.clear();
+  hcv_language_cache[header] = hcv_language_cache_entry_st {chunkgen, langvec};
+  return langvec;
+} // end hcv_negotiate_languages
+
+
+void
+hcv_language_cache_statistics(long*phits, long*pmisses, long*pnbentries)
+{
+  if (phits)
+    *phits = hcv_language_cache_hits.load();
+  if (pmisses)
+    *pmisses = hcv_language_cache_misses.load();
+  if (pnbentries)
+    {
+      std::lock_guard<std::mutex> gu(hcv_language_mtx);
+      *pnbentries = (long) hcv_language_cache.size();
+    }
+} // end hcv_language_cache_statistics
+
+
+std::shared_ptr<const std::vector<std::string>>
+Hcv_http_template_data::request_languages(void) const
+{
+  if (_hcvhttp_languages)
+    return _hcvhttp_languages;
+  auto req = request();
+  if (!req || !req->has_header("Accept-Language"))
+    _hcvhttp_languages = std::make_shared<const std::vector<std::string>>();
+  else
+    _hcvhttp_languages = hcv_negotiate_languages(req->get_header_value("Accept-Language"));
+  return _hcvhttp_languages;
+} // end Hcv_http_template_data::request_languages
+
+
 std::string
 Hcv_http_template_data::request_language(void) const
 {
-  if (!_hcvhttp_language.empty())
-    return _hcvhttp_language;
-  auto req = request();
-  if (!req)
+  auto langs = request_languages();
+  if (langs->empty())
     return "";
-  std::string langstr= req->get_header_value("Accept-Language");
-  HCV_DEBUGOUT("Hcv_http_template_data::request_language langstr='" << langstr << "'");
-  if (langstr.empty())
-    return "";
-  std::string reqlanstr;
-#warning Hcv_http_template_data::request_language incomplete
-  if (false) {}
-#define HCV_WHENLANG(Str) else if (langstr.find(Str) != std::string::npos) reqlanstr= Str
-  // see https://www.metamodpro.com/browser-language-codes
-  // only two letter codes here
-  HCV_WHENLANG("af"); // Afrikaans
-  HCV_WHENLANG("hr"); // Croatian
-  HCV_WHENLANG("el"); // Gree
-  HCV_WHENLANG("pl"); // Polish
-  HCV_WHENLANG("sx"); // Sutu
-  HCV_WHENLANG("sq"); // Albanian
-  HCV_WHENLANG("cs"); // Czech
-  HCV_WHENLANG("gu"); // Gujurati
-  HCV_WHENLANG("pt"); // Portugese
-  HCV_WHENLANG("sw"); // Swahili
-  HCV_WHENLANG("ar"); // Arabic (standard)
-  HCV_WHENLANG("da"); // Danish
-  HCV_WHENLANG("ht"); // Haitian
-  HCV_WHENLANG("sv"); // Swedish
-  HCV_WHENLANG("nl"); // Dutch
-  HCV_WHENLANG("he"); // Hebrew
-  HCV_WHENLANG("pa"); // Punjabi
-  HCV_WHENLANG("hi"); // Hindi
-  HCV_WHENLANG("en"); // English
-  HCV_WHENLANG("hu"); // Hungarian
-  HCV_WHENLANG("ta"); // Tamil
-  HCV_WHENLANG("is"); // Icelandic
-  HCV_WHENLANG("qe"); // Quechua
-  HCV_WHENLANG("tt"); // Tatar
-  HCV_WHENLANG("id"); // Indonesian
-  HCV_WHENLANG("rm"); // Rhaeto-Romanic
-  HCV_WHENLANG("te"); // Teluga
-  HCV_WHENLANG("iu"); // Inuktitut
-  HCV_WHENLANG("ro"); // Romanian
-  HCV_WHENLANG("th"); // Thai
-  HCV_WHENLANG("ga"); // Irish
-  HCV_WHENLANG("tig"); // Tigre
-  HCV_WHENLANG("it"); // Italian
-  HCV_WHENLANG("ru"); // Russian
-  HCV_WHENLANG("ts"); // Tsonga
-  HCV_WHENLANG("tn"); // Tswana
-  HCV_WHENLANG("ja"); // Japanese
-  HCV_WHENLANG("sz"); // Sami
-  HCV_WHENLANG("tr"); // Turkish
-  HCV_WHENLANG("kn"); // Kannada
-  HCV_WHENLANG("sg"); // Sango
-  HCV_WHENLANG("tk"); // Turkmen
-  HCV_WHENLANG("ks"); // Kashmiri
-  HCV_WHENLANG("sa"); // Sanskrit
-  HCV_WHENLANG("uk"); // Ukrainian
-  HCV_WHENLANG("kk"); // Kazakh
-  HCV_WHENLANG("sc"); // Sardinian
-  HCV_WHENLANG("hsb"); // Upper Sorbian
-  HCV_WHENLANG("km"); // Khmer
-  HCV_WHENLANG("gd"); // Scots Gaelic
-  HCV_WHENLANG("ur"); // Urdu
-  HCV_WHENLANG("ky"); // Kirghiz
-  HCV_WHENLANG("sd"); // Sindhi
-  HCV_WHENLANG("ve"); // Venda
-  HCV_WHENLANG("eo"); // Esperanto
-  HCV_WHENLANG("tlh"); // Klingon
-  HCV_WHENLANG("si"); // Singhalese
-  HCV_WHENLANG("vi"); // Vietnamese
-  HCV_WHENLANG("ar"); // Aragonese
-  HCV_WHENLANG("et"); // Estonian
-  HCV_WHENLANG("ko"); // Korean
-  HCV_WHENLANG("sr"); // Serbian
-  HCV_WHENLANG("vo"); // Volapuk
-  HCV_WHENLANG("hy"); // Armenian
-  HCV_WHENLANG("fo"); // Faeroese
-  HCV_WHENLANG("sk"); // Slovak
-  HCV_WHENLANG("wa"); // Walloon
-  HCV_WHENLANG("as"); // Assamese
-  HCV_WHENLANG("fa"); // Farsi
-  HCV_WHENLANG("sl"); // Slovenian
-  HCV_WHENLANG("cy"); // Welsh
-  HCV_WHENLANG("ast"); // Asturian
-  HCV_WHENLANG("fj"); // Fijian
-  HCV_WHENLANG("la"); // Latin
-  HCV_WHENLANG("so"); // Somani
-  HCV_WHENLANG("xh"); // Xhosa
-  HCV_WHENLANG("az"); // Azerbaijani
-  HCV_WHENLANG("fi"); // Finnish
-  HCV_WHENLANG("lv"); // Latvian
-  HCV_WHENLANG("sb"); // Sorbian
-  HCV_WHENLANG("ji"); // Yiddish
-  HCV_WHENLANG("eu"); // Basque
-  HCV_WHENLANG("fr"); // French
-  HCV_WHENLANG("lt"); // Lithuanian
-  HCV_WHENLANG("es"); // Spanish
-  HCV_WHENLANG("zu"); // Zulu
-  HCV_WHENLANG("bg"); // Bulgarian
-  HCV_WHENLANG("lb"); // Luxembourgish
-  HCV_WHENLANG("be"); // Belarusian
-  HCV_WHENLANG("mk"); // Macedonian
-  HCV_WHENLANG("bn"); // Bengali
-  HCV_WHENLANG("ms"); // Malay
-  HCV_WHENLANG("bs"); // Bosnian
-  HCV_WHENLANG("ml"); // Malayalam
-  HCV_WHENLANG("br"); // Breton
-  HCV_WHENLANG("mt"); // Maltese
-  HCV_WHENLANG("my"); // Burmese
-  HCV_WHENLANG("fy"); // Frisian
-  HCV_WHENLANG("mr"); // Marathi
-  HCV_WHENLANG("ca"); // Catalan
-  HCV_WHENLANG("fur"); // Friulian
-  HCV_WHENLANG("mo"); // Moldavian
-  HCV_WHENLANG("ch"); // Chamarro
-  HCV_WHENLANG("gd"); // Gaelic
-  HCV_WHENLANG("nv"); // Navajo
-  HCV_WHENLANG("ce"); // Chechen
-  HCV_WHENLANG("ng"); // Ndonga
-  HCV_WHENLANG("zh"); // Chinese
-  HCV_WHENLANG("gl"); // Galacian
-  HCV_WHENLANG("ne"); // Nepali
-  HCV_WHENLANG("ka"); // Georgian
-  HCV_WHENLANG("no"); // Norwegian
-  HCV_WHENLANG("de"); // German
-  HCV_WHENLANG("co"); // Corsican
-  HCV_WHENLANG("cr"); // Cree
-  HCV_WHENLANG("oc"); // Occitan
-  HCV_WHENLANG("or"); // Oriya
-  HCV_WHENLANG("fa"); // Persian
-#warning a few human language codes are missing in Hcv_http_template_data::request_language
-#undef HCV_WHENLANG
-  if (!reqlanstr.empty())
-    _hcvhttp_language = reqlanstr;
-  return reqlanstr;
+  return langs->front();
 } // end Hcv_http_template_data::request_language
 
 ////////////////
@@ -281,7 +319,13 @@ hcv_register_template_expander_closure(const std::string&name, const hcv_templat
     if (!std::isalnum(c) && c!='_')
       HCV_FATALOUT("hcv_register_expander_closure: bad name '"<< name <<"' for expander.");
   std::lock_guard<std::recursive_mutex> gu(hcv_template_mtx);
-  hcv_template_expander_dict.insert({name,expfun});
+  if (name == "msg")
+    hcv_template_msg_builtin.store(false);
+  auto newdict = std::make_shared<hcv_template_expander_dict_t>(*std::atomic_load(&hcv_template_expander_dict));
+  newdict->insert({name,expfun});
+  std::atomic_store(&hcv_template_expander_dict,
+                    std::shared_ptr<const hcv_template_expander_dict_t>(newdict));
+  hcv_template_expander_generation++;
 } // end hcv_register_expander_closure
 
 
@@ -290,29 +334,64 @@ void
 hcv_forget_template_expander(const std::string&name)
 {
   std::lock_guard<std::recursive_mutex> gu(hcv_template_mtx);
-  auto it = hcv_template_expander_dict.find(name);
-  if (it == hcv_template_expander_dict.end())
+  auto olddict = std::atomic_load(&hcv_template_expander_dict);
+  if (olddict->find(name) == olddict->end())
     {
       HCV_SYSLOGOUT(LOG_WARNING,"hcv_forget_template_expander: unknown name='" << name << "'");
       return;
     };
-  hcv_template_expander_dict.erase(it);
+  if (name == "msg")
+    hcv_template_msg_builtin.store(false);
+  auto newdict = std::make_shared<hcv_template_expander_dict_t>(*olddict);
+  newdict->erase(name);
+  std::atomic_store(&hcv_template_expander_dict,
+                    std::shared_ptr<const hcv_template_expander_dict_t>(newdict));
+  hcv_template_expander_generation++;
 } // end hcv_forget_template_expander
 
 
 
+/// parse the expander name of some processing instruction, giving the
+/// offset of its argument, or -1 if invalid
+static int
+hcv_parse_processing_instruction_name(const std::string &procinstr, std::string&name)
+{
+  char namebuf[80];
+  memset (namebuf, 0, sizeof(namebuf));
+  static_assert (sizeof(namebuf) >= HCV_TEMPLATE_NAME_MAXLEN, "too short namebuf");
+  int endpos = -1;
+  if (sscanf(procinstr.c_str(), "<?hcv %64[a-zA-Z0-9_] %n", namebuf, &endpos)<1 || endpos<0)
+    return -1;
+  name.assign(namebuf);
+  return endpos;
+} // end hcv_parse_processing_instruction_name
+
+
+
+static void
+hcv_warn_unknown_expander(Hcv_template_data*templdata, const std::string&name)
+{
+  if (auto httptempl = dynamic_cast<Hcv_http_template_data*>(templdata))
+    HCV_SYSLOGOUT(LOG_WARNING,"hcv_expand_processing_instruction: unknown namebuf='"
+                  << name << "' for HTTP request "
+                  << httptempl->request_method()
+                  << " on " << httptempl->request_path());
+  else
+    HCV_SYSLOGOUT(LOG_WARNING,"hcv_expand_processing_instruction: unknown namebuf='" << name);
+} // end hcv_warn_unknown_expander
+
+
+
 void
 hcv_expand_processing_instruction(Hcv_template_data*templdata, const std::string &procinstr, const char*filename, int lineno, long offset)
 {
   if (!templdata || templdata->kind() == Hcv_template_data::TmplKind_en::hcvtk_none)
     HCV_FATALOUT("hcv_expand_processing_instruction: missing templdata for procinstr='"
                  << procinstr << "' in " << (filename?:"??") << ":" << lineno);
-  char namebuf[80];
-  memset (namebuf, 0, sizeof(namebuf));
-  static_assert (sizeof(namebuf) >= HCV_TEMPLATE_NAME_MAXLEN, "too short namebuf");
-  int endpos = -1;
+  std::string name;
   const char*procstr = procinstr.c_str();
-  if (sscanf(procstr, "<?hcv %64[a-zA-Z0-9_] %n", namebuf, &endpos)<1 || endpos<0)
+  int endpos = hcv_parse_processing_instruction_name(procinstr, name);
+  if (endpos < 0)
     {
       HCV_SYSLOGOUT(LOG_WARNING,"hcv_expand_processing_instruction: invalid procinstr='" << procinstr
                     << "' in " << (filename?:"**??**")
@@ -324,38 +403,315 @@ hcv_expand_processing_instruction(Hcv_template_data*templdata, const std::string
     HCV_FATALOUT("hcv_expand_processing_instruction: corrupted procinstr='" << procinstr
                  << "' in " << (filename?:"**??**")
                  << ":" << lineno << " @" << offset);
-  std::string arg(procstr+endpos, endpi-(procstr+endpos));
-  std::lock_guard<std::recursive_mutex> gu(hcv_template_mtx);
-  auto it = hcv_template_expander_dict.find(std::string(namebuf));
-  if (it == hcv_template_expander_dict.end())
+  auto dict = std::atomic_load(&hcv_template_expander_dict);
+  auto it = dict->find(name);
+  if (it == dict->end())
     {
-      if (auto httptempl = dynamic_cast<Hcv_http_template_data*>(templdata))
-        HCV_SYSLOGOUT(LOG_WARNING,"hcv_expand_processing_instruction: unknown namebuf='"
-                      << namebuf << "' for HTTP request "
-                      << httptempl->request_method()
-                      << " on " << httptempl->request_path());
-      else
-        HCV_SYSLOGOUT(LOG_WARNING,"hcv_expand_processing_instruction: unknown namebuf='" << namebuf);
+      hcv_warn_unknown_expander(templdata, name);
       return;
     };
-  hcv_template_expanding_closure_t clos = it->second;
-  return clos(templdata,procinstr,filename,lineno,offset);
+  return it->second(templdata,procinstr,filename,lineno,offset);
 } // end hcv_expand_processing_instruction
 
 
 const unsigned hcv_max_template_size = 128*1024;
 
 
-std::string
-hcv_expand_template_file(const std::string& srcfilepath, Hcv_template_data* templdata)
+//////////////// compiled templates
+//// A template file is parsed once into a vector of segments, each
+//// being either some verbatim text or a <?hcv ...?> processing
+//// instruction.  Compiled templates are cached by path, and
+//// recompiled when the file device, inode, size or mtime changes.
+//// Processing instructions are bound to their expander closure at
+//// compile time, and rebound when the expander generation changes.
+struct hcv_template_segment_st
+{
+  std::string hcvseg_text;	// literal text, or whole procinstr
+  bool hcvseg_is_pi;		// true for a processing instruction
+  int hcvseg_lineno;
+  long hcvseg_offset;
+  std::string hcvseg_name;	// expander name of processing instruction
+  hcv_template_expanding_closure_t hcvseg_closure; // bound expander, or empty
+  std::string hcvseg_deflated;	// raw deflate of literal text, for gzip
+  unsigned long hcvseg_crc;	// CRC32 of literal text
+  std::string hcvseg_msgid;	// message id of a <?hcv msg ...?>, or empty
+  std::string hcvseg_rawmsg;	// its default text
+  unsigned hcvseg_traceid;	// trace name of the expander
+};
+
+/// A compiled template with <?hcv msg ...?> processing instructions
+/// gets per-language variants, built at first rendering for a given
+/// ranking of negotiated languages. Messages are resolved once and
+/// folded into the surrounding literals, precompressed again, so
+/// rendering a localized page only concatenates literals and expands
+/// the other processing instructions.
+struct hcv_template_variant_st
+{
+  long hcvtv_chunkgen;		// chunk map generation of the resolutions
+  size_t hcvtv_literal_size;
+  std::vector<hcv_template_segment_st> hcvtv_segments;
+};
+
+typedef std::map<std::string,std::shared_ptr<const hcv_template_variant_st>> hcv_template_variant_map_t;
+
+/// copy-on-write snapshot of the variants of a compiled template,
+/// keyed by the comma separated language ranking
+struct hcv_template_variant_cache_st
+{
+  std::mutex hcvtvc_mtx;
+  std::shared_ptr<const hcv_template_variant_map_t> hcvtvc_map
+    = std::make_shared<const hcv_template_variant_map_t>();
+};
+
+#define HCV_TEMPLATE_MAX_VARIANTS 32
+
+struct hcv_compiled_template_st
+{
+  std::string hcvctpl_path;
+  dev_t hcvctpl_dev;
+  ino_t hcvctpl_ino;
+  off_t hcvctpl_size;
+  struct timespec hcvctpl_mtim;
+  long hcvctpl_expgen;		// expander generation of the bindings
+  size_t hcvctpl_literal_size;	// total size of literal segments
+  bool hcvctpl_deflated;	// literal segments are precompressed
+  std::vector<hcv_template_segment_st> hcvctpl_segments;
+  /// null without any <?hcv msg ...?>
+  std::shared_ptr<hcv_template_variant_cache_st> hcvctpl_variants;
+};
+
+/// the cache is also an immutable snapshot, replaced under
+/// hcv_compiled_template_mtx after a compilation, so that a cache hit
+/// takes no lock.
+typedef std::map<std::string,std::shared_ptr<const hcv_compiled_template_st>> hcv_compiled_template_map_t;
+static std::shared_ptr<const hcv_compiled_template_map_t> hcv_compiled_template_cache
+  = std::make_shared<const hcv_compiled_template_map_t>();
+static std::recursive_mutex hcv_compiled_template_mtx;
+/// extra bytes reserved for expanded processing instructions
+static const size_t hcv_template_expansion_slack = 4096;
+
+/// the layout of the last HTML template rendered by the current thread
+/// for a client accepting gzip: the offset of each literal segment in
+/// its output. Used by hcv_template_gzip_last_rendering.
+struct hcv_rendering_layout_st
+{
+  const httplib::Response* hcvrl_response;
+  std::shared_ptr<const hcv_compiled_template_st> hcvrl_template;
+  std::shared_ptr<const hcv_template_variant_st> hcvrl_variant;
+  size_t hcvrl_size;		// total size of the rendered output
+  std::vector<std::pair<size_t,const hcv_template_segment_st*>> hcvrl_literals;
+};
+static thread_local hcv_rendering_layout_st hcv_last_rendering;
+static std::atomic<long> hcv_compiled_template_hits;
+static std::atomic<long> hcv_compiled_template_misses;
+static std::atomic<long> hcv_template_variant_hits;
+static std::atomic<long> hcv_template_variant_builds;
+
+
+static void
+hcv_template_add_literal(std::vector<hcv_template_segment_st>&segvec, const char*str, size_t len)
+{
+  if (len == 0)
+    return;
+  if (!segvec.empty() && !segvec.back().hcvseg_is_pi)
+    segvec.back().hcvseg_text.append(str, len);
+  else
+    segvec.push_back(hcv_template_segment_st{std::string(str, len), false, 0, 0, "", nullptr, "", 0, "", "", 0});
+} // end hcv_template_add_literal
+
+
+static void
+hcv_bind_template_expanders(hcv_compiled_template_st&ctpl)
+{
+  /// load the generation before the dictionary: the bindings are at
+  /// least as recent as the recorded generation
+  ctpl.hcvctpl_expgen = hcv_template_expander_generation.load();
+  auto dict = std::atomic_load(&hcv_template_expander_dict);
+  for (hcv_template_segment_st& seg: ctpl.hcvctpl_segments)
+    {
+      if (!seg.hcvseg_is_pi)
+        continue;
+      auto it = dict->find(seg.hcvseg_name);
+      if (it != dict->end())
+        seg.hcvseg_closure = it->second;
+      else
+        seg.hcvseg_closure = nullptr;
+    }
+} // end hcv_bind_template_expanders
+
+
+/// parse once the message id and default text of a <?hcv msg ...?>
+static void
+hcv_template_parse_msg(hcv_template_segment_st&seg)
+{
+  char msgidbuf[40];
+  memset (msgidbuf, 0, sizeof(msgidbuf));
+  int endp = -1;
+  if (sscanf(seg.hcvseg_text.c_str(), "<?hcv msg %38[A-Za-z0-9_] %n", msgidbuf, &endp) < 1
+      || endp <= 0 || !isalpha(msgidbuf[0]))
+    return;
+  size_t endmsg = seg.hcvseg_text.rfind("?>");
+  if (endmsg == std::string::npos || endmsg < (size_t)endp)
+    return;
+  seg.hcvseg_msgid.assign(msgidbuf);
+  seg.hcvseg_rawmsg = seg.hcvseg_text.substr(endp, endmsg-endp);
+} // end hcv_template_parse_msg
+
+
+/// The single template scanner, working on a contiguous buffer.  It
+/// splits lines with memchr, and looks for <?hcv with memchr on '<'.
+/// A processing instruction should end on the same line.  When
+/// keepdoctype, lines starting with <! in the first 8 lines are kept
+/// verbatim (e.g. <!DOCTYPE html> or some <!-- html comment -->).
+static std::shared_ptr<hcv_compiled_template_st>
+hcv_compile_template_buffer(std::string_view srcbuf, const std::string&inpname, bool keepdoctype)
+{
+  HCV_TRACE_SPAN("template compile");
+  static const char hcvpistart[] = "<?hcv ";
+  const size_t hcvpistartlen = sizeof(hcvpistart)-1;
+  auto ctpl = std::make_shared<hcv_compiled_template_st>();
+  ctpl->hcvctpl_path = inpname;
+  ctpl->hcvctpl_dev = 0;
+  ctpl->hcvctpl_ino = 0;
+  ctpl->hcvctpl_size = srcbuf.size();
+  ctpl->hcvctpl_mtim = {0,0};
+  ctpl->hcvctpl_expgen = 0;
+  ctpl->hcvctpl_deflated = false;
+  auto& segvec = ctpl->hcvctpl_segments;
+  const char*bufstart = srcbuf.data();
+  const char*bufend = bufstart + srcbuf.size();
+  const char*linstart = bufstart;
+  int lincnt = 0;
+  while (linstart < bufend)
+    {
+      lincnt++;
+      const char*eol = (const char*) memchr(linstart, '\n', bufend-linstart);
+      const char*linend = eol?eol:bufend;
+      long off = linstart - bufstart;
+      const char*curpc = linstart;
+      if (keepdoctype && lincnt < 8 && linend-linstart > 4
+          && linstart[0]=='<' && linstart[1]=='!')
+        curpc = linend;
+      while (curpc < linend)
+        {
+          const char*startpi = (const char*) memchr(curpc, '<', linend-curpc);
+          while (startpi
+                 && ((size_t)(linend-startpi) < hcvpistartlen
+                     || memcmp(startpi, hcvpistart, hcvpistartlen)))
+            startpi = (const char*) memchr(startpi+1, '<', linend-(startpi+1));
+          if (!startpi)
+            break;
+          const char*endpi = (const char*) memmem(startpi+hcvpistartlen,
+                                                  linend-(startpi+hcvpistartlen),
+                                                  "?>", 2);
+          if (!endpi)
+            {
+              HCV_SYSLOGOUT(LOG_WARNING,
+                            "hcv_compile_template_buffer: " << inpname
+                            << ":" << lincnt
+                            << " line has unclosed template markup:" << std::endl
+                            << std::string(linstart, linend-linstart));
+              break;
+            }
+          hcv_template_add_literal(segvec, curpc, startpi-curpc);
+          std::string procinstr(startpi, (endpi+2)-startpi);
+          std::string name;
+          if (hcv_parse_processing_instruction_name(procinstr, name) < 0)
+            HCV_SYSLOGOUT(LOG_WARNING,
+                          "hcv_compile_template_buffer: " << inpname
+                          << ":" << lincnt
+                          << " invalid procinstr='" << procinstr << "'");
+          segvec.push_back(hcv_template_segment_st{procinstr, true, lincnt, off,
+                                                   name, nullptr, "", 0, "", "",
+                                                   hcv_trace_intern("expander " + name)});
+          if (name == "msg")
+            hcv_template_parse_msg(segvec.back());
+          curpc = endpi+2;
+        } // end while curpc < linend
+      hcv_template_add_literal(segvec, curpc, linend-curpc);
+      hcv_template_add_literal(segvec, "\n", 1);
+      linstart = linend+1;
+    };
+  ctpl->hcvctpl_literal_size = 0;
+  for (const hcv_template_segment_st& seg: segvec)
+    {
+      if (!seg.hcvseg_is_pi)
+        ctpl->hcvctpl_literal_size += seg.hcvseg_text.size();
+      else if (!seg.hcvseg_msgid.empty() && !ctpl->hcvctpl_variants)
+        ctpl->hcvctpl_variants = std::make_shared<hcv_template_variant_cache_st>();
+    }
+  hcv_bind_template_expanders(*ctpl);
+  HCV_DEBUGOUT("hcv_compile_template_buffer " << inpname
+               << " compiled " << srcbuf.size() << " bytes in "
+               << lincnt << " lines into "
+               << segvec.size() << " segments");
+  return ctpl;
+} // end hcv_compile_template_buffer
+
+
+static void
+hcv_template_deflate_literals(std::vector<hcv_template_segment_st>&segvec)
+{
+  for (hcv_template_segment_st& seg: segvec)
+    if (!seg.hcvseg_is_pi)
+      {
+        seg.hcvseg_deflated = hcv_raw_deflate_sync_flush(seg.hcvseg_text.data(),
+                              seg.hcvseg_text.size());
+        seg.hcvseg_crc = crc32(crc32(0L, Z_NULL, 0),
+                               reinterpret_cast<const Bytef*>(seg.hcvseg_text.data()),
+                               seg.hcvseg_text.size());
+      }
+} // end hcv_template_deflate_literals
+
+
+/// throws a std::runtime_error when the file cannot be read, so that
+/// hcv_rebuild_template_cache can keep the previous compiled template
+static std::shared_ptr<const hcv_compiled_template_st>
+hcv_compile_template_file(const std::string& srcfilepath, const struct stat&srcfilestat)
+{
+  /// read the whole file in one read syscall, usually
+  int fd = open(srcfilepath.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    throw std::runtime_error("hcv_compile_template_file: cannot open " + srcfilepath
+                             + " (" + strerror(errno) + ")");
+  std::string srcbuf(srcfilestat.st_size, '\0');
+  size_t nbread = 0;
+  while (nbread < srcbuf.size())
+    {
+      ssize_t nb = read(fd, srcbuf.data()+nbread, srcbuf.size()-nbread);
+      if (nb < 0 && errno == EINTR)
+        continue;
+      if (nb < 0)
+        {
+          int err = errno;
+          close(fd);
+          throw std::runtime_error("hcv_compile_template_file: failed to read " + srcfilepath
+                                   + " (" + strerror(err) + ")");
+        }
+      if (nb == 0)
+        break;
+      nbread += nb;
+    }
+  close(fd);
+  srcbuf.resize(nbread);
+  auto ctpl = hcv_compile_template_buffer(srcbuf, srcfilepath, true);
+  /// compress once the literal segments, so that gzip-ed responses
+  /// only need to compress the expanded processing instructions
+  hcv_template_deflate_literals(ctpl->hcvctpl_segments);
+  ctpl->hcvctpl_deflated = true;
+  ctpl->hcvctpl_dev = srcfilestat.st_dev;
+  ctpl->hcvctpl_ino = srcfilestat.st_ino;
+  ctpl->hcvctpl_size = srcfilestat.st_size;
+  ctpl->hcvctpl_mtim = srcfilestat.st_mtim;
+  return ctpl;
+} // end hcv_compile_template_file
+
+
+static std::shared_ptr<const hcv_compiled_template_st>
+hcv_get_compiled_template(const std::string& srcfilepath)
 {
   struct stat srcfilestat;
   memset (&srcfilestat, 0, sizeof(srcfilestat));
-  if (srcfilepath.empty())
-    HCV_FATALOUT("hcv_expand_template_file with empty srcfilepath");
-  if (srcfilepath[0] != '/')
-    HCV_SYSLOGOUT(LOG_WARNING,
-                  "hcv_expand_template_file with relative path: " << srcfilepath);
   if (stat(srcfilepath.c_str(), &srcfilestat))
     HCV_FATALOUT("hcv_expand_template_file: stat failure on source file " << srcfilepath);
   if (!S_ISREG(srcfilestat.st_mode))
@@ -365,67 +721,332 @@ hcv_expand_template_file(const std::string& srcfilepath, Hcv_template_data* temp
     HCV_FATALOUT("hcv_expand_template_file: source file " << srcfilepath
                  << " is too big: "
                  << (long)srcfilestat.st_size << " bytes.");
+  std::shared_ptr<const hcv_compiled_template_st> ctpl;
+  {
+    auto cache = std::atomic_load(&hcv_compiled_template_cache);
+    auto it = cache->find(srcfilepath);
+    if (it != cache->end())
+      {
+        auto& oldctpl = it->second;
+        if (oldctpl->hcvctpl_dev == srcfilestat.st_dev
+            && oldctpl->hcvctpl_ino == srcfilestat.st_ino
+            && oldctpl->hcvctpl_size == srcfilestat.st_size
+            && oldctpl->hcvctpl_mtim.tv_sec == srcfilestat.st_mtim.tv_sec
+            && oldctpl->hcvctpl_mtim.tv_nsec == srcfilestat.st_mtim.tv_nsec)
+          {
+            if (oldctpl->hcvctpl_expgen == hcv_template_expander_generation.load())
+              {
+                hcv_compiled_template_hits++;
+                return oldctpl;
+              }
+            /// some expander was registered or forgotten, rebind
+            auto newctpl = std::make_shared<hcv_compiled_template_st>(*oldctpl);
+            hcv_bind_template_expanders(*newctpl);
+            /// variants hold bound expanders too
+            if (newctpl->hcvctpl_variants)
+              newctpl->hcvctpl_variants = std::make_shared<hcv_template_variant_cache_st>();
+            ctpl = newctpl;
+          }
+      }
+  }
+  /// compile outside of the lock, a concurrent compilation of the
+  /// same file is harmless: the last one wins.
+  if (!ctpl)
+    {
+      hcv_compiled_template_misses++;
+      try
+        {
+          ctpl = hcv_compile_template_file(srcfilepath, srcfilestat);
+        }
+      catch (std::exception&exc)
+        {
+          HCV_FATALOUT("hcv_expand_template_file: " << exc.what());
+        }
+    }
+  std::lock_guard<std::recursive_mutex> gu(hcv_compiled_template_mtx);
+  auto newcache = std::make_shared<hcv_compiled_template_map_t>(*std::atomic_load(&hcv_compiled_template_cache));
+  (*newcache)[srcfilepath] = ctpl;
+  std::atomic_store(&hcv_compiled_template_cache,
+                    std::shared_ptr<const hcv_compiled_template_map_t>(newcache));
+  return ctpl;
+} // end hcv_get_compiled_template
 
-  auto outp = dynamic_cast<std::ostringstream*>(templdata->output_stream());
-  if (outp == nullptr)
-    HCV_FATALOUT("hcv_expand_template_file: bad templdata->output_stream()");
 
-  //std::ostringstream *outp = outstrptr;
-  std::ifstream srcinp(srcfilepath);
-  int lincnt = 0;
-  bool gotpe = false;
-  long off=0;
-  for (std::string linbuf; (off=srcinp.tellg()), std::getline(srcinp, linbuf); )
+
+void
+hcv_clear_template_cache(void)
+{
+  std::lock_guard<std::recursive_mutex> gu(hcv_compiled_template_mtx);
+  HCV_DEBUGOUT("hcv_clear_template_cache forgetting "
+               << std::atomic_load(&hcv_compiled_template_cache)->size() << " compiled templates");
+  std::atomic_store(&hcv_compiled_template_cache,
+                    std::make_shared<const hcv_compiled_template_map_t>());
+} // end hcv_clear_template_cache
+
+
+
+/// on SIGHUP, recompile every cached template aside, so that requests
+/// keep using the old compiled templates and never compile themselves.
+/// Vanished files are dropped; a template failing to compile keeps its
+/// previous compiled version.
+void
+hcv_rebuild_template_cache(void)
+{
+  auto oldcache = std::atomic_load(&hcv_compiled_template_cache);
+  auto newcache = std::make_shared<hcv_compiled_template_map_t>();
+  std::set<std::string> droppedset;
+  double startim = hcv_monotonic_real_time();
+  for (auto& it: *oldcache)
     {
-      gotpe = false;
-      lincnt++;
-      if (linbuf.empty())
+      const std::string& srcfilepath = it.first;
+      struct stat srcfilestat;
+      memset (&srcfilestat, 0, sizeof(srcfilestat));
+      if (stat(srcfilepath.c_str(), &srcfilestat)
+          || !S_ISREG(srcfilestat.st_mode)
+          || srcfilestat.st_size > hcv_max_template_size)
         {
-          *outp << std::endl;
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_rebuild_template_cache dropping template "
+                        << srcfilepath);
+          droppedset.insert(srcfilepath);
           continue;
         }
-      /// skip <!DOCTYPE html> or <!-- html comment --> in first 8 lines
-      if (lincnt < 8 && linbuf.size()>4 && linbuf[0]=='<' && linbuf[1]=='!')
+      try
         {
-          *outp << linbuf << std::endl;
-          continue;
+          (*newcache)[srcfilepath] = hcv_compile_template_file(srcfilepath, srcfilestat);
+        }
+      catch (std::exception&exc)
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_rebuild_template_cache keeps the previous "
+                        << srcfilepath << ": " << exc.what());
+          (*newcache)[srcfilepath] = it.second;
+        }
+    }
+  std::lock_guard<std::recursive_mutex> gu(hcv_compiled_template_mtx);
+  /// keep the templates compiled by requests during the rebuild
+  for (auto& it: *std::atomic_load(&hcv_compiled_template_cache))
+    if (newcache->find(it.first) == newcache->end()
+        && droppedset.find(it.first) == droppedset.end())
+      newcache->insert(it);
+  std::atomic_store(&hcv_compiled_template_cache,
+                    std::shared_ptr<const hcv_compiled_template_map_t>(newcache));
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_rebuild_template_cache recompiled " << newcache->size()
+                << " templates in " << (hcv_monotonic_real_time() - startim) << " seconds");
+} // end hcv_rebuild_template_cache
+
+
+void
+hcv_template_cache_statistics(long*phits, long*pmisses, long*pnbentries)
+{
+  if (phits)
+    *phits = hcv_compiled_template_hits.load();
+  if (pmisses)
+    *pmisses = hcv_compiled_template_misses.load();
+  if (pnbentries)
+    *pnbentries = (long) std::atomic_load(&hcv_compiled_template_cache)->size();
+} // end hcv_template_cache_statistics
+
+
+void
+hcv_template_variant_statistics(long*phits, long*pbuilds)
+{
+  if (phits)
+    *phits = hcv_template_variant_hits.load();
+  if (pbuilds)
+    *pbuilds = hcv_template_variant_builds.load();
+} // end hcv_template_variant_statistics
+
+
+
+/// get, or build then remember, the variant of a compiled template
+/// for the languages negotiated by some HTTP request
+static std::shared_ptr<const hcv_template_variant_st>
+hcv_get_template_variant(const hcv_compiled_template_st&ctpl, Hcv_http_template_data*httptempl)
+{
+  hcv_template_variant_cache_st& vcache = *ctpl.hcvctpl_variants;
+  auto langs = httptempl->request_languages();
+  std::string key;
+  for (const std::string& lang: *langs)
+    {
+      if (!key.empty())
+        key.push_back(',');
+      key.append(lang);
+    }
+  long chunkgen = hcv_chunkmap_generation();
+  {
+    auto vmap = std::atomic_load(&vcache.hcvtvc_map);
+    auto it = vmap->find(key);
+    if (it != vmap->end() && it->second->hcvtv_chunkgen == chunkgen)
+      {
+        hcv_template_variant_hits++;
+        return it->second;
+      }
+  }
+  hcv_template_variant_builds++;
+  HCV_TRACE_SPAN("template variant build");
+  auto variant = std::make_shared<hcv_template_variant_st>();
+  variant->hcvtv_chunkgen = chunkgen;
+  variant->hcvtv_literal_size = 0;
+  auto& segvec = variant->hcvtv_segments;
+  const char*pathcstr = ctpl.hcvctpl_path.c_str();
+  for (const hcv_template_segment_st& seg: ctpl.hcvctpl_segments)
+    {
+      if (!seg.hcvseg_is_pi)
+        hcv_template_add_literal(segvec, seg.hcvseg_text.data(), seg.hcvseg_text.size());
+      else if (!seg.hcvseg_msgid.empty())
+        {
+          std::string msg = hcv_view_resolve_msg(seg.hcvseg_msgid.c_str(), *langs, seg.hcvseg_rawmsg,
+                                                 pathcstr, seg.hcvseg_lineno);
+          hcv_template_add_literal(segvec, msg.data(), msg.size());
         }
-      const char*linestr= linbuf.c_str();
-      const char*startpi = nullptr;
-      const char*curpc = linestr;
-      while (curpc && (startpi = strstr(curpc, "<?hcv ")) != nullptr)
+      else
+        segvec.push_back(seg);
+    }
+  for (const hcv_template_segment_st& seg: segvec)
+    if (!seg.hcvseg_is_pi)
+      variant->hcvtv_literal_size += seg.hcvseg_text.size();
+  if (ctpl.hcvctpl_deflated)
+    hcv_template_deflate_literals(segvec);
+  HCV_DEBUGOUT("hcv_get_template_variant " << ctpl.hcvctpl_path << " for languages '" << key
+               << "' has " << segvec.size() << " segments");
+  std::lock_guard<std::mutex> gu(vcache.hcvtvc_mtx);
+  auto newmap = std::make_shared<hcv_template_variant_map_t>(*std::atomic_load(&vcache.hcvtvc_map));
+  if (newmap->size() >= HCV_TEMPLATE_MAX_VARIANTS)
+    newmap->clear();
+  (*newmap)[key] = variant;
+  std::atomic_store(&vcache.hcvtvc_map,
+                    std::shared_ptr<const hcv_template_variant_map_t>(newmap));
+  return variant;
+} // end hcv_get_template_variant
+
+
+/// render some compiled template into the output stream of templdata,
+/// and return all that output.
+static std::string
+hcv_render_compiled_template(const std::shared_ptr<const hcv_compiled_template_st>&ctplptr, Hcv_template_data* templdata)
+{
+  HCV_TRACE_SPAN("template render");
+  const hcv_compiled_template_st&ctpl = *ctplptr;
+  if (!templdata || templdata->kind() == Hcv_template_data::TmplKind_en::hcvtk_none)
+    HCV_FATALOUT("hcv_render_compiled_template: missing templdata for " << ctpl.hcvctpl_path);
+  /// template data output into a Hcv_string_ostream, whose contents
+  /// are moved out; other ones should use a std::ostringstream
+  std::ostream* outp = templdata->output_stream();
+  auto outstrp = dynamic_cast<Hcv_string_ostream*>(outp);
+  auto outsstrp = outstrp?nullptr:dynamic_cast<std::ostringstream*>(outp);
+  if (outstrp == nullptr && outsstrp == nullptr)
+    HCV_FATALOUT("hcv_render_compiled_template: bad templdata->output_stream() for "
+                 << ctpl.hcvctpl_path);
+  auto httptempl = dynamic_cast<Hcv_http_template_data*>(templdata);
+  /// a localized page renders its variant, with messages already folded
+  std::shared_ptr<const hcv_template_variant_st> variant;
+  const std::vector<hcv_template_segment_st>* segvec = &ctpl.hcvctpl_segments;
+  if (httptempl && httptempl->request() && ctpl.hcvctpl_variants
+      && hcv_template_msg_builtin.load())
+    {
+      variant = hcv_get_template_variant(ctpl, httptempl);
+      segvec = &variant->hcvtv_segments;
+    }
+  if (outstrp)
+    outstrp->reserve(outstrp->size()
+                     + (variant?variant->hcvtv_literal_size:ctpl.hcvctpl_literal_size)
+                     + hcv_template_expansion_slack);
+  /// remember the layout of precompressed literals for gzip
+  std::vector<std::pair<size_t,const hcv_template_segment_st*>>* literalsvec = nullptr;
+  hcv_last_rendering.hcvrl_template.reset();
+  hcv_last_rendering.hcvrl_variant.reset();
+  if (outstrp && ctpl.hcvctpl_deflated && httptempl)
+    if (httptempl->request() && httptempl->response()
+        && hcv_request_accepts_gzip(*httptempl->request()))
+      {
+        hcv_last_rendering.hcvrl_response = httptempl->response();
+        hcv_last_rendering.hcvrl_literals.clear();
+        literalsvec = &hcv_last_rendering.hcvrl_literals;
+      }
+  const char*pathcstr = ctpl.hcvctpl_path.c_str();
+  for (const hcv_template_segment_st& seg: *segvec)
+    {
+      if (seg.hcvseg_is_pi)
         {
-          const char*endpi = strstr(curpc+strlen("<?hcv "), "?>");
-          if (endpi == nullptr)
+          if (seg.hcvseg_closure)
             {
-              HCV_SYSLOGOUT(LOG_WARNING,
-                            "hcv_expand_template_file: " << srcfilepath
-                            << ":" << lincnt
-                            << " line has unclosed template markup:" << std::endl
-                            << linbuf);
-              *outp << std::string(curpc);
-              curpc = nullptr;
-              break;
+              HCV_TRACE_SPAN_ID(seg.hcvseg_traceid);
+              seg.hcvseg_closure(templdata, seg.hcvseg_text, pathcstr,
+                                 seg.hcvseg_lineno, seg.hcvseg_offset);
             }
-          else
-            {
-              std::string before(curpc, startpi-curpc);
-              *outp << before;
-              std::string procinstr(startpi, (endpi+2)-startpi);
-              hcv_expand_processing_instruction(templdata, procinstr, srcfilepath.c_str(), lincnt, off);
-              curpc = endpi+2;
-              gotpe = true;
-            };
-          if (gotpe)
-            *outp << std::flush;
-        } // end while curpc && (startpi=....)
-      if (curpc && !startpi)
-        *outp << curpc;
-      *outp << std::endl;
-    };
-  outp->flush();
+          else if (!seg.hcvseg_name.empty())
+            hcv_warn_unknown_expander(templdata, seg.hcvseg_name);
+        }
+      else
+        {
+          if (literalsvec)
+            literalsvec->push_back({outstrp->size(), &seg});
+          outp->write(seg.hcvseg_text.data(), seg.hcvseg_text.size());
+        }
+    }
+  if (literalsvec)
+    {
+      hcv_last_rendering.hcvrl_template = ctplptr;
+      hcv_last_rendering.hcvrl_variant = variant;
+      hcv_last_rendering.hcvrl_size = outstrp->size();
+    }
+  if (outstrp)
+    return outstrp->take_string();
+  outsstrp->flush();
+  return outsstrp->str();
+} // end hcv_render_compiled_template
+
+
+
+bool
+hcv_template_gzip_last_rendering(const httplib::Response*resp, const std::string&body, std::string&gzbody)
+{
+  hcv_rendering_layout_st&lay = hcv_last_rendering;
+  if (!resp || !lay.hcvrl_template || lay.hcvrl_response != resp
+      || lay.hcvrl_size != body.size())
+    return false;
+  Hcv_gzip_builder gzb(body.size()/3);
+  size_t curoff = 0;
+  bool ok = true;
+  for (auto& litpair: lay.hcvrl_literals)
+    {
+      size_t litoff = litpair.first;
+      const hcv_template_segment_st&seg = *litpair.second;
+      /// the body might have been modified after rendering
+      if (litoff < curoff
+          || body.compare(litoff, seg.hcvseg_text.size(), seg.hcvseg_text) != 0)
+        {
+          ok = false;
+          break;
+        }
+      gzb.add_stored(body.data()+curoff, litoff-curoff);
+      gzb.add_deflated(seg.hcvseg_deflated, seg.hcvseg_crc, seg.hcvseg_text.size());
+      curoff = litoff + seg.hcvseg_text.size();
+    }
+  if (ok)
+    {
+      gzb.add_stored(body.data()+curoff, body.size()-curoff);
+      gzbody = gzb.finish();
+    }
+  lay.hcvrl_template.reset();
+  lay.hcvrl_variant.reset();
+  lay.hcvrl_literals.clear();
+  lay.hcvrl_response = nullptr;
+  return ok;
+} // end hcv_template_gzip_last_rendering
+
+
 
-  return outp->str();
+std::string
+hcv_expand_template_file(const std::string& srcfilepath, Hcv_template_data* templdata)
+{
+  if (srcfilepath.empty())
+    HCV_FATALOUT("hcv_expand_template_file with empty srcfilepath");
+  if (srcfilepath[0] != '/')
+    HCV_SYSLOGOUT(LOG_WARNING,
+                  "hcv_expand_template_file with relative path: " << srcfilepath);
+  std::shared_ptr<const hcv_compiled_template_st> ctpl
+    = hcv_get_compiled_template(srcfilepath);
+  return hcv_render_compiled_template(ctpl, templdata);
 } // end hcv_expand_template_file
 
 
@@ -434,53 +1055,18 @@ hcv_expand_template_input_stream(std::istream&srcinp, const char*inpname, Hcv_te
 {
   if (!inpname)
     inpname = "??*null*??";
-  std::ostringstream outp;
-  int lincnt = 0;
-  bool gotpe = false;
-  long off=0;
-  for (std::string linbuf; (off=srcinp.tellg()), std::getline(srcinp, linbuf); )
+  std::string srcbuf;
+  char rdbuf[4096];
+  while (srcinp.read(rdbuf, sizeof(rdbuf)), srcinp.gcount() > 0)
     {
-      gotpe = false;
-      lincnt++;
-      if (off > hcv_max_template_size)
+      srcbuf.append(rdbuf, srcinp.gcount());
+      if (srcbuf.size() > hcv_max_template_size)
         HCV_FATALOUT("hcv_expand_template_input_stream: source input " << inpname
                      << " is too big: "
-                     << (long)off << " bytes.");
-      const char*linestr= linbuf.c_str();
-      const char*startpi = nullptr;
-      const char*curpc = linestr;
-      while (curpc && (startpi = strstr(curpc, "<?hcv ")) != nullptr)
-        {
-          const char*endpi = strstr(curpc+strlen("<?hcv "), "?>");
-          if (endpi == nullptr)
-            {
-              HCV_SYSLOGOUT(LOG_WARNING,
-                            "hcv_expand_template_input_stream: " << inpname
-                            << ":" << lincnt
-                            << " line has unclosed template markup:" << std::endl
-                            << linbuf);
-              outp << std::string(curpc);
-              curpc = nullptr;
-              break;
-            }
-          else
-            {
-              std::string before(curpc, startpi-curpc);
-              outp << before;
-              std::string procinstr(startpi, (endpi+2)-startpi);
-              hcv_expand_processing_instruction(templdata, procinstr, inpname, lincnt, off);
-              curpc = endpi+2;
-              gotpe = true;
-            };
-          if (gotpe)
-            outp << std::flush;
-        } // end while curpc && (startpi=....)
-      if (curpc && !startpi)
-        outp << curpc;
-      outp<<std::endl;
+                     << (long)srcbuf.size() << " bytes.");
     }
-  outp.flush();
-  return outp.str();
+  auto ctpl = hcv_compile_template_buffer(srcbuf, inpname, false);
+  return hcv_render_compiled_template(ctpl, templdata);
 } // end hcv_expand_template_input_stream
 
 
@@ -488,11 +1074,18 @@ hcv_expand_template_input_stream(std::istream&srcinp, const char*inpname, Hcv_te
 std::string
 hcv_expand_template_string(const std::string&inpstr, const char*inpname, Hcv_template_data*templdata)
 {
-  std::istringstream inp(inpstr);
-  return hcv_expand_template_input_stream(inp,inpname,templdata);
+  if (!inpname)
+    inpname = "??*null*??";
+  if (inpstr.size() > hcv_max_template_size)
+    HCV_FATALOUT("hcv_expand_template_string: source input " << inpname
+                 << " is too big: "
+                 << (long)inpstr.size() << " bytes.");
+  auto ctpl = hcv_compile_template_buffer(inpstr, inpname, false);
+  return hcv_render_compiled_template(ctpl, templdata);
 } // end hcv_expand_template_input_string
 
 
+
 void
 hcv_initialize_templates(void)
 {
@@ -575,7 +1168,11 @@ hcv_initialize_templates(void)
         return;
       }
     if (auto pouts = templdata->output_stream())
-      *pouts << hcv_get_config_html(std::string(confname));
+      {
+        hcv_snapshot_ref_t confref;
+        std::string_view confhtml = hcv_get_config_html_view(confname, confref);
+        pouts->write(confhtml.data(), confhtml.size());
+      }
     else
       HCV_SYSLOGOUT(LOG_WARNING, "no output stream for '<?hcv now?>' processing instruction in "
                     << filename << ":" << lineno<< " @" << offset);
@@ -966,6 +1563,8 @@ hcv_initialize_templates(void)
                     << filename << ":" << lineno<< " @" << offset
                     << std::endl << procinstr);
   }); // end  <?hcv msg ...?>
+  /// our msg expander may be folded into per-language template variants
+  hcv_template_msg_builtin.store(true);
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv confmsg ...?>
   hcv_register_template_expander_closure
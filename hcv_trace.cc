@@ -0,0 +1,319 @@
+/****************************************************************
+ * file hcv_trace.cc
+ *
+ * Description:
+ *      Binary tracing of timed spans of https://github.com/bstarynk/helpcovid
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+
+extern "C" const char hcv_trace_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcv_trace_date[] = __DATE__;
+
+std::atomic<bool> hcv_tracing;
+
+/// While tracing, every Hcv_trace_span (see HCV_TRACE_SPAN) appends
+/// one fixed size record to a ring owned by its thread, without any
+/// lock.  The background thread dumps the rings about once per second
+/// into the trace file, as blocks appended to it, each being:
+///
+///   8 bytes magic "HCVTRAC1"
+///   uint32 number of names, uint32 number of records,
+///   uint32 pid, uint32 zero, double wall clock time of process start,
+///   then each name as uint32 length and bytes (the name of id #i is the
+///   i-th one), then the records, as hcv_trace_record_st.
+///
+/// in native (x86-64, so little endian) byte order.  See the
+/// print-trace.py script.  A full ring drops its spans, and counts them.
+#define HCV_TRACE_RING_SIZE 4096 /* records per thread, a power of two */
+#define HCV_TRACE_MAX_NAMES 4096
+#define HCV_TRACE_DUMP_PERIOD 1.0 /*seconds*/
+
+struct hcv_trace_record_st
+{
+  uint32_t hctrec_name;		// interned name id
+  uint32_t hctrec_tid;		// Linux thread id
+  int64_t hctrec_reqnum;	// current web request number, or 0
+  double hctrec_start;		// seconds since hcv_monotonic_start_time
+  double hctrec_real;		// elapsed real time, in seconds
+  double hctrec_cpu;		// elapsed CPU time of the thread, in seconds
+  uint32_t hctrec_depth;	// number of enclosing spans
+  uint32_t hctrec_pad;
+};
+static_assert(sizeof(hcv_trace_record_st) == 48, "unexpected size of trace record");
+
+struct hcv_trace_ring_st
+{
+  std::atomic<unsigned long> hctring_head; // by the owning thread
+  std::atomic<unsigned long> hctring_tail; // by the dumper
+  std::atomic<bool> hctring_orphan;	   // the owning thread has exited
+  uint32_t hctring_tid;
+  hcv_trace_record_st hctring_records[HCV_TRACE_RING_SIZE];
+};
+
+struct hcv_trace_ring_owner_st
+{
+  hcv_trace_ring_st*hctown_ring;
+  ~hcv_trace_ring_owner_st()
+  {
+    if (hctown_ring)
+      hctown_ring->hctring_orphan.store(true, std::memory_order_release);
+  };
+};
+
+static thread_local hcv_trace_ring_owner_st hcv_trace_thread_owner;
+static thread_local unsigned hcv_trace_depth;
+static thread_local long hcv_trace_request;
+
+static std::mutex hcv_trace_rings_mtx;
+static std::vector<hcv_trace_ring_st*> hcv_trace_rings;
+
+static std::mutex hcv_trace_names_mtx;
+static std::deque<std::string> hcv_trace_names {"?"};
+static std::unordered_map<std::string,unsigned> hcv_trace_name_map {{"?", 0}};
+
+/// serializes the dumps, and protects the trace file and its path
+static std::mutex hcv_trace_dump_mtx;
+static std::string hcv_trace_path;
+static FILE* hcv_trace_file;
+static double hcv_trace_last_dump_time;
+
+static std::atomic<long> hcv_trace_spans;
+static std::atomic<long> hcv_trace_dropped;
+
+
+unsigned
+hcv_trace_intern(const std::string&name)
+{
+  std::lock_guard<std::mutex> gu(hcv_trace_names_mtx);
+  auto it = hcv_trace_name_map.find(name);
+  if (it != hcv_trace_name_map.end())
+    return it->second;
+  if (hcv_trace_names.size() >= HCV_TRACE_MAX_NAMES)
+    return 0;
+  unsigned id = hcv_trace_names.size();
+  hcv_trace_names.push_back(name);
+  hcv_trace_name_map.insert({name, id});
+  return id;
+} // end hcv_trace_intern
+
+
+void
+hcv_trace_set_request(long reqnum)
+{
+  hcv_trace_request = reqnum;
+} // end hcv_trace_set_request
+
+
+unsigned
+hcv_trace_enter(void)
+{
+  return hcv_trace_depth++;
+} // end hcv_trace_enter
+
+
+static hcv_trace_ring_st*
+hcv_trace_thread_ring(void)
+{
+  hcv_trace_ring_st* ring = hcv_trace_thread_owner.hctown_ring;
+  if (HCV_LIKELY(ring != nullptr))
+    return ring;
+  ring = new hcv_trace_ring_st;
+  ring->hctring_head.store(0);
+  ring->hctring_tail.store(0);
+  ring->hctring_orphan.store(false);
+  ring->hctring_tid = (uint32_t) syscall(SYS_gettid);
+  {
+    std::lock_guard<std::mutex> gu(hcv_trace_rings_mtx);
+    hcv_trace_rings.push_back(ring);
+  }
+  hcv_trace_thread_owner.hctown_ring = ring;
+  return ring;
+} // end hcv_trace_thread_ring
+
+
+void
+hcv_trace_record_span(unsigned nameid, unsigned depth, double startime, double startcpu)
+{
+  double endcpu = hcv_thread_cpu_time();
+  double endtime = hcv_monotonic_real_time();
+  hcv_trace_depth = depth;
+  hcv_trace_ring_st* ring = hcv_trace_thread_ring();
+  unsigned long head = ring->hctring_head.load(std::memory_order_relaxed);
+  if (HCV_UNLIKELY(head - ring->hctring_tail.load(std::memory_order_acquire)
+                   >= HCV_TRACE_RING_SIZE))
+    {
+      hcv_trace_dropped++;
+      return;
+    }
+  hcv_trace_record_st& rec = ring->hctring_records[head % HCV_TRACE_RING_SIZE];
+  rec.hctrec_name = nameid;
+  rec.hctrec_tid = ring->hctring_tid;
+  rec.hctrec_reqnum = hcv_trace_request;
+  rec.hctrec_start = startime - hcv_monotonic_start_time;
+  rec.hctrec_real = endtime - startime;
+  rec.hctrec_cpu = endcpu - startcpu;
+  rec.hctrec_depth = depth;
+  rec.hctrec_pad = 0;
+  ring->hctring_head.store(head+1, std::memory_order_release);
+} // end hcv_trace_record_span
+
+
+/// move the records of every ring into recvec, with hcv_trace_dump_mtx
+/// locked, and free the drained rings of exited threads
+static void
+hcv_trace_collect_locked(std::vector<hcv_trace_record_st>&recvec)
+{
+  std::lock_guard<std::mutex> gu(hcv_trace_rings_mtx);
+  for (hcv_trace_ring_st* ring: hcv_trace_rings)
+    {
+      unsigned long tail = ring->hctring_tail.load(std::memory_order_relaxed);
+      unsigned long head = ring->hctring_head.load(std::memory_order_acquire);
+      for (; tail < head; tail++)
+        recvec.push_back(ring->hctring_records[tail % HCV_TRACE_RING_SIZE]);
+      ring->hctring_tail.store(tail, std::memory_order_release);
+    }
+  hcv_trace_rings.erase
+  (std::remove_if(hcv_trace_rings.begin(), hcv_trace_rings.end(),
+                  [](hcv_trace_ring_st*ring)
+  {
+    if (!ring->hctring_orphan.load(std::memory_order_acquire)
+        || ring->hctring_tail.load() != ring->hctring_head.load())
+      return false;
+    delete ring;
+    return true;
+  }),
+  hcv_trace_rings.end());
+} // end hcv_trace_collect_locked
+
+
+/// append one block to the trace file, with hcv_trace_dump_mtx locked
+static void
+hcv_trace_dump_locked(void)
+{
+  hcv_trace_last_dump_time = hcv_monotonic_real_time();
+  std::vector<hcv_trace_record_st> recvec;
+  hcv_trace_collect_locked(recvec);
+  if (recvec.empty() || !hcv_trace_file)
+    return;
+  std::vector<std::string> namevec;
+  {
+    std::lock_guard<std::mutex> gu(hcv_trace_names_mtx);
+    namevec.assign(hcv_trace_names.begin(), hcv_trace_names.end());
+  }
+  uint32_t head[4] =
+  {
+    (uint32_t)namevec.size(), (uint32_t)recvec.size(), (uint32_t)getpid(), 0
+  };
+  double wallstart = hcv_wallclock_real_time()
+                     - (hcv_monotonic_real_time() - hcv_monotonic_start_time);
+  bool ok = fwrite("HCVTRAC1", 8, 1, hcv_trace_file) == 1
+            && fwrite(head, sizeof(head), 1, hcv_trace_file) == 1
+            && fwrite(&wallstart, sizeof(wallstart), 1, hcv_trace_file) == 1;
+  for (const std::string& name: namevec)
+    {
+      uint32_t len = name.size();
+      ok = ok && fwrite(&len, sizeof(len), 1, hcv_trace_file) == 1
+           && (len == 0 || fwrite(name.data(), len, 1, hcv_trace_file) == 1);
+    }
+  ok = ok && fwrite(recvec.data(), sizeof(hcv_trace_record_st), recvec.size(),
+                    hcv_trace_file) == recvec.size();
+  if (!ok || fflush(hcv_trace_file))
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_trace_dump failed to write " << recvec.size()
+                  << " spans into " << hcv_trace_path);
+  hcv_trace_spans += recvec.size();
+} // end hcv_trace_dump_locked
+
+
+void
+hcv_set_trace_file(const std::string&tracepath)
+{
+  std::lock_guard<std::mutex> gu(hcv_trace_dump_mtx);
+  hcv_trace_path = tracepath;
+} // end hcv_set_trace_file
+
+
+bool
+hcv_start_tracing(void)
+{
+  std::lock_guard<std::mutex> gu(hcv_trace_dump_mtx);
+  if (hcv_tracing.load())
+    return true;
+  if (hcv_trace_path.empty())
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_start_tracing: no trace file, see --trace-file");
+      return false;
+    }
+  hcv_trace_file = fopen(hcv_trace_path.c_str(), "ae");
+  if (!hcv_trace_file)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_start_tracing: cannot open trace file " << hcv_trace_path);
+      return false;
+    }
+  /// forget spans recorded during some previous tracing
+  std::vector<hcv_trace_record_st> oldrecvec;
+  hcv_trace_collect_locked(oldrecvec);
+  hcv_trace_last_dump_time = hcv_monotonic_real_time();
+  hcv_tracing.store(true);
+  HCV_SYSLOGOUT(LOG_NOTICE, "hcv_start_tracing into " << hcv_trace_path);
+  return true;
+} // end hcv_start_tracing
+
+
+void
+hcv_stop_tracing(void)
+{
+  std::lock_guard<std::mutex> gu(hcv_trace_dump_mtx);
+  if (!hcv_tracing.exchange(false))
+    return;
+  hcv_trace_dump_locked();
+  if (hcv_trace_file)
+    fclose(hcv_trace_file), hcv_trace_file = nullptr;
+  HCV_SYSLOGOUT(LOG_NOTICE, "hcv_stop_tracing into " << hcv_trace_path
+                << " after " << hcv_trace_spans.load() << " spans, "
+                << hcv_trace_dropped.load() << " dropped");
+} // end hcv_stop_tracing
+
+
+/// called by the background thread after each poll
+void
+hcv_trace_periodic_dump(void)
+{
+  if (!hcv_tracing.load())
+    return;
+  std::lock_guard<std::mutex> gu(hcv_trace_dump_mtx);
+  if (hcv_monotonic_real_time() - hcv_trace_last_dump_time >= HCV_TRACE_DUMP_PERIOD)
+    hcv_trace_dump_locked();
+} // end hcv_trace_periodic_dump
+
+
+void
+hcv_trace_statistics(long*pnbspans, long*pnbdropped)
+{
+  if (pnbspans)
+    *pnbspans = hcv_trace_spans.load();
+  if (pnbdropped)
+    *pnbdropped = hcv_trace_dropped.load();
+} // end hcv_trace_statistics
+
+//////////////////// end of file hcv_trace.cc of github.com/bstarynk/helpcovid
@@ -63,6 +63,14 @@ hcv_login_view_post(const httplib::Request& req,  httplib::Response& resp, long
                << " email=" << email
                << " passwd=" << passwd
                << " status=" << status);
+  if (status)
+    {
+      long cookieid = hcv_web_persist_signed_cookie(&data);
+      long userid = (long) hcv_user_model_find_by_email(email);
+      std::string uuid = (userid > 0) ? hcv_web_open_session(&data, userid) : "";
+      HCV_DEBUGOUT("hcv_login_view_post req#" << reqnum << " cookieid=" << cookieid
+                   << " userid=" << userid << " session=" << uuid);
+    }
 
 #warning hcv_login_view_post should not wire-in French or English
   std::string msg_en = status ? "OK" : "Your e-mail address and password do not"
@@ -182,7 +190,9 @@ hcv_register_view_post(const httplib::Request& req,  httplib::Response& resp, lo
   auto phonestr = req.get_param_value("inputPhone");
   auto emailstr = req.get_param_value("inputEmail");
   auto agreestr = req.get_param_value("registerAgree");
-  auto cookiestr = req.get_header_value("Set-Cookie");
+  auto cookiestr = req.get_header_value("Cookie");
+  long cookieid = -1;
+  bool goodcookie = hcv_web_request_cookie(req, &cookieid);
   HCV_DEBUGOUT("hcv_register_view_post reqpath:" << req.path
                << " req#" << reqnum << std::endl
                << " .. regtoken=" << regtokenstr << std::endl
@@ -194,6 +204,7 @@ hcv_register_view_post(const httplib::Request& req,  httplib::Response& resp, lo
                << " .. phonestr=" << phonestr << std::endl
                << " .. emailstr=" << emailstr << std::endl
                << " .. cookiestr=" << cookiestr << std::endl
+               << " .. " << (goodcookie?"valid":"invalid") << " cookieid=" << cookieid << std::endl
               );
 #warning hcv_register_view_post incomplete
   HCV_SYSLOGOUT(LOG_WARNING,
@@ -228,10 +239,18 @@ hcv_profile_view_get(const httplib::Request& req, httplib::Response& resp,
   if (req.method != "GET")
     HCV_FATALOUT("hcv_profile_view_get() called with non GET request");
 
+  long userid = -1;
+  if (!hcv_web_request_session(req, &userid))
+    {
+      HCV_DEBUGOUT("hcv_profile_view_get req#" << reqnum
+                   << " without valid session, redirected to /");
+      resp.set_redirect("/");
+      return "";
+    }
   Hcv_http_template_data data(req, resp, reqnum);
   std::string thtml = hcv_get_web_root() + "html/profile.html";
   HCV_DEBUGOUT("hcv_profile_view_get reqpath:" << req.path
-               << " req#" << reqnum);
+               << " req#" << reqnum << " userid=" << userid);
 
   std::string str = hcv_expand_template_file(thtml, &data);
   HCV_DEBUGOUT("hcv_profile_view_get reqpath:" << req.path
@@ -240,6 +259,56 @@ hcv_profile_view_get(const httplib::Request& req, httplib::Response& resp,
 } // end hcv_profile_view_get
 
 
+/// resolve a message id, by the chunk map then dgettext(3), then the
+/// chunk map again with MSGID_lang for each of the given languages,
+/// else give its raw default text. Also used to fold <?hcv msg ...?>
+/// in per-language variants of compiled templates.
+std::string
+hcv_view_resolve_msg(const char*msgid, const std::vector<std::string>&langs,
+                     std::string_view rawmsg, const char*filename, int lineno)
+{
+  hcv_snapshot_ref_t chunkref;
+  std::string_view chunkent = hcv_get_chunkmap_view(msgid, chunkref);
+  if (!chunkent.empty())
+    {
+      HCV_DEBUGOUT("hcv_view_resolve_msg chunked msgid=" << msgid << " at "  << filename << ":" << lineno
+                   << " => " << chunkent);
+      return std::string(chunkent);
+    }
+  /// see http://man7.org/linux/man-pages/man7/locale.7.html
+  /// see http://man7.org/linux/man-pages/man5/locale.5.html
+  /// see http://man7.org/linux/man-pages/man3/dgettext.3.html
+  char* localizedmsg = dgettext(HCV_DGETTEXT_DOMAIN, msgid);
+  if (localizedmsg && strcmp(localizedmsg, msgid))
+    {
+      HCV_DEBUGOUT("hcv_view_resolve_msg msgid=" << msgid << " at "  << filename << ":" << lineno
+                   << " => " << localizedmsg);
+      return std::string(localizedmsg);
+    }
+  /// try MSGID_lang for each accepted language, best first
+  std::string langchunknam{msgid};
+  langchunknam.push_back('_');
+  size_t prefixlen = langchunknam.size();
+  for (const std::string& reqlang: langs)
+    {
+      langchunknam.resize(prefixlen);
+      langchunknam.append(reqlang);
+      std::string_view entry = hcv_get_chunkmap_view(langchunknam, chunkref);
+      if (!entry.empty())
+        {
+          HCV_DEBUGOUT("hcv_view_resolve_msg msgid=" << msgid << " at "  << filename << ":" << lineno
+                       << " => chunkentry " << langchunknam);
+          return std::string(entry);
+        }
+    }
+  HCV_SYSLOGOUT(LOG_NOTICE, "hcv_view_resolve_msg msgid=" << msgid << " at "  << filename << ":" << lineno
+                << " not found");
+  HCV_DEBUGOUT("hcv_view_resolve_msg msgid=" << msgid << " at "  << filename << ":" << lineno
+               << ":::" << rawmsg);
+  return std::string(rawmsg);
+} // end hcv_view_resolve_msg
+
+
 ///////////////////////////
 // message views - to emit some message (usually request specific, e.g. localized, or customized)
 ///////////////////////////////////////////////////////////////////////////////
@@ -263,43 +332,8 @@ hcv_view_expand_msg(Hcv_http_template_data*tdata, const std::string &procinstr,
       const char*begmsg = procinstr.c_str() + endp;
       const char*endmsg = strstr(begmsg, "?>");
       HCV_ASSERT(endmsg != nullptr);
-      std::string chunkent = hcv_get_chunkmap_entry(std::string(msgidbuf));
-      if (!chunkent.empty())
-        {
-          HCV_DEBUGOUT("hcv_view_expand_msg chunked msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                       << " => " << chunkent);
-          return chunkent;
-        }
-      /// see http://man7.org/linux/man-pages/man7/locale.7.html
-      /// see http://man7.org/linux/man-pages/man5/locale.5.html
-      /// see http://man7.org/linux/man-pages/man3/dgettext.3.html
-      char* localizedmsg = dgettext(HCV_DGETTEXT_DOMAIN, msgidbuf);
-      std::string reqlang = tdata->request_language();
-      std::string chunknam{msgidbuf};
-      std::string langchunknam = (reqlang.empty()?chunknam:(chunknam+"_"+reqlang));
-      std::string entry;
-      HCV_DEBUGOUT("hcv_view_expand_msg chunked langchunknam='" << langchunknam << "'");
-      if (localizedmsg && strcmp(localizedmsg, msgidbuf))
-        {
-          HCV_DEBUGOUT("hcv_view_expand_msg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                       << " => " << localizedmsg);
-          return std::string(localizedmsg);
-        }
-      else if (!(entry=hcv_get_chunkmap_entry(langchunknam)).empty())
-        {
-          HCV_DEBUGOUT("hcv_view_expand_msg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                       << " => chunkentry " << entry);
-          return entry;
-        }
-      else
-        {
-          HCV_SYSLOGOUT(LOG_NOTICE, "hcv_view_expand_msg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                        << " not found");
-          std::string rawmsg(begmsg, endmsg-begmsg);
-          HCV_DEBUGOUT("hcv_view_expand_msg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                       << ":::" << rawmsg);
-          return rawmsg;
-        }
+      return hcv_view_resolve_msg(msgidbuf, *tdata->request_languages(),
+                                  std::string_view(begmsg, endmsg-begmsg), filename, lineno);
     }
   else
     {
@@ -333,28 +367,17 @@ hcv_view_expand_confmsg(Hcv_http_template_data*tdata, const std::string &procins
       const char*begmsg = procinstr.c_str() + endp;
       const char*endmsg = strstr(begmsg, "?>");
       HCV_ASSERT(endmsg != nullptr);
-#if 0 && not_implemented_hcv_view_expand_confmsg
-      char* localizedmsg = dgettext(HCV_DGETTEXT_DOMAIN, msgidbuf);
-      if (localizedmsg && strcmp(localizedmsg, msgidbuf))
+      hcv_snapshot_ref_t confref;
+      std::string_view confmsg = hcv_get_config_message_view(msgidbuf, confref);
+      if (!confmsg.empty())
         {
           HCV_DEBUGOUT("hcv_view_expand_confmsg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                       << " => " << localizedmsg);
-          return std::string(localizedmsg);
+                       << " => " << confmsg);
+          return std::string(confmsg);
         }
-      else
-        {
-          HCV_SYSLOGOUT(LOG_NOTICE, "hcv_view_expand_confmsg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                        << " not found");
-          std::string rawmsg(begmsg, endmsg-begmsg);
-          HCV_DEBUGOUT("hcv_view_expand_confmsg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                       << ":::" << rawmsg);
-          return rawmsg;
-        };
-#endif  0 && not_implemented_hcv_view_expand_confmsg
-      //////////@@@@@@@@@@@@@@TODO
-#warning TODO: unimplemented hcv_view_expand_confmsg
-      HCV_FATALOUT("hcv_view_expand_confmsg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                   << " not implemented");
+      HCV_DEBUGOUT("hcv_view_expand_confmsg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
+                   << " not in [message], using default text");
+      return std::string(begmsg, endmsg-begmsg);
     }
   else
     {
@@ -27,6 +27,10 @@
 
 #include "hcv_header.hh"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif /*__x86_64__*/
+
 extern "C" const char hcv_web_gitid[] = HELPCOVID_GITID;
 extern "C" const char hcv_web_date[] = __DATE__;
 
@@ -60,15 +64,47 @@ static inline long
 hcv_incremented_request_counter(void)
 {
 #if __GNUC__ >= 9
-  return 1+std::atomic_fetch_add(&hcv_web_request_counter, 1);
+  long reqnum = 1+std::atomic_fetch_add(&hcv_web_request_counter, 1);
 #else
   //return __sync_fetch_and_add(&hcv_web_request_counter, 1);
-  return 1+__sync_fetch_and_add(reinterpret_cast<long*>(&hcv_web_request_counter),
-                                1L);
+  long reqnum = 1+__sync_fetch_and_add(reinterpret_cast<long*>(&hcv_web_request_counter),
+                                       1L);
 #endif /* __GNUC__ >= 9 */
+  /// later traced spans of this thread belong to that request
+  hcv_trace_set_request(reqnum);
+  return reqnum;
 } // end hcv_incremented_request_counter
 
 
+httplib::Server::Handler
+hcv_web_traced_handler(const char*spanname, const httplib::Server::Handler&handler)
+{
+  HCV_ASSERT(spanname != nullptr);
+  unsigned traceid = hcv_trace_intern(spanname);
+  Hcv_latency_histogram* hist = hcv_metrics_route_histogram(spanname);
+  return [=](const httplib::Request&req, httplib::Response&resp)
+  {
+    /// the builtin handlers number their request; those registered
+    /// by plugins thru Hcv_plugin_web_registrar do not
+    hcv_trace_set_request(0);
+    HCV_TRACE_SPAN_ID(traceid);
+    double startime = hcv_monotonic_real_time();
+    try
+      {
+        handler(req, resp);
+      }
+    catch (...)
+      {
+        hist->record(hcv_monotonic_real_time() - startime);
+        throw;
+      }
+    hist->record(hcv_monotonic_real_time() - startime);
+  };
+} // end hcv_web_traced_handler
+
+
+static void hcv_web_initialize_cookie_signing(void);
+
 /// this could be run with root privilege if we need to serve the :80
 /// HTTP TCP port. So be specially careful here!
 void hcv_initialize_web(const std::string&weburl, const std::string&webroot, const std::string&opensslcert, const std::string&opensslkey)
@@ -116,10 +152,12 @@ void hcv_initialize_web(const std::string&weburl, const std::string&webroot, con
     }
   hcv_weburl = weburl;
   hcv_webroot = webroot;
+  hcv_web_initialize_cookie_signing();
   hcv_json_builder["commentStyle"] = "None";
   hcv_json_builder["indentation"] = " ";
 
-  hcv_webserver->set_mount_point("/", webroot.c_str());
+  /// static files of the webroot are served from memory by
+  /// hcv_serve_static_file, in the last handler of hcv_webserver_run
 } // end hcv_initialize_web
 
 
@@ -127,10 +165,11 @@ void
 hcv_stop_web()
 {
   HCV_DEBUGOUT("start of hcv_stop_web");
-  HCV_ASSERT(hcv_webserver);
+  /// not deleted, since the main thread could still be leaving its
+  /// listen in hcv_webserver_run
+  if (!hcv_webserver)
+    return;
   hcv_webserver->stop();
-  delete hcv_webserver;
-  hcv_webserver = nullptr;
   HCV_SYSLOGOUT(LOG_NOTICE, "hcv_stop_web stopped the web service");
 } // end hcv_stop_web
 
@@ -142,33 +181,170 @@ hcv_initialize_webserver(void)
 #warning hcv_initialize_webserver unimplemented
 } // end of hcv_initialize_webserver
 
+//////////////// HTML encoding
+//// We search runs of bytes without any of <>&'" characters, 32 bytes
+//// at a time with AVX2 or 16 with SSE2 on x86-64, and copy each such
+//// clean run in bulk.  The search function is chosen once at startup.
+
+typedef size_t hcv_html_clean_span_sig_t(const char*str, size_t len);
+
+static inline bool
+hcv_is_html_special_char(char c)
+{
+  return c=='<' || c=='>' || c=='&' || c=='\'' || c=='\"';
+} // end hcv_is_html_special_char
+
+static size_t
+hcv_html_clean_span_scalar(const char*str, size_t len)
+{
+  size_t ix = 0;
+  while (ix < len && !hcv_is_html_special_char(str[ix]))
+    ix++;
+  return ix;
+} // end hcv_html_clean_span_scalar
+
+#if defined(__x86_64__)
+static size_t
+hcv_html_clean_span_sse2(const char*str, size_t len)
+{
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i gt = _mm_set1_epi8('>');
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i apos = _mm_set1_epi8('\'');
+  const __m128i quot = _mm_set1_epi8('\"');
+  size_t ix = 0;
+  for (; ix + 16 <= len; ix += 16)
+    {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str+ix));
+      __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)),
+                               _mm_or_si128(_mm_cmpeq_epi8(v, amp),
+                                            _mm_or_si128(_mm_cmpeq_epi8(v, apos),
+                                                _mm_cmpeq_epi8(v, quot))));
+      unsigned mask = (unsigned) _mm_movemask_epi8(m);
+      if (mask)
+        return ix + __builtin_ctz(mask);
+    }
+  return ix + hcv_html_clean_span_scalar(str+ix, len-ix);
+} // end hcv_html_clean_span_sse2
+
+__attribute__((target("avx2")))
+static size_t
+hcv_html_clean_span_avx2(const char*str, size_t len)
+{
+  const __m256i lt = _mm256_set1_epi8('<');
+  const __m256i gt = _mm256_set1_epi8('>');
+  const __m256i amp = _mm256_set1_epi8('&');
+  const __m256i apos = _mm256_set1_epi8('\'');
+  const __m256i quot = _mm256_set1_epi8('\"');
+  size_t ix = 0;
+  for (; ix + 32 <= len; ix += 32)
+    {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str+ix));
+      __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, gt)),
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(v, amp),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, apos),
+                                          _mm256_cmpeq_epi8(v, quot))));
+      unsigned mask = (unsigned) _mm256_movemask_epi8(m);
+      if (mask)
+        return ix + __builtin_ctz(mask);
+    }
+  return ix + hcv_html_clean_span_sse2(str+ix, len-ix);
+} // end hcv_html_clean_span_avx2
+#endif /*__x86_64__*/
+
+static hcv_html_clean_span_sig_t*
+hcv_html_select_clean_span(void)
+{
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return hcv_html_clean_span_avx2;
+  return hcv_html_clean_span_sse2;
+#else
+  return hcv_html_clean_span_scalar;
+#endif /*__x86_64__*/
+} // end hcv_html_select_clean_span
+
+static hcv_html_clean_span_sig_t* const hcv_html_clean_span
+  = hcv_html_select_clean_span();
+
+
+static inline const char*
+hcv_html_entity(char c)
+{
+  switch(c)
+    {
+    case '<':
+      return "&lt;";
+    case '>':
+      return "&gt;";
+    case '\'':
+      return "&apos;";
+    case '&':
+      return "&amp;";
+    case '\"':
+      return "&quot;";
+    default:
+      return nullptr;
+    }
+} // end hcv_html_entity
+
+
+static inline void
+hcv_append_encoded_html_with(hcv_html_clean_span_sig_t*spanfun,
+                             std::string&outstr, const char*str, size_t len)
+{
+  if (!str)
+    return;
+  outstr.reserve(outstr.size() + len + len/8);
+  while (len > 0)
+    {
+      size_t cleanlen = spanfun(str, len);
+      outstr.append(str, cleanlen);
+      if (cleanlen == len)
+        break;
+      outstr.append(hcv_html_entity(str[cleanlen]));
+      str += cleanlen+1;
+      len -= cleanlen+1;
+    }
+} // end hcv_append_encoded_html_with
+
+
 void
-hcv_output_encoded_html(std::ostream&out, const std::string&str)
+hcv_append_encoded_html(std::string&outstr, const char*str, size_t len)
+{
+  hcv_append_encoded_html_with(hcv_html_clean_span, outstr, str, len);
+} // end hcv_append_encoded_html
+
+
+/// the byte at a time reference encoder, for bench/hcvbench_escape.cc
+void
+hcv_append_encoded_html_scalar(std::string&outstr, const char*str, size_t len)
+{
+  hcv_append_encoded_html_with(hcv_html_clean_span_scalar, outstr, str, len);
+} // end hcv_append_encoded_html_scalar
+
+
+static void
+hcv_output_encoded_html_buffer(std::ostream&out, const char*str, size_t len)
 {
-  for (char c: str)
+  while (len > 0)
     {
-      switch(c)
-        {
-        case '<':
-          out << "&lt;";
-          break;
-        case '>':
-          out << "&gt;";
-          break;
-        case '\'':
-          out << "&apos;";
-          break;
-        case '&':
-          out << "&amp;";
-          break;
-        case '\"':
-          out << "&quot;";
-          break;
-        default:
-          out << c;
-          break;
-        }
+      size_t cleanlen = hcv_html_clean_span(str, len);
+      out.write(str, cleanlen);
+      if (cleanlen == len)
+        break;
+      out << hcv_html_entity(str[cleanlen]);
+      str += cleanlen+1;
+      len -= cleanlen+1;
     }
+} // end hcv_output_encoded_html_buffer
+
+
+void
+hcv_output_encoded_html(std::ostream&out, const std::string&str)
+{
+  hcv_output_encoded_html_buffer(out, str.data(), str.size());
 } // end hcv_output_encoded_html
 
 
@@ -177,30 +353,7 @@ hcv_output_cstr_encoded_html(std::ostream&out, const char*cstr)
 {
   if (!cstr)
     return;
-  for (const char*pc=cstr; *pc; pc++)
-    {
-      switch(*pc)
-        {
-        case '<':
-          out << "&lt;";
-          break;
-        case '>':
-          out << "&gt;";
-          break;
-        case '\'':
-          out << "&apos;";
-          break;
-        case '&':
-          out << "&amp;";
-          break;
-        case '\"':
-          out << "&quot;";
-          break;
-        default:
-          out << *pc;
-          break;
-        }
-    }
+  hcv_output_encoded_html_buffer(out, cstr, strlen(cstr));
 } // end hcv_output_cstr_encoded_html
 
 
@@ -288,6 +441,206 @@ hcv_web_extract_cookie_string(const std::string&str, long *id, char randomstr[HC
 
 
 static constexpr unsigned hcv_web_cookie_duration = 5400; // in seconds, so one hour and a half
+
+
+////////////////////////////////////////////////////////////////
+//// Signed web cookies.  When signed_cookies=true in the [web]
+//// configuration group, a fresh cookie is not written into
+//// tb_web_cookie: its random part holds instead its expiry time, in 8
+//// hexadecimal digits, then 16 base32 digits of an HMAC-SHA256 (80
+//// bits) over its id, expiry and web agent hash.  So it is checked
+//// without any database access.  The HMAC key comes from the
+//// cookie_secret of [web], or is random at each start (then signed
+//// cookies do not survive a restart of helpcovid).  The id is a
+//// process-wide serial, not a wcookie_id, until the user logs in:
+//// then hcv_web_persist_signed_cookie writes the cookie into
+//// tb_web_cookie and signs it again with its wcookie_id.
+static bool hcv_web_signed_cookies;
+static unsigned char hcv_web_cookie_key[64];
+static unsigned hcv_web_cookie_keylen;
+static std::atomic<long> hcv_web_signed_cookie_serial;
+#define HCV_WEBCOOKIE_MAC_WIDTH 16 /* base32 digits, so 80 bits */
+
+/// bounded cache of recently validated cookies, direct-mapped by hash
+struct hcv_validated_cookie_st
+{
+  std::string hcvvc_cookie;
+  time_t hcvvc_exptime;
+  int hcvvc_webagenthash;
+};
+#define HCV_VALIDATED_COOKIE_CACHE_SIZE 1024
+static std::mutex hcv_validated_cookie_mtx;
+static hcv_validated_cookie_st hcv_validated_cookie_cache[HCV_VALIDATED_COOKIE_CACHE_SIZE];
+
+
+static void
+hcv_web_initialize_cookie_signing(void)
+{
+  std::string secret;
+  hcv_config_do([&secret](const Glib::KeyFile*kf)
+  {
+    if (!kf->has_group("web"))
+      return;
+    if (kf->has_key("web", "signed_cookies"))
+      hcv_web_signed_cookies = kf->get_boolean("web", "signed_cookies");
+    if (kf->has_key("web", "cookie_secret"))
+      secret = kf->get_string("web", "cookie_secret");
+  });
+  if (!hcv_web_signed_cookies)
+    return;
+  if (secret.size() >= 16)
+    {
+      SHA256(reinterpret_cast<const unsigned char*>(secret.data()), secret.size(),
+             hcv_web_cookie_key);
+      hcv_web_cookie_keylen = SHA256_DIGEST_LENGTH;
+    }
+  else
+    {
+      if (!secret.empty())
+        HCV_SYSLOGOUT(LOG_WARNING, "hcv_web_initialize_cookie_signing: ignoring too short cookie_secret in [web]");
+      hcv_web_cookie_keylen = 32;
+      if (RAND_bytes(hcv_web_cookie_key, hcv_web_cookie_keylen) != 1)
+        HCV_FATALOUT("hcv_web_initialize_cookie_signing: RAND_bytes failed");
+    }
+  hcv_web_signed_cookie_serial.store(((long)time(nullptr) << 16)
+                                     | (Hcv_Random::random_32u() & 0xffff));
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_web_initialize_cookie_signing: web cookies are signed, "
+                << (secret.size()>=16?"with configured secret":"with random secret"));
+} // end hcv_web_initialize_cookie_signing
+
+
+/// compute the base32 MAC of a signed cookie into macbuf
+static void
+hcv_web_cookie_mac(long id, time_t exptime, int webhash,
+                   char macbuf[HCV_WEBCOOKIE_MAC_WIDTH+1])
+{
+  static constexpr const char base32chars[] = "abcdefghijklmnopqrstuvwxyz234567";
+  char msgbuf[64];
+  int msglen = snprintf(msgbuf, sizeof(msgbuf), "%lx:%lx:%x",
+                        id, (long)exptime, (unsigned)webhash);
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned mdlen = 0;
+  if (!HMAC(EVP_sha256(), hcv_web_cookie_key, hcv_web_cookie_keylen,
+            reinterpret_cast<const unsigned char*>(msgbuf), msglen, md, &mdlen))
+    HCV_FATALOUT("hcv_web_cookie_mac: HMAC failed");
+  /// 16 digits of 5 bits from the first 10 bytes of the digest
+  for (int ix=0; ix<HCV_WEBCOOKIE_MAC_WIDTH; ix++)
+    {
+      int bitpos = 5*ix;
+      unsigned twobytes = (md[bitpos/8] << 8) | md[bitpos/8+1];
+      macbuf[ix] = base32chars[(twobytes >> (11 - bitpos%8)) & 0x1f];
+    }
+  macbuf[HCV_WEBCOOKIE_MAC_WIDTH] = (char)0;
+} // end hcv_web_cookie_mac
+
+
+static int
+hcv_web_agent_hash(const httplib::Request&req)
+{
+  auto webagendit = req.headers.find("User-Agent");
+  if (webagendit == req.headers.end() || webagendit->second.empty())
+    return 0;
+  int webagenthash = std::hash<std::string> {}(webagendit->second);
+  if (webagenthash == 0)
+    webagenthash = webagendit->second.size();
+  return webagenthash;
+} // end hcv_web_agent_hash
+
+
+/// validate a cookie value, for the given request, and give its id
+bool
+hcv_web_validate_cookie(const std::string&cookiestr, const httplib::Request&req, long*pid)
+{
+  long id = 0;
+  int webhash = 0;
+  char randombuf[HCV_WEBCOOKIE_RANDOMSTR_WIDTH+4];
+  memset (randombuf, 0, sizeof(randombuf));
+  if (!hcv_web_extract_cookie_string(cookiestr, &id, randombuf, &webhash))
+    return false;
+  if (webhash != hcv_web_agent_hash(req))
+    return false;
+  time_t nowt = time(nullptr);
+  unsigned slot = std::hash<std::string> {}(cookiestr) % HCV_VALIDATED_COOKIE_CACHE_SIZE;
+  {
+    std::lock_guard<std::mutex> gu(hcv_validated_cookie_mtx);
+    const hcv_validated_cookie_st& vc = hcv_validated_cookie_cache[slot];
+    if (vc.hcvvc_cookie == cookiestr && vc.hcvvc_webagenthash == webhash)
+      {
+        if (vc.hcvvc_exptime <= nowt)
+          return false;
+        if (pid)
+          *pid = id;
+        return true;
+      }
+  }
+  time_t exptime = 0;
+  if (hcv_web_signed_cookies)
+    {
+      char expbuf[12];
+      memset (expbuf, 0, sizeof(expbuf));
+      memcpy (expbuf, randombuf, 8);
+      char*endexp = nullptr;
+      exptime = (time_t) strtol(expbuf, &endexp, 16);
+      if (!endexp || *endexp)
+        return false;
+      char macbuf[HCV_WEBCOOKIE_MAC_WIDTH+1];
+      hcv_web_cookie_mac(id, exptime, webhash, macbuf);
+      if (CRYPTO_memcmp(macbuf, randombuf+8, HCV_WEBCOOKIE_MAC_WIDTH))
+        {
+          HCV_DEBUGOUT("hcv_web_validate_cookie bad MAC in " << cookiestr);
+          return false;
+        }
+    }
+  else
+    exptime = hcv_database_web_cookie_expiry(id, randombuf, webhash);
+  if (exptime <= nowt)
+    return false;
+  {
+    std::lock_guard<std::mutex> gu(hcv_validated_cookie_mtx);
+    hcv_validated_cookie_st& vc = hcv_validated_cookie_cache[slot];
+    vc.hcvvc_cookie = cookiestr;
+    vc.hcvvc_exptime = exptime;
+    vc.hcvvc_webagenthash = webhash;
+  }
+  if (pid)
+    *pid = id;
+  return true;
+} // end hcv_web_validate_cookie
+
+
+/// the value of some cookie, e.g. HCV_COOKIE_NAME, in the Cookie:
+/// request header, or an empty string
+static std::string
+hcv_web_find_request_cookie(const httplib::Request&req, const char*cookiename = HCV_COOKIE_NAME)
+{
+  std::string cookiehdr = req.get_header_value("Cookie");
+  std::string cookieprefix = std::string(cookiename) + "=";
+  size_t pos = 0;
+  while ((pos = cookiehdr.find(cookieprefix, pos)) != std::string::npos)
+    {
+      if (pos == 0 || cookiehdr[pos-1] == ' ' || cookiehdr[pos-1] == ';')
+        {
+          size_t start = pos + cookieprefix.size();
+          size_t end = cookiehdr.find(';', start);
+          return cookiehdr.substr(start, (end==std::string::npos)?end:end-start);
+        }
+      pos++;
+    }
+  return "";
+} // end hcv_web_find_request_cookie
+
+
+/// find and validate our HCV_COOKIE_NAME cookie in the Cookie: request header
+bool
+hcv_web_request_cookie(const httplib::Request&req, long*pid)
+{
+  std::string cookiestr = hcv_web_find_request_cookie(req);
+  if (cookiestr.empty())
+    return false;
+  return hcv_web_validate_cookie(cookiestr, req, pid);
+} // end hcv_web_request_cookie
+
+
 /// register a fresh cookie in the database and return it.
 /// see also https://tools.ietf.org/html/rfc6265
 #warning we may want to implement secure or httponly web cookies, see RFC6265
@@ -316,15 +669,23 @@ hcv_web_register_fresh_cookie(Hcv_http_template_data*htpl)
 		  << htpl->serial());
     return "";
   };
-  std::string webagentstr;
-  {
-    auto webagendit = hreq->headers.find("User-Agent");
-    if (webagendit != hreq->headers.end())
-      webagentstr = webagendit->second;
-  }
   auto reqnum = htpl->request_number();
+  int webagenthash = hcv_web_agent_hash(*hreq);
+  time_t expiret = 0;
+  if (time(&expiret)<0)
+    HCV_FATALOUT("hcv_web_register_fresh_cookie time(2) failed");
+  expiret += hcv_web_cookie_duration;
   char randombuf[HCV_WEBCOOKIE_RANDOMSTR_WIDTH+4];
   memset (randombuf, 0, sizeof(randombuf));
+  long id = -1;
+  if (hcv_web_signed_cookies) {
+    id = hcv_web_signed_cookie_serial++;
+    snprintf(randombuf, 9, "%08lx", (long)expiret);
+    hcv_web_cookie_mac(id, expiret, webagenthash, randombuf+8);
+    HCV_DEBUGOUT("hcv_web_register_fresh_cookie reqnum#" << reqnum
+		 << " signed id=" << id << " randombuf=" << randombuf);
+  }
+  else {
   for (unsigned ix=0; ix<HCV_WEBCOOKIE_RANDOMSTR_WIDTH; ix++) {
     char uc=0;
     uc = alphanumchars[Hcv_Random::random_quickly_8bits() % nbalphanum];
@@ -335,23 +696,14 @@ hcv_web_register_fresh_cookie(Hcv_http_template_data*htpl)
     }
     randombuf[ix] = uc;
   };
-  time_t expiret = 0;
-  if (time(&expiret)<0)
-    HCV_FATALOUT("hcv_web_register_fresh_cookie time(2) failed");
-  expiret += hcv_web_cookie_duration;
-  int webagenthash = 0;
-  if (!webagentstr.empty()) {
-    webagenthash = std::hash<std::string>{}(webagentstr);
-    if (webagenthash == 0)
-      webagenthash = webagentstr.size();
-  }
   HCV_DEBUGOUT("hcv_web_register_fresh_cookie reqnum#" << reqnum << " randombuf=" << randombuf
-	       << " expiret=" << expiret << " webagentstr='" << webagentstr
-	       << "', webagenthash=" << webagenthash);
-  long id = hcv_database_get_id_of_added_web_cookie(std::string(randombuf), expiret, webagenthash);
+	       << " expiret=" << expiret
+	       << ", webagenthash=" << webagenthash);
+  id = hcv_database_get_id_of_added_web_cookie(std::string(randombuf), expiret, webagenthash);
   HCV_DEBUGOUT("hcv_web_register_fresh_cookie reqnum#" << reqnum << " randombuf=" << randombuf
 	       << " webagenthash=" << webagenthash
 	       << " id=" << id);
+  }
   std::string res = hcv_web_make_cookie_string(id, randombuf, webagenthash);
   HCV_DEBUGOUT("hcv_web_register_fresh_cookie reqnum#" << reqnum << " gives " << res);
   char agebuf[32];
@@ -365,6 +717,72 @@ hcv_web_register_fresh_cookie(Hcv_http_template_data*htpl)
 } // end hcv_web_register_fresh_cookie
 
 
+/// Called when a session is opened, e.g. at login.  A signed cookie
+/// is then written into tb_web_cookie, with a provisional random
+/// string, and signed again with its wcookie_id; the new cookie is set
+/// in the response.  An unsigned cookie is already in tb_web_cookie.
+/// Without a valid cookie in the request, a fresh stored one is set.
+/// Gives the wcookie_id, or -1 on failure.
+long
+hcv_web_persist_signed_cookie(Hcv_http_template_data*htpl)
+{
+  if (!htpl || !htpl->request() || !htpl->response()) {
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_web_persist_signed_cookie: missing web request or response");
+    return -1;
+  }
+  const httplib::Request& hreq = *htpl->request();
+  auto reqnum = htpl->request_number();
+  std::string oldcookie = hcv_web_find_request_cookie(hreq);
+  long id = -1;
+  if (oldcookie.empty() || !hcv_web_validate_cookie(oldcookie, hreq, &id))
+    oldcookie.clear();
+  if (!hcv_web_signed_cookies) {
+    if (!oldcookie.empty())
+      return id;
+    std::string res = hcv_web_register_fresh_cookie(htpl);
+    if (res.empty() || !hcv_web_extract_cookie_string(res, &id, nullptr, nullptr))
+      return -1;
+    return id;
+  }
+  int webagenthash = hcv_web_agent_hash(hreq);
+  char randombuf[HCV_WEBCOOKIE_RANDOMSTR_WIDTH+4];
+  memset (randombuf, 0, sizeof(randombuf));
+  time_t expiret = 0;
+  if (!oldcookie.empty()) {
+    hcv_web_extract_cookie_string(oldcookie, nullptr, randombuf, nullptr);
+    /// already stored at some previous login
+    if (hcv_database_web_cookie_expiry(id, std::string(randombuf), webagenthash) > 0)
+      return id;
+    char expbuf[12];
+    memset (expbuf, 0, sizeof(expbuf));
+    memcpy (expbuf, randombuf, 8);
+    expiret = (time_t) strtol(expbuf, nullptr, 16);
+  }
+  else
+    expiret = time(nullptr) + hcv_web_cookie_duration;
+  snprintf(randombuf, sizeof(randombuf), "%08lx%016d", (long)expiret, 0);
+  id = hcv_database_get_id_of_added_web_cookie(std::string(randombuf), expiret, webagenthash);
+  if (id <= 0) {
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_web_persist_signed_cookie reqnum#" << reqnum
+		  << " failed to store cookie, id=" << id);
+    return -1;
+  }
+  hcv_web_cookie_mac(id, expiret, webagenthash, randombuf+8);
+  if (!hcv_database_set_web_cookie_random(id, std::string(randombuf)))
+    return -1;
+  std::string res = hcv_web_make_cookie_string(id, randombuf, webagenthash);
+  long maxage = (long) (expiret - time(nullptr));
+  char agebuf[32];
+  memset(agebuf, 0, sizeof(agebuf));
+  snprintf(agebuf, sizeof(agebuf), "; Max-Age=%ld", (maxage>0)?maxage:0L);
+  std::string cookiestr = std::string(HCV_COOKIE_NAME "=") + res + agebuf;
+  htpl->response()->set_header("Set-Cookie", cookiestr);
+  HCV_DEBUGOUT("hcv_web_persist_signed_cookie reqnum#" << reqnum
+	       << " stored id=" << id << " SETCOOKIE cookiestr=" << cookiestr);
+  return id;
+} // end hcv_web_persist_signed_cookie
+
+
 void
 hcv_web_forget_cookie(Hcv_http_template_data*htpl)
 {
@@ -395,7 +813,60 @@ hcv_web_forget_cookie(Hcv_http_template_data*htpl)
 	       << " path=" << hreq->path <<  " CLEARSETCOOKIE" << std::endl
 	       << forgetcookie << std::endl);
   hresp->set_header("Set-Cookie", forgetcookie);
+  /// forgetting the cookie also logs out
+  std::string uuid = hcv_web_find_request_cookie(*hreq, HCV_SESSION_COOKIE_NAME);
+  if (!uuid.empty()) {
+    hcv_session_close(uuid);
+    hresp->set_header("Set-Cookie", HCV_SESSION_COOKIE_NAME "=; Expires="
+		      HCV_HTTP_DATE_RFC822_LONG_TIME_AGO);
+    HCV_DEBUGOUT("hcv_web_forget_cookie reqnum#" << htpl->serial()
+		 << " closed session " << uuid);
+  }
 } // end of hcv_web_forget_cookie
+
+
+/// open a session, cached by hcv_session.cc, for an authenticated
+/// user, and set its HCV_SESSION_COOKIE_NAME cookie; gives its UUID
+std::string
+hcv_web_open_session(Hcv_http_template_data*htpl, long userid)
+{
+  if (!htpl || !htpl->request() || !htpl->response()) {
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_web_open_session: missing web request or response");
+    return "";
+  }
+  const httplib::Request& hreq = *htpl->request();
+  std::string uuid = hcv_session_open(userid, hreq.get_header_value("User-Agent"),
+				      hreq.remote_addr);
+  if (uuid.empty()) {
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_web_open_session reqnum#" << htpl->serial()
+		  << " failed for userid " << userid);
+    return "";
+  }
+  char agebuf[32];
+  memset(agebuf, 0, sizeof(agebuf));
+  snprintf(agebuf, sizeof(agebuf), "; Max-Age=%d", HCV_SESSION_DURATION);
+  std::string cookiestr = std::string(HCV_SESSION_COOKIE_NAME "=") + uuid + agebuf
+    + "; HttpOnly; SameSite=Strict";
+  htpl->response()->set_header("Set-Cookie", cookiestr);
+  HCV_DEBUGOUT("hcv_web_open_session reqnum#" << htpl->serial()
+	       << " userid=" << userid << " SETCOOKIE " << cookiestr);
+  return uuid;
+} // end hcv_web_open_session
+
+
+/// check the session of a request thru the session cache, and extend
+/// its expiry; gives its user id
+bool
+hcv_web_request_session(const httplib::Request&req, long*puserid)
+{
+  std::string uuid = hcv_web_find_request_cookie(req, HCV_SESSION_COOKIE_NAME);
+  if (uuid.empty())
+    return false;
+  if (!hcv_session_is_valid(uuid, req.get_header_value("User-Agent"),
+			    req.remote_addr, puserid))
+    return false;
+  return hcv_session_ping(uuid);
+} // end hcv_web_request_session
   
 ////////////////////////////////////////////////////////////////
 
@@ -431,6 +902,57 @@ hcv_web_get_json_status(const httplib::Request&req, httplib::Response& resp, lon
   if (procshared>0)
     jsob["process_shared"] = (Json::Value::Int)procshared;
   jsob["postgresql_version"] = hcv_postgresql_version();
+  {
+    hcv_database_pool_stats_st dbst = hcv_database_pool_statistics();
+    Json::Value jsdb(Json::objectValue);
+    jsdb["connections"] = (Json::Value::Int64)dbst.dbpool_size;
+    jsdb["idle"] = (Json::Value::Int64)dbst.dbpool_idle;
+    jsdb["checkouts"] = (Json::Value::Int64)dbst.dbpool_checkouts;
+    jsdb["waits"] = (Json::Value::Int64)dbst.dbpool_waits;
+    jsdb["total_wait_time"] = dbst.dbpool_total_wait;
+    jsdb["max_wait_time"] = dbst.dbpool_max_wait;
+    jsdb["reconnects"] = (Json::Value::Int64)dbst.dbpool_reconnects;
+    jsob["database_pool"] = jsdb;
+  }
+  {
+    Json::Value jspstm(Json::objectValue);
+    for (auto& pst: hcv_database_prepared_statement_statistics())
+      {
+        Json::Value jsst(Json::objectValue);
+        jsst["count"] = (Json::Value::Int64)pst.pstm_count;
+        jsst["errors"] = (Json::Value::Int64)pst.pstm_errors;
+        jsst["total_time"] = pst.pstm_total_time;
+        jsst["max_time"] = pst.pstm_max_time;
+        jspstm[pst.pstm_name] = jsst;
+      }
+    jsob["prepared_statements"] = jspstm;
+  }
+  {
+    hcv_session_cache_stats_st sessst = hcv_session_cache_statistics();
+    Json::Value jssess(Json::objectValue);
+    jssess["cached"] = (Json::Value::Int64)sessst.sesscache_size;
+    jssess["hits"] = (Json::Value::Int64)sessst.sesscache_hits;
+    jssess["misses"] = (Json::Value::Int64)sessst.sesscache_misses;
+    jssess["flushed_expiries"] = (Json::Value::Int64)sessst.sesscache_flushed;
+    jsob["session_cache"] = jssess;
+  }
+  jsob["postponed_tasks"] = (Json::Value::Int64)hcv_background_pending_count();
+  {
+    Json::Value jstcl(Json::objectValue);
+    for (auto& tcl: hcv_background_task_class_statistics())
+      {
+        Json::Value jscl(Json::objectValue);
+        jscl["limit"] = tcl.tcl_limit;
+        jscl["running"] = tcl.tcl_running;
+        jscl["queued"] = (Json::Value::Int64)tcl.tcl_queued;
+        jscl["completed"] = (Json::Value::Int64)tcl.tcl_completed;
+        jscl["average_wait"] = tcl.tcl_completed?(tcl.tcl_total_wait/tcl.tcl_completed):0.0;
+        jscl["max_wait"] = tcl.tcl_max_wait;
+        jscl["average_run"] = tcl.tcl_completed?(tcl.tcl_total_run/tcl.tcl_completed):0.0;
+        jstcl[tcl.tcl_name] = jscl;
+      }
+    jsob["task_classes"] = jstcl;
+  }
   time_t nowt = 0;
   time(&nowt);
   struct tm nowtm;
@@ -659,6 +1181,7 @@ hcv_webserver_run(void)
   });
   //////////////// /status.json serving
   hcv_webserver->Get("/status.json",
+                     hcv_web_traced_handler("GET /status.json",
                      [](const httplib::Request&req, httplib::Response& resp)
   {
     errno = 0;
@@ -668,10 +1191,18 @@ hcv_webserver_run(void)
        HCV_DEBUGOUT("status.json URL handling GET path '" << req.path
 		    << "' req#" << reqcnt);
        hcv_web_get_json_status(req, resp, reqcnt, startcputime, startmonotonictime);
-  });
+  }));
+  //////////////// /metrics serving, for Prometheus
+  hcv_webserver->Get("/metrics",
+                     hcv_web_traced_handler("GET /metrics",
+                     [](const httplib::Request&req, httplib::Response& resp)
+  {
+    hcv_web_get_metrics(req, resp);
+  }));
   ////////////////////////////////////////////////////////////////
   //////////////// /status.html serving
   hcv_webserver->Get("/status.html",
+                     hcv_web_traced_handler("GET /status.html",
                      [](const httplib::Request&req, httplib::Response& resp)
   {
     errno = 0;
@@ -681,12 +1212,13 @@ hcv_webserver_run(void)
        HCV_DEBUGOUT("status.html URL handling GET path '" << req.path
 		    << "' req#" << reqcnt);
     hcv_web_get_html_status(req, resp, reqcnt, startcputime, startmonotonictime);
-  });
+  }));
 
   ////////////////////////////////////////////////////////////////
   //////////////// /ajax/ serving
   hcv_webserver->Get
     ("/ajax/",
+     hcv_web_traced_handler("GET /ajax/",
      [](const httplib::Request&req, httplib::Response&)
      {
        errno = 0;
@@ -697,10 +1229,11 @@ hcv_webserver_run(void)
 		     "hcv_webserver_run AJAX GET request unimplemented path="
 		     << req.path);
 #warning hcv_webserver_run unimplemented AJAX GET
-		     });
+		     }));
 
   hcv_webserver->Post
     ("/ajax/",
+     hcv_web_traced_handler("POST /ajax/",
      [](const httplib::Request&req, httplib::Response&)
      {
        errno = 0;
@@ -711,11 +1244,12 @@ hcv_webserver_run(void)
 		     "hcv_webserver_run AJAX POST request unimplemented path="
 		     << req.path);
 #warning hcv_webserver_run unimplemented AJAX POST
-		     });
+		     }));
 		     
   ////////////////////////////////////////////////////////////////
   
-  hcv_webserver->Get("", [](const httplib::Request& req,
+  hcv_webserver->Get("", hcv_web_traced_handler("GET (empty)",
+                     [](const httplib::Request& req,
                              httplib::Response& resp)
   {
     errno = 0;
@@ -726,18 +1260,20 @@ hcv_webserver_run(void)
     htmlcont = hcv_home_view_get(req, resp, reqcnt);
     if (htmlcont.size() > HCV_HTML_RESPONSE_MAX_LEN)
       HCV_FATALOUT("root URL handling GET sending too many bytes " << htmlcont.size());
-    resp.set_content(htmlcont, "text/html");
-  });
-  hcv_webserver->Get("/", [](const httplib::Request& req,
+    hcv_web_set_compressible_content(req, resp, std::move(htmlcont), "text/html");
+  }));
+  hcv_webserver->Get("/", hcv_web_traced_handler("GET /",
+                     [](const httplib::Request& req,
                              httplib::Response& resp)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
     HCV_DEBUGOUT("root URL handling GET path '" << req.path
 		 << "' req#" << reqcnt);
-    resp.set_content(hcv_home_view_get(req, resp, reqcnt), "text/html");
-  });
-  hcv_webserver->Get("^/?$", [](const httplib::Request& req,
+    hcv_web_set_compressible_content(req, resp, hcv_home_view_get(req, resp, reqcnt), "text/html");
+  }));
+  hcv_webserver->Get("^/?$", hcv_web_traced_handler("GET ^/?$",
+                     [](const httplib::Request& req,
                              httplib::Response& resp)
   {
     errno = 0;
@@ -748,11 +1284,12 @@ hcv_webserver_run(void)
     htmlcont = hcv_home_view_get(req, resp, reqcnt);
     if (htmlcont.size() > HCV_HTML_RESPONSE_MAX_LEN)
       HCV_FATALOUT("root URL handling GET sending too many bytes " << htmlcont.size());
-    resp.set_content(htmlcont, "text/html");
-  });
+    hcv_web_set_compressible_content(req, resp, std::move(htmlcont), "text/html");
+  }));
 
   //////////////// /login/ serving
-  hcv_webserver->Get("/login", [](const httplib::Request& req,
+  hcv_webserver->Get("/login", hcv_web_traced_handler("GET /login",
+                     [](const httplib::Request& req,
                                   httplib::Response& resp)
   {
     errno = 0;
@@ -764,10 +1301,11 @@ hcv_webserver_run(void)
     if (htmlcont.size() > HCV_HTML_RESPONSE_MAX_LEN)
       HCV_FATALOUT("login URL handling POST sending too many bytes " << htmlcont.size());
     HCV_DEBUGOUT("login URL handling GET sending " << htmlcont.size() << " bytes in response");;
-    resp.set_content(htmlcont, "text/html");
-  });
+    hcv_web_set_compressible_content(req, resp, std::move(htmlcont), "text/html");
+  }));
   ///////
-  hcv_webserver->Post("/ajax/login", [](const httplib::Request& req, 
+  hcv_webserver->Post("/ajax/login", hcv_web_traced_handler("POST /ajax/login",
+                     [](const httplib::Request& req, 
                                    httplib::Response& resp)
   {
     errno = 0;
@@ -778,10 +1316,11 @@ hcv_webserver_run(void)
     jsoncont = hcv_login_view_post(req, resp, reqcnt);
     if (jsoncont.size() > HCV_JSON_RESPONSE_MAX_LEN)
       HCV_FATALOUT("login URL handling POST sending too many bytes " << jsoncont.size());
-    resp.set_content(jsoncont, "application/json");
-  });
+    hcv_web_set_compressible_content(req, resp, std::move(jsoncont), "application/json");
+  }));
   //////////////// /register/ serving
-  hcv_webserver->Get("/register", [](const httplib::Request& req,
+  hcv_webserver->Get("/register", hcv_web_traced_handler("GET /register",
+                     [](const httplib::Request& req,
                                   httplib::Response& resp)
   {
     long reqcnt = hcv_incremented_request_counter();
@@ -792,10 +1331,11 @@ hcv_webserver_run(void)
     if (htmlcont.size() > HCV_HTML_RESPONSE_MAX_LEN)
       HCV_FATALOUT("register URL handling POST sending too many bytes " << htmlcont.size());
     HCV_DEBUGOUT("register URL handling GET sending " << htmlcont.size() << " bytes in response");
-    resp.set_content(htmlcont, "text/html");
-  });
+    hcv_web_set_compressible_content(req, resp, std::move(htmlcont), "text/html");
+  }));
   ///////
-  hcv_webserver->Post("/register", [](const httplib::Request& req, 
+  hcv_webserver->Post("/register", hcv_web_traced_handler("POST /register",
+                     [](const httplib::Request& req, 
                                    httplib::Response& resp)
   {
     errno = 0;
@@ -807,11 +1347,12 @@ hcv_webserver_run(void)
     if (jsoncont.size() > HCV_JSON_RESPONSE_MAX_LEN)
       HCV_FATALOUT("register URL handling POST sending too many bytes " << jsoncont.size());
     HCV_DEBUGOUT("register URL handling POST sending " << jsoncont.size() << " bytes in response");
-    resp.set_content(jsoncont, "application/json");
-  });
+    hcv_web_set_compressible_content(req, resp, std::move(jsoncont), "application/json");
+  }));
   ////////////////////////////////////////////////////////////////
   
-  hcv_webserver->Get("/profile", [](const httplib::Request& req,
+  hcv_webserver->Get("/profile", hcv_web_traced_handler("GET /profile",
+                     [](const httplib::Request& req,
                                     httplib::Response& resp)
   {
     errno = 0;
@@ -823,11 +1364,12 @@ hcv_webserver_run(void)
       HCV_FATALOUT("profile GET view sent too many bytes: " << html.size());
 
     HCV_DEBUGOUT("profile GET view sent " << html.size() << " bytes");
-    resp.set_content(html, "text/html");
-  });
+    hcv_web_set_compressible_content(req, resp, std::move(html), "text/html");
+  }));
 
   //////////////// /images/ serving
-  hcv_webserver->Get("/images/", [](const httplib::Request& req,
+  hcv_webserver->Get("/images/", hcv_web_traced_handler("GET /images/",
+                     [](const httplib::Request& req,
                                   httplib::Response&)
   {
     errno = 0;
@@ -839,11 +1381,23 @@ hcv_webserver_run(void)
     HCV_SYSLOGOUT(LOG_WARNING,
 		  "hcv_webserver_run GET /images request unimplemented path="
 		  << req.path);
-  }); // end /images/ serving
+  })); // end /images/ serving
   ////////
   //////// initialize plugins, if any
   hcv_initialize_plugins_for_web(hcv_webserver);
   ////////////////////////////////////////////////////////////////
+  //////// static files of the webroot; this catch-all handler should
+  //////// stay the last one, after the plugins' handlers
+  hcv_webserver->Get(".*", hcv_web_traced_handler("GET .*",
+                     [](const httplib::Request& req,
+                              httplib::Response& resp)
+  {
+    errno = 0;
+    long reqcnt = hcv_incremented_request_counter();
+    if (!hcv_serve_static_file(req, resp, reqcnt))
+      resp.status = 404;
+  }));
+  ////////////////////////////////////////////////////////////////
   hcv_webserver->listen(webhost, webport);
   HCV_SYSLOGOUT(LOG_INFO, "end hcv_webserver_run webhost=" << webhost << " webport=" << webport);
 } // end hcv_webserver_run
@@ -36,15 +36,15 @@ const char hcvplugin_gitapi[]=HELPCOVID_GITID;
 
 /// mandatory initialization routine
 void
-hcvplugin_initialize_web(httplib::Server*,const char*arg)
+hcvplugin_initialize_web_registrar(Hcv_plugin_web_registrar&,const char*arg)
 {
   if (!arg)
     HCV_SYSLOGOUT(LOG_WARNING, "echo plugin " << hcvplugin_version
-                  << " hcvplugin_initialize_web without arguments");
+                  << " hcvplugin_initialize_web_registrar without arguments");
   else
     HCV_SYSLOGOUT(LOG_NOTICE, "echo plugin  " << hcvplugin_version
-                  << " hcvplugin_initialize_web got argument: " << arg);
-} // end of hcvplugin_initialize_web
+                  << " hcvplugin_initialize_web_registrar got argument: " << arg);
+} // end of hcvplugin_initialize_web_registrar
 
 
 /***************** end of example plugin hcvplugin_echo.cc in github.com/bstarynk/helpcovid */
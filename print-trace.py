@@ -0,0 +1,81 @@
+#!/usr/bin/python3
+
+# Helpcovid file print-trace.py -- see
+# https://github.com/bstarynk/helpcovid/ and hcv_trace.cc
+#
+# Print a summary of a binary trace file written by ./helpcovid
+# --trace-file=TRACEFILE (or after SIGUSR1): the time spent per span
+# name, and optionally the slowest web requests with their spans.
+
+
+
+import argparse
+import struct
+import sys
+
+
+
+BLOCK_HEADER = struct.Struct("=8sIIIId")
+NAME_LENGTH = struct.Struct("=I")
+RECORD = struct.Struct("=IIqdddII")
+
+
+
+def read_blocks(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    pos = 0
+    while pos < len(data):
+        magic, nbnames, nbrecords, pid, _, wallstart \
+            = BLOCK_HEADER.unpack_from(data, pos)
+        if magic != b"HCVTRAC1":
+            sys.exit("%s: bad block magic at offset %d" % (path, pos))
+        pos += BLOCK_HEADER.size
+        names = []
+        for _ in range(nbnames):
+            (length,) = NAME_LENGTH.unpack_from(data, pos)
+            pos += NAME_LENGTH.size
+            names.append(data[pos:pos+length].decode("utf-8", "replace"))
+            pos += length
+        for _ in range(nbrecords):
+            yield (pid, wallstart, names) + RECORD.unpack_from(data, pos)
+            pos += RECORD.size
+
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Summarize a helpcovid trace file")
+    parser.add_argument("tracefile")
+    parser.add_argument("--requests", type=int, default=0, metavar="N",
+                        help="also show the N slowest web requests and their spans")
+    args = parser.parse_args()
+
+    totals = {}
+    requests = {}
+    for (pid, wallstart, names, nameid, tid, reqnum,
+         start, real, cpu, depth, _) in read_blocks(args.tracefile):
+        name = names[nameid] if nameid < len(names) else "?"
+        count, sumreal, maxreal, sumcpu = totals.get(name, (0, 0.0, 0.0, 0.0))
+        totals[name] = (count+1, sumreal+real, max(maxreal, real), sumcpu+cpu)
+        if reqnum > 0:
+            requests.setdefault((pid, reqnum), []).append((start, depth, name, real, cpu))
+
+    print("%-40s %8s %12s %12s %12s" % ("span", "count", "avg ms", "max ms", "avg cpu ms"))
+    for name, (count, sumreal, maxreal, sumcpu) \
+            in sorted(totals.items(), key=lambda item: -item[1][1]):
+        print("%-40s %8d %12.3f %12.3f %12.3f"
+              % (name, count, 1e3*sumreal/count, 1e3*maxreal, 1e3*sumcpu/count))
+
+    if args.requests > 0:
+        slowest = sorted(requests.items(),
+                         key=lambda item: -max(span[3] for span in item[1]))
+        for (pid, reqnum), spans in slowest[:args.requests]:
+            print("\nrequest #%d of process %d" % (reqnum, pid))
+            for start, depth, name, real, cpu in sorted(spans):
+                print("  %10.6f %s%s %.3f ms (cpu %.3f ms)"
+                      % (start, "  "*depth, name, 1e3*real, 1e3*cpu))
+
+
+
+if __name__ == "__main__":
+    main()